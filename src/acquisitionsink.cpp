@@ -0,0 +1,66 @@
+#include "acquisitionsink.hpp"
+
+#include <sstream>
+
+DatasetSink::DatasetSink(std::string filename, std::string group)
+  : m_Dataset(filename.c_str(), group.c_str())
+{
+
+}
+
+DatasetSink::~DatasetSink()
+{
+
+}
+
+void DatasetSink::WriteHeader(const ISMRMRD::IsmrmrdHeader& h)
+{
+  std::stringstream str;
+  ISMRMRD::serialize(h, str);
+  m_Dataset.writeHeader(str.str());
+}
+
+void DatasetSink::AppendAcquisition(const ISMRMRD::Acquisition& acq)
+{
+  m_Dataset.appendAcquisition(acq);
+}
+
+
+StreamSink::StreamSink(std::string filename)
+  : m_File(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc),
+    m_View(m_File),
+    m_Serializer(m_View),
+    m_bClosed(false)
+{
+
+}
+
+StreamSink::~StreamSink()
+{
+  Close();
+}
+
+void StreamSink::WriteHeader(const ISMRMRD::IsmrmrdHeader& h)
+{
+  m_Serializer.serialize(h);
+  Flush();
+}
+
+void StreamSink::AppendAcquisition(const ISMRMRD::Acquisition& acq)
+{
+  m_Serializer.serialize(acq);
+  Flush();
+}
+
+void StreamSink::Flush()
+{
+  m_File.flush();
+}
+
+void StreamSink::Close()
+{
+  if (m_bClosed) return;
+  m_Serializer.close();
+  m_File.close();
+  m_bClosed = true;
+}
@@ -0,0 +1,73 @@
+/*****************************************************
+ *
+ *  Output targets for converted acquisitions
+ *
+ *  The converter writes the ISMRMRD header and
+ *  acquisitions through an AcquisitionSink so that the
+ *  main loop does not care whether the output is an
+ *  HDF5 dataset or an ISMRMRD stream.
+ *
+ *****************************************************/
+
+#ifndef ACQUISITION_SINK_HPP
+#define ACQUISITION_SINK_HPP
+
+#include <string>
+#include <fstream>
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/xml.h"
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/serialization.h"
+#include "ismrmrd/serialization_iostream.h"
+
+class AcquisitionSink
+{
+public:
+  virtual ~AcquisitionSink() {}
+
+  virtual void WriteHeader(const ISMRMRD::IsmrmrdHeader& h) = 0;
+  virtual void AppendAcquisition(const ISMRMRD::Acquisition& acq) = 0;
+
+  /* Make everything appended so far visible to readers */
+  virtual void Flush() {}
+  virtual void Close() {}
+};
+
+/* Writes to an ISMRMRD HDF5 dataset */
+class DatasetSink : public AcquisitionSink
+{
+public:
+  DatasetSink(std::string filename, std::string group);
+  ~DatasetSink();
+
+  void WriteHeader(const ISMRMRD::IsmrmrdHeader& h);
+  void AppendAcquisition(const ISMRMRD::Acquisition& acq);
+
+protected:
+  ISMRMRD::Dataset m_Dataset;
+};
+
+/* Writes the ISMRMRD streaming protocol to a file or named pipe,
+   each acquisition is flushed as soon as it has been appended */
+class StreamSink : public AcquisitionSink
+{
+public:
+  StreamSink(std::string filename);
+  ~StreamSink();
+
+  bool IsOpen() { return m_File.is_open(); }
+
+  void WriteHeader(const ISMRMRD::IsmrmrdHeader& h);
+  void AppendAcquisition(const ISMRMRD::Acquisition& acq);
+  void Flush();
+  void Close();
+
+protected:
+  std::ofstream m_File;
+  ISMRMRD::OStreamView m_View;
+  ISMRMRD::ProtocolSerializer m_Serializer;
+  bool m_bClosed;
+};
+
+#endif //ACQUISITION_SINK_HPP
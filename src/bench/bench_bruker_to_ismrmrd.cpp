@@ -0,0 +1,272 @@
+// bench_bruker_to_ismrmrd.cpp
+// End-to-end conversion throughput of bruker_to_ismrmrd on synthetic
+// ParaVision datasets, for a matrix of dataset configurations, output
+// modes and thread counts. With --baseline it is a regression test that
+// fails when a case is slower than the checked-in throughput.
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+#include "syntheticdataset.hpp"
+#include "brukerfidfollower.hpp"
+
+#ifndef BRUKER_TO_ISMRMRD_PATH
+#define BRUKER_TO_ISMRMRD_PATH "bruker_to_ismrmrd"
+#endif
+
+namespace po = boost::program_options;
+
+struct OutputMode
+{
+  std::string name;
+  std::string arguments;
+  std::string thread_option;  /* empty if the mode does not take a thread count */
+  bool preview;               /* also writes a --preview next to the output */
+};
+
+static std::vector<std::string> SplitList(std::string list)
+{
+  std::vector<std::string> items;
+  std::stringstream s(list);
+  std::string item;
+  while (std::getline(s, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+/* Host name, CPU model and cores, recorded in written baselines */
+static std::string DescribeMachine()
+{
+  char hostname[256] = "";
+  if (gethostname(hostname, sizeof(hostname) - 1) != 0) hostname[0] = 0;
+
+  std::string cpu = "unknown CPU";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos) {
+      cpu = line.substr(line.find(':') + 1);
+      cpu.erase(0, cpu.find_first_not_of(" \t"));
+      break;
+    }
+  }
+
+  std::stringstream s;
+  s << (hostname[0] ? hostname : "unknown host") << ", " << cpu << ", " << std::thread::hardware_concurrency() << " cores";
+  return s.str();
+}
+
+/* Baseline entries are "dataset<TAB>mode<TAB>threads<TAB>MB/s", lines starting with # are comments */
+static std::string BaselineKey(const std::string& dataset, const std::string& mode, const std::string& threads)
+{
+  return dataset + "\t" + mode + "\t" + threads;
+}
+
+static bool ReadBaseline(std::string filename, std::map<std::string, double>& baseline)
+{
+  std::ifstream f(filename.c_str());
+  if (!f) {
+    std::cerr << "Unable to read baseline " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(f, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::string::size_type tab = line.rfind('\t');
+    if (tab == std::string::npos) continue;
+    baseline[line.substr(0, tab)] = atof(line.substr(tab + 1).c_str());
+  }
+  return true;
+}
+
+static std::vector<SyntheticDataset> DatasetMatrix(unsigned int scale)
+{
+  std::vector<SyntheticDataset> cases;
+  SyntheticDataset d;
+
+  d.samples = 256; d.phase_encodes = 256; d.channels = 1; d.repetitions = 8*scale;
+  d.format = BrukerRawDataProfile::GO_32BIT_SGN_INT;
+  cases.push_back(d);
+
+  d = SyntheticDataset();
+  d.samples = 256; d.phase_encodes = 256; d.channels = 8; d.repetitions = 4*scale;
+  d.format = BrukerRawDataProfile::GO_16BIT_SGN_INT; d.kblock = true;
+  cases.push_back(d);
+
+  d = SyntheticDataset();
+  d.samples = 128; d.phase_encodes = 128; d.channels = 4; d.slices = 16; d.echoes = 2; d.phase_factor = 4;
+  d.repetitions = 2*scale; d.format = BrukerRawDataProfile::GO_32BIT_FLOAT;
+  cases.push_back(d);
+
+  d = SyntheticDataset();
+  d.samples = 128; d.phase_encodes = 128; d.partitions = 64; d.channels = 4; d.repetitions = scale;
+  d.format = BrukerRawDataProfile::GO_32BIT_SGN_INT;
+  cases.push_back(d);
+
+  return cases;
+}
+
+static std::vector<OutputMode> AllModes()
+{
+  std::vector<OutputMode> modes;
+  OutputMode m;
+  m.preview = false;
+  m.name = "chunked";     m.arguments = "--chunked-writer";          m.thread_option = "";                     modes.push_back(m);
+  m.name = "library";     m.arguments = "";                          m.thread_option = "";                     modes.push_back(m);
+  m.name = "stream";      m.arguments = "--stream";                  m.thread_option = "";                     modes.push_back(m);
+  m.name = "noreadahead"; m.arguments = "--chunked-writer --readahead 0"; m.thread_option = "";                modes.push_back(m);
+  m.name = "compressed";  m.arguments = "--compression-level 1";     m.thread_option = "--compression-threads"; modes.push_back(m);
+  m.name = "sharded";     m.arguments = "--shard-repetitions 1";     m.thread_option = "--writers";            modes.push_back(m);
+  /* The chunked writer with a preview, the difference to "chunked" is the cost of the preview */
+  m.name = "preview";     m.arguments = "--chunked-writer";          m.thread_option = "";  m.preview = true;  modes.push_back(m);
+  return modes;
+}
+
+int main(int argc, char** argv)
+{
+  std::string converter, scratch, mode_list, thread_list, dataset_list, extra_args;
+  std::string baseline_filename, write_baseline_filename;
+  unsigned int scale, runs;
+  double tolerance;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("converter", po::value<std::string>(&converter)->default_value(BRUKER_TO_ISMRMRD_PATH), "bruker_to_ismrmrd executable")
+    ("scratch,o", po::value<std::string>(&scratch)->default_value("bench_bruker_to_ismrmrd"), "Scratch directory for datasets and output")
+    ("modes,m", po::value<std::string>(&mode_list)->default_value("chunked,library,stream,noreadahead,compressed,sharded,preview"), "Comma separated output modes")
+    ("threads,t", po::value<std::string>(&thread_list)->default_value("1,4"), "Comma separated thread counts for the modes that take one")
+    ("scale,s", po::value<unsigned int>(&scale)->default_value(1), "Multiplies the repetitions of every dataset")
+    ("runs,n", po::value<unsigned int>(&runs)->default_value(1), "Runs per case, the fastest is reported")
+    ("datasets,d", po::value<std::string>(&dataset_list)->default_value(""), "Comma separated indices into the dataset matrix, all if empty")
+    ("extra-args", po::value<std::string>(&extra_args)->default_value(""), "Extra arguments for every converter run, e.g. --check-allocations")
+    ("baseline", po::value<std::string>(&baseline_filename), "Fail if a case is slower than the MB/s of this baseline file, less the tolerance")
+    ("tolerance", po::value<double>(&tolerance)->default_value(0.25), "Fraction below the baseline throughput that still passes")
+    ("write-baseline", po::value<std::string>(&write_baseline_filename), "Write the measured MB/s of every case as a baseline file")
+    ("keep", "Keep the scratch directory")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+  if (scale == 0) scale = 1;
+  if (runs == 0) runs = 1;
+
+  std::vector<OutputMode> modes;
+  std::vector<std::string> names = SplitList(mode_list);
+  std::vector<OutputMode> all = AllModes();
+  for (size_t i = 0; i < names.size(); i++) {
+    size_t j = 0;
+    while (j < all.size() && all[j].name != names[i]) j++;
+    if (j == all.size()) {
+      std::cerr << "Unknown output mode " << names[i] << std::endl;
+      return -1;
+    }
+    modes.push_back(all[j]);
+  }
+  std::vector<std::string> threads = SplitList(thread_list);
+
+  std::map<std::string, double> baseline;
+  if (vm.count("baseline") && !ReadBaseline(baseline_filename, baseline)) return -1;
+  std::ofstream baseline_out;
+  if (vm.count("write-baseline")) {
+    baseline_out.open(write_baseline_filename.c_str());
+    baseline_out << "# Measured on: " << DescribeMachine() << std::endl;
+    baseline_out << "# With: --scale " << scale << " --runs " << runs << std::endl;
+    baseline_out << "# dataset\tmode\tthreads\tMB/s" << std::endl;
+  }
+
+  std::cout << std::setw(40) << std::left << "dataset" << std::right << std::setw(13) << "mode"
+	    << std::setw(8) << "threads" << std::setw(10) << "MB" << std::setw(10) << "s"
+	    << std::setw(10) << "MB/s" << std::setw(14) << "profiles/s" << std::endl;
+
+  std::vector<SyntheticDataset> datasets = DatasetMatrix(scale);
+  std::vector<bool> selected(datasets.size(), dataset_list.empty());
+  std::vector<std::string> indices = SplitList(dataset_list);
+  for (size_t i = 0; i < indices.size(); i++) {
+    unsigned int d = static_cast<unsigned int>(atoi(indices[i].c_str()));
+    if (d >= datasets.size()) {
+      std::cerr << "Unknown dataset " << indices[i] << ", there are " << datasets.size() << std::endl;
+      return -1;
+    }
+    selected[d] = true;
+  }
+
+  int failures = 0;
+  int regressions = 0;
+  for (size_t i = 0; i < datasets.size(); i++) {
+    if (!selected[i]) continue;
+    std::string study = scratch + "/study";
+    unsigned long int bytes = 0;
+    if (!WriteSyntheticDataset(datasets[i], study, "1", &bytes)) {
+      std::cerr << "Failed to write dataset " << datasets[i].Describe() << std::endl;
+      return -1;
+    }
+    double mb = bytes/(1024.0*1024.0);
+
+    for (size_t m = 0; m < modes.size(); m++) {
+      std::vector<std::string> counts = modes[m].thread_option.empty() ? std::vector<std::string>(1, "-") : threads;
+      for (size_t t = 0; t < counts.size(); t++) {
+	std::string command = "\"" + converter + "\" -f \"" + study + "/1\" -o \"" + scratch + "/out.h5\" " + modes[m].arguments;
+	if (!modes[m].thread_option.empty()) command += " " + modes[m].thread_option + " " + counts[t];
+	if (modes[m].preview) command += " --preview \"" + scratch + "/out_preview.pgm\"";
+	if (!extra_args.empty()) command += " " + extra_args;
+	/* Progress goes to stderr and would interleave with the table */
+	command += " --progress 0 > /dev/null";
+
+	double best = 0.0;
+	bool ok = true;
+	for (unsigned int r = 0; r < runs && ok; r++) {
+	  std::system(("rm -rf \"" + scratch + "\"/out*").c_str());
+	  double t0 = BrukerMonotonicSeconds();
+	  ok = (std::system(command.c_str()) == 0);
+	  double elapsed = BrukerMonotonicSeconds() - t0;
+	  if (r == 0 || elapsed < best) best = elapsed;
+	}
+
+	std::cout << std::setw(40) << std::left << datasets[i].Describe() << std::right << std::setw(13) << modes[m].name
+		  << std::setw(8) << counts[t] << std::fixed << std::setprecision(1) << std::setw(10) << mb;
+	if (ok) {
+	  std::cout << std::setprecision(3) << std::setw(10) << best << std::setprecision(1) << std::setw(10) << mb/best
+		    << std::setprecision(0) << std::setw(14) << datasets[i].Profiles()/best;
+
+	  std::string key = BaselineKey(datasets[i].Describe(), modes[m].name, counts[t]);
+	  if (baseline_out.is_open()) baseline_out << key << "\t" << std::setprecision(1) << mb/best << std::endl;
+	  if (vm.count("baseline")) {
+	    std::map<std::string, double>::const_iterator b = baseline.find(key);
+	    if (b == baseline.end()) {
+	      std::cout << "  no baseline";
+	    } else if (mb/best < b->second*(1.0 - tolerance)) {
+	      std::cout << "  REGRESSION, baseline " << std::setprecision(1) << b->second << " MB/s";
+	      regressions++;
+	    }
+	  }
+	  std::cout << std::endl;
+	} else {
+	  std::cout << std::setw(34) << "failed" << std::endl;
+	  failures++;
+	}
+      }
+    }
+  }
+
+  if (!vm.count("keep")) std::system(("rm -rf \"" + scratch + "\"").c_str());
+  if (regressions) std::cerr << regressions << " cases are slower than the baseline" << std::endl;
+  return (failures || regressions) ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// bench_hdf5_layout.cpp
+// Write throughput and single repetition read back for different
+// HDF5 layouts of the ISMRMRD acquisition dataset
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdio>
+
+#include "acquisitionsink.hpp"
+#include "chunkeddatasetsink.hpp"
+#include "brukerfidfollower.hpp"
+
+namespace po = boost::program_options;
+
+struct LayoutCase
+{
+  std::string name;
+  bool library_writer;
+  HDF5LayoutOptions layout;
+};
+
+static double WriteDataset(AcquisitionSink* sink, unsigned int nx, unsigned int nc,
+			   unsigned int profiles_per_rep, unsigned int repetitions)
+{
+  ISMRMRD::IsmrmrdHeader h;
+  sink->WriteHeader(h);
+
+  ISMRMRD::Acquisition acq;
+  acq.resize(nx, nc);
+  for (unsigned int c = 0; c < nc; c++) {
+    for (unsigned int s = 0; s < nx; s++) {
+      acq.data(s, c) = std::complex<float>(static_cast<float>(s), static_cast<float>(c));
+    }
+  }
+
+  double t0 = BrukerMonotonicSeconds();
+  unsigned int counter = 0;
+  for (unsigned int r = 0; r < repetitions; r++) {
+    for (unsigned int p = 0; p < profiles_per_rep; p++) {
+      acq.scan_counter() = counter++;
+      acq.idx().kspace_encode_step_1 = p;
+      acq.idx().repetition = r;
+      sink->AppendAcquisition(acq);
+    }
+  }
+  sink->Close();
+  return BrukerMonotonicSeconds() - t0;
+}
+
+static double ReadRepetition(std::string filename, std::string group, unsigned int profiles_per_rep, unsigned int rep)
+{
+  double t0 = BrukerMonotonicSeconds();
+
+  hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  hid_t data = H5Dopen2(file, (group + "/data").c_str(), H5P_DEFAULT);
+  hid_t type = CreateAcquisitionType(filename + ".types.tmp");
+
+  std::vector<HDF5Acquisition> buf(profiles_per_rep);
+  hsize_t start[1] = { static_cast<hsize_t>(rep)*profiles_per_rep };
+  hsize_t count[1] = { profiles_per_rep };
+  hid_t fspace = H5Dget_space(data);
+  H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, 0, count, 0);
+  hid_t mspace = H5Screate_simple(1, count, 0);
+  if (H5Dread(data, type, mspace, fspace, H5P_DEFAULT, &buf[0]) < 0) {
+    std::cerr << "Failed to read repetition " << rep << " from " << filename << std::endl;
+  }
+  H5Dvlen_reclaim(type, mspace, H5P_DEFAULT, &buf[0]);
+
+  H5Sclose(mspace);
+  H5Sclose(fspace);
+  H5Tclose(type);
+  H5Dclose(data);
+  H5Fclose(file);
+
+  return BrukerMonotonicSeconds() - t0;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int nx, nc, ppr, nr;
+  std::string out_filename;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("samples,x", po::value<unsigned int>(&nx)->default_value(256), "Samples per readout")
+    ("channels,c", po::value<unsigned int>(&nc)->default_value(4), "Channels")
+    ("profiles,p", po::value<unsigned int>(&ppr)->default_value(256), "Profiles per repetition")
+    ("repetitions,r", po::value<unsigned int>(&nr)->default_value(32), "Repetitions")
+    ("outfile,o", po::value<std::string>(&out_filename)->default_value("bench_hdf5_layout.h5"), "Scratch file")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  std::vector<LayoutCase> cases;
+  LayoutCase c;
+
+  c.name = "ismrmrd library"; c.library_writer = true;
+  cases.push_back(c);
+
+  c.library_writer = false;
+  c.name = "chunk 1"; c.layout = HDF5LayoutOptions(); c.layout.chunk_profiles = 1; c.layout.alignment = 1;
+  cases.push_back(c);
+  c.name = "chunk 64"; c.layout = HDF5LayoutOptions(); c.layout.chunk_profiles = 64; c.layout.alignment = 1;
+  cases.push_back(c);
+  c.name = "derived, unaligned"; c.layout = HDF5LayoutOptions(); c.layout.alignment = 1;
+  cases.push_back(c);
+  c.name = "derived"; c.layout = HDF5LayoutOptions();
+  cases.push_back(c);
+
+  double mb = static_cast<double>(nx)*nc*8*ppr*nr/(1024.0*1024.0);
+  std::cout << "Writing " << nr << " repetitions of " << ppr << " profiles, "
+	    << nx << " samples x " << nc << " channels (" << mb << " MB)" << std::endl;
+  std::cout << std::setw(22) << "layout" << std::setw(10) << "chunk" << std::setw(14) << "write MB/s"
+	    << std::setw(16) << "read rep ms" << std::endl;
+
+  for (size_t i = 0; i < cases.size(); i++) {
+    std::remove(out_filename.c_str());
+
+    AcquisitionSink* sink = 0;
+    if (cases[i].library_writer) {
+      sink = new DatasetSink(out_filename, "dataset");
+    } else {
+      cases[i].layout.FillDefaults(nx, nc, ppr);
+      sink = new ChunkedDatasetSink(out_filename, "dataset", cases[i].layout);
+    }
+    double tw = WriteDataset(sink, nx, nc, ppr, nr);
+    delete sink;
+
+    double tr = ReadRepetition(out_filename, "dataset", ppr, nr/2);
+
+    std::cout << std::setw(22) << cases[i].name
+	      << std::setw(10) << (cases[i].library_writer ? 0 : cases[i].layout.chunk_profiles)
+	      << std::setw(14) << std::fixed << std::setprecision(1) << mb/tw
+	      << std::setw(16) << std::setprecision(3) << 1000.0*tr << std::endl;
+  }
+
+  std::remove(out_filename.c_str());
+  return 0;
+}
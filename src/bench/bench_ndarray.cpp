@@ -0,0 +1,156 @@
+// bench_ndarray.cpp
+// Hyperslab extraction and insertion with NDArray::get and NDArray::set
+// for the slices typically taken from a [kx,ky,kz,obj,rep] k-space array
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "brukerfidfollower.hpp"
+
+namespace po = boost::program_options;
+
+using namespace mr_recon;
+
+struct SliceCase
+{
+  std::string name;
+  std::vector<int> lower;
+  std::vector<int> upper;
+};
+
+/* Element by element copy as NDArray::get did it before, used as reference */
+static ComplexFloatArray ReferenceGet(ComplexFloatArray& a, std::vector<int> lower, std::vector<int> upper)
+{
+  std::vector<int> sizes;
+  for (size_t i = 0; i < lower.size(); i++) {
+    sizes.push_back(upper[i]-lower[i]+1);
+  }
+  ComplexFloatArray out(&sizes);
+
+  std::vector<int> index(lower.size(), 0);
+  for (unsigned long int i = 0; i < out.get_number_of_elements(); i++) {
+    unsigned long int offset = 0, stride = 1;
+    for (size_t d = 0; d < index.size(); d++) {
+      offset += (index[d]+lower[d])*stride;
+      stride *= a.get_size(d);
+    }
+    out[i] = a[offset];
+    for (size_t d = 0; d < index.size(); d++) {
+      if (++index[d] < sizes[d]) break;
+      index[d] = 0;
+    }
+  }
+  return out;
+}
+
+int main(int argc, char** argv)
+{
+  int nx, ny, nz, nobj, nr, iterations;
+  unsigned int threads;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("kx", po::value<int>(&nx)->default_value(256), "Samples")
+    ("ky", po::value<int>(&ny)->default_value(256), "Phase encoding steps")
+    ("kz", po::value<int>(&nz)->default_value(32), "Slice/partition encoding steps")
+    ("objects", po::value<int>(&nobj)->default_value(2), "Objects")
+    ("repetitions,r", po::value<int>(&nr)->default_value(4), "Repetitions")
+    ("iterations,i", po::value<int>(&iterations)->default_value(10), "Iterations per case")
+    ("threads,t", po::value<unsigned int>(&threads)->default_value(0), "Threads, 0 for one per core")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  set_number_of_threads(threads);
+
+  std::vector<int> dims;
+  dims.push_back(nx); dims.push_back(ny); dims.push_back(nz); dims.push_back(nobj); dims.push_back(nr);
+  ComplexFloatArray kspace(&dims);
+  for (unsigned long int i = 0; i < kspace.get_number_of_elements(); i++) {
+    kspace[i] = ComplexFloat(static_cast<float>(i % 65521), static_cast<float>(i % 251));
+  }
+
+  std::vector<SliceCase> cases;
+  SliceCase c;
+
+  c.name = "one kz slice";
+  c.lower.assign(5, -1); c.upper.assign(5, -1);
+  c.lower[2] = c.upper[2] = nz/2;
+  c.lower[3] = c.upper[3] = 0;
+  c.lower[4] = c.upper[4] = 0;
+  cases.push_back(c);
+
+  c.name = "one repetition";
+  c.lower.assign(5, -1); c.upper.assign(5, -1);
+  c.lower[4] = c.upper[4] = nr/2;
+  cases.push_back(c);
+
+  c.name = "ky sub-block";
+  c.lower.assign(5, -1); c.upper.assign(5, -1);
+  c.lower[1] = ny/4; c.upper[1] = ny/4 + ny/2 - 1;
+  cases.push_back(c);
+
+  std::cout << "Array " << nx << " x " << ny << " x " << nz << " x " << nobj << " x " << nr
+	    << ", " << get_number_of_threads() << " threads" << std::endl;
+  std::cout << std::setw(18) << "slice" << std::setw(12) << "MB"
+	    << std::setw(14) << "reference ms" << std::setw(10) << "get ms" << std::setw(10) << "set ms"
+	    << std::setw(8) << "match" << std::endl;
+
+  for (size_t i = 0; i < cases.size(); i++) {
+    std::vector<int> lower, upper;
+    for (size_t d = 0; d < 5; d++) {
+      lower.push_back(cases[i].lower[d] == -1 ? 0 : cases[i].lower[d]);
+      upper.push_back(cases[i].upper[d] == -1 ? dims[d]-1 : cases[i].upper[d]);
+    }
+
+    double t0 = BrukerMonotonicSeconds();
+    ComplexFloatArray ref;
+    for (int it = 0; it < iterations; it++) {
+      ref = ReferenceGet(kspace, lower, upper);
+    }
+    double t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+
+    t0 = BrukerMonotonicSeconds();
+    ComplexFloatArray slab;
+    for (int it = 0; it < iterations; it++) {
+      std::vector<int> l = cases[i].lower, u = cases[i].upper;
+      slab = kspace.get(&l, &u);
+    }
+    double t_get = (BrukerMonotonicSeconds()-t0)/iterations;
+
+    t0 = BrukerMonotonicSeconds();
+    for (int it = 0; it < iterations; it++) {
+      std::vector<int> l = cases[i].lower, u = cases[i].upper;
+      kspace.set(slab, &l, &u);
+    }
+    double t_set = (BrukerMonotonicSeconds()-t0)/iterations;
+
+    bool match = slab.get_number_of_elements() == ref.get_number_of_elements();
+    for (unsigned long int e = 0; match && e < ref.get_number_of_elements(); e++) {
+      match = slab[e] == ref[e];
+    }
+
+    std::cout << std::setw(18) << cases[i].name
+	      << std::setw(12) << std::fixed << std::setprecision(1) << slab.get_number_of_elements()*sizeof(ComplexFloat)/(1024.0*1024.0)
+	      << std::setw(14) << std::setprecision(3) << 1000.0*t_ref
+	      << std::setw(10) << 1000.0*t_get
+	      << std::setw(10) << 1000.0*t_set
+	      << std::setw(8) << (match ? "yes" : "NO") << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+// bench_ndarray_kernels.cpp
+// Element-wise complex arithmetic, scaling and flipdim on NDArray
+// compared with plain std::complex loops, for 3D multi-channel k-space sizes,
+// and the decoding of 16 bit fid profiles with sequential and interleaved channels
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+#include <sstream>
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "ndarraykernels.hpp"
+#include "brukerfidfollower.hpp"
+
+namespace po = boost::program_options;
+
+using namespace mr_recon;
+
+static bool Matches(ComplexFloatArray& a, ComplexFloatArray& b)
+{
+  if (a.get_number_of_elements() != b.get_number_of_elements()) return false;
+  for (unsigned long int i = 0; i < a.get_number_of_elements(); i++) {
+    if (std::abs(a[i] - b[i]) > 1e-4f*(1.0f + std::abs(b[i]))) return false;
+  }
+  return true;
+}
+
+/* Flip with the index math written out, used as reference */
+static void ReferenceFlip(ComplexFloatArray& a, int dimension)
+{
+  long before = 1, after = 1;
+  for (int i = 0; i < dimension; i++) before *= a.get_size(i);
+  for (int i = dimension+1; i < a.get_number_of_dimensions(); i++) after *= a.get_size(i);
+  long length = a.get_size(dimension);
+  ComplexFloatArray in = a;
+  for (long j = 0; j < after; j++) {
+    for (long k = 0; k < length; k++) {
+      for (long i = 0; i < before; i++) {
+	a[(j*length + k)*before + i] = in[(j*length + (length-1-k))*before + i];
+      }
+    }
+  }
+}
+
+static void PrintResult(std::string name, double t_ref, double t, bool match, double mb)
+{
+  std::cout << std::setw(20) << name
+	    << std::setw(14) << std::fixed << std::setprecision(3) << 1000.0*t_ref
+	    << std::setw(12) << 1000.0*t
+	    << std::setw(12) << std::setprecision(1) << mb/t
+	    << std::setw(8) << (match ? "yes" : "NO") << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  int nx, ny, nz, nc, iterations;
+  unsigned int threads;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("kx", po::value<int>(&nx)->default_value(128), "Samples")
+    ("ky", po::value<int>(&ny)->default_value(128), "Phase encoding steps")
+    ("kz", po::value<int>(&nz)->default_value(64), "Partition encoding steps")
+    ("channels,c", po::value<int>(&nc)->default_value(8), "Channels")
+    ("iterations,i", po::value<int>(&iterations)->default_value(5), "Iterations per operation")
+    ("threads,t", po::value<unsigned int>(&threads)->default_value(0), "Threads, 0 for one per core")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  set_number_of_threads(threads);
+
+  std::vector<int> dims;
+  dims.push_back(nx); dims.push_back(ny); dims.push_back(nz); dims.push_back(nc);
+  ComplexFloatArray a(&dims), b(&dims), ref(&dims), out(&dims);
+  unsigned long int n = a.get_number_of_elements();
+  for (unsigned long int i = 0; i < n; i++) {
+    a[i] = ComplexFloat(std::sin(0.001f*i), std::cos(0.003f*i));
+    b[i] = ComplexFloat(1.0f + 0.5f*std::cos(0.002f*i), 0.25f*std::sin(0.005f*i));
+  }
+  ComplexFloat s(0.5f, -2.0f);
+  ComplexFloat* pa = a.get_data_ptr();
+  ComplexFloat* pb = b.get_data_ptr();
+  ComplexFloat* pr = ref.get_data_ptr();
+
+  /* MB touched per operation, two inputs and one output for the binary operations */
+  double mb = n*sizeof(ComplexFloat)/(1024.0*1024.0);
+
+  std::cout << "Array " << nx << " x " << ny << " x " << nz << " x " << nc
+	    << " (" << mb << " MB), " << get_number_of_threads() << " threads" << std::endl;
+  std::cout << std::setw(20) << "operation" << std::setw(14) << "reference ms"
+	    << std::setw(12) << "ndarray ms" << std::setw(12) << "MB/s" << std::setw(8) << "match" << std::endl;
+
+  double t0, t_ref, t;
+
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) for (unsigned long int i = 0; i < n; i++) pr[i] = pa[i]*pb[i];
+  t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) out = elementwise_multiply(a, b);
+  t = (BrukerMonotonicSeconds()-t0)/iterations;
+  PrintResult("dot_multiply", t_ref, t, Matches(out, ref), 3*mb);
+
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) for (unsigned long int i = 0; i < n; i++) pr[i] = pa[i]/pb[i];
+  t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) out = elementwise_divide(a, b);
+  t = (BrukerMonotonicSeconds()-t0)/iterations;
+  PrintResult("dot_divide", t_ref, t, Matches(out, ref), 3*mb);
+
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) for (unsigned long int i = 0; i < n; i++) pr[i] = pa[i]*pb[i]*s;
+  t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) out = elementwise_multiply(a, b) * s;
+  t = (BrukerMonotonicSeconds()-t0)/iterations;
+  PrintResult("dot_multiply * s", t_ref, t, Matches(out, ref), 3*mb);
+
+  /* In place scaling, the scale is undone every other iteration to keep values bounded */
+  ComplexFloat inv = ComplexFloat(1.0f, 0.0f)/s;
+  ref = a;
+  out = a;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < 2*iterations; it++) {
+    ComplexFloat f = (it % 2) ? inv : s;
+    for (unsigned long int i = 0; i < n; i++) pr[i] *= f;
+  }
+  t_ref = (BrukerMonotonicSeconds()-t0)/(2*iterations);
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < 2*iterations; it++) out *= (it % 2) ? inv : s;
+  t = (BrukerMonotonicSeconds()-t0)/(2*iterations);
+  PrintResult("operator*=", t_ref, t, Matches(out, ref), 2*mb);
+
+  for (int d = 0; d < 4; d++) {
+    ref = a;
+    out = a;
+    t0 = BrukerMonotonicSeconds();
+    ReferenceFlip(ref, d);
+    t_ref = BrukerMonotonicSeconds()-t0;
+    t0 = BrukerMonotonicSeconds();
+    out.flipdim(d);
+    t = BrukerMonotonicSeconds()-t0;
+    std::stringstream name;
+    name << "flipdim(" << d << ")";
+    PrintResult(name.str(), t_ref, t, Matches(out, ref), 2*mb);
+  }
+
+  /* The same samples as ny*nz fid profiles of nx samples and nc channels, 16 bit as most scans store them */
+  std::vector<short> raw(2*n);
+  for (unsigned long int i = 0; i < 2*n; i++) raw[i] = static_cast<short>((i*37) % 65536 - 32768);
+  unsigned long int profiles = static_cast<unsigned long int>(ny)*nz;
+  unsigned long int profile_values = 2UL*nx*nc;
+  float* fr = reinterpret_cast<float*>(pr);
+  float* fo = reinterpret_cast<float*>(out.get_data_ptr());
+  double mb_raw = 2*n*sizeof(short)/(1024.0*1024.0);
+
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) for (unsigned long int i = 0; i < 2*n; i++) fr[i] = raw[i];
+  t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) {
+    for (unsigned long int p = 0; p < profiles; p++) convert(&raw[p*profile_values], fo + p*profile_values, nx*nc);
+  }
+  t = (BrukerMonotonicSeconds()-t0)/iterations;
+  PrintResult("decode sequential", t_ref, t, Matches(out, ref), mb_raw + mb);
+
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) {
+    for (unsigned long int p = 0; p < profiles; p++) {
+      const short* in = &raw[p*profile_values];
+      float* o = fr + p*profile_values;
+      for (int x = 0; x < nx; x++) {
+	for (int c = 0; c < nc; c++) {
+	  o[2*(c*nx + x)] = in[2*(x*nc + c)];
+	  o[2*(c*nx + x) + 1] = in[2*(x*nc + c) + 1];
+	}
+      }
+    }
+  }
+  t_ref = (BrukerMonotonicSeconds()-t0)/iterations;
+  t0 = BrukerMonotonicSeconds();
+  for (int it = 0; it < iterations; it++) {
+    for (unsigned long int p = 0; p < profiles; p++) deinterleave_channels(&raw[p*profile_values], fo + p*profile_values, nx, nc);
+  }
+  t = (BrukerMonotonicSeconds()-t0)/iterations;
+  PrintResult("decode interleaved", t_ref, t, Matches(out, ref), mb_raw + mb);
+
+  return 0;
+}
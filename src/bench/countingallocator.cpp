@@ -0,0 +1,206 @@
+// countingallocator.cpp
+// Replaces the global operator new and delete, and interposes malloc,
+// calloc, realloc, posix_memalign, aligned_alloc and memalign, with
+// versions that count the allocations of each thread in
+// BrukerAllocationCounter. The C functions also count the allocations of
+// HDF5, ISMRMRD and the C library. Linked only into the test build of the
+// converter used by the allocation checks.
+//
+// The replacements call the glibc entry points (__libc_malloc and friends)
+// directly, so operator new is counted once and no lookup through dlsym is
+// needed, which would itself allocate.
+//
+
+#include <new>
+#include <cstdlib>
+#include <errno.h>
+
+#include "brukerallocationcounter.hpp"
+
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void* __libc_memalign(size_t alignment, size_t size);
+  void __libc_free(void* p);
+}
+
+static void* CountedAllocate(std::size_t size)
+{
+  BrukerAllocationCounter::Count();
+  void* p = __libc_malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+/* Marks the counter enabled before main */
+static struct CountingAllocatorInit
+{
+  CountingAllocatorInit() { BrukerAllocationCounter::Enable(); }
+} s_CountingAllocatorInit;
+
+extern "C" {
+
+void* malloc(size_t size)
+{
+  BrukerAllocationCounter::Count();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+  BrukerAllocationCounter::Count();
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+  /* Shrinking or freeing does not take new memory from the heap */
+  if (!p || size) BrukerAllocationCounter::Count();
+  return __libc_realloc(p, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+  BrukerAllocationCounter::Count();
+  void* q = __libc_memalign(alignment, size);
+  if (!q) return ENOMEM;
+  *p = q;
+  return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  BrukerAllocationCounter::Count();
+  return __libc_memalign(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  BrukerAllocationCounter::Count();
+  return __libc_memalign(alignment, size);
+}
+
+void free(void* p)
+{
+  __libc_free(p);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+  return CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+  return CountedAllocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  BrukerAllocationCounter::Count();
+  return __libc_malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  BrukerAllocationCounter::Count();
+  return __libc_malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  __libc_free(p);
+}
+
+#if defined (__cpp_aligned_new)
+/* Over-aligned types, built with -faligned-new so that they exist in C++11 */
+static void* CountedAllocateAligned(std::size_t size, std::align_val_t alignment)
+{
+  BrukerAllocationCounter::Count();
+  std::size_t a = static_cast<std::size_t>(alignment);
+  void* p = __libc_memalign(a < sizeof(void*) ? sizeof(void*) : a, size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  return CountedAllocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return CountedAllocateAligned(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  BrukerAllocationCounter::Count();
+  std::size_t a = static_cast<std::size_t>(alignment);
+  return __libc_memalign(a < sizeof(void*) ? sizeof(void*) : a, size ? size : 1);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& t) noexcept
+{
+  return operator new(size, alignment, t);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  __libc_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  __libc_free(p);
+}
+#endif
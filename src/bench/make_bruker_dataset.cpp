@@ -0,0 +1,66 @@
+// make_bruker_dataset.cpp
+// Writes a complete synthetic ParaVision experiment (subject, acqp,
+// method and fid) as test data for the converter
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+#include "syntheticdataset.hpp"
+#include "brukerfidfollower.hpp"
+
+namespace po = boost::program_options;
+
+int main(int argc, char** argv)
+{
+  SyntheticDataset d;
+  std::string study, expno, format;
+  unsigned int threads;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("study,o", po::value<std::string>(&study)->default_value("synthetic_study"), "Study directory, the subject file is written here")
+    ("expno,n", po::value<std::string>(&expno)->default_value("1"), "Experiment directory within the study")
+    ("samples,x", po::value<unsigned int>(&d.samples)->default_value(128), "Samples per readout")
+    ("phase-encodes,y", po::value<unsigned int>(&d.phase_encodes)->default_value(128), "Phase encoding steps")
+    ("partitions,z", po::value<unsigned int>(&d.partitions)->default_value(1), "Partitions (3D phase encoding steps), 1 for 2D")
+    ("channels,c", po::value<unsigned int>(&d.channels)->default_value(4), "Receiver channels")
+    ("slices,s", po::value<unsigned int>(&d.slices)->default_value(1), "Slices")
+    ("echoes,e", po::value<unsigned int>(&d.echoes)->default_value(1), "Echo images")
+    ("repetitions,r", po::value<unsigned int>(&d.repetitions)->default_value(1), "Repetitions")
+    ("phase-factor,p", po::value<unsigned int>(&d.phase_factor)->default_value(1), "Phase factor, must divide the phase encoding steps")
+    ("format,b", po::value<std::string>(&format)->default_value("32"), "GO_raw_data_format: 16, 32 or float")
+    ("kblock", "Pad profiles to 1024 bytes (Standard_KBlock_Format)")
+    ("threads,t", po::value<unsigned int>(&threads)->default_value(0), "Threads, 0 for one per core")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  if (!ParseDataFormat(format, d.format)) {
+    std::cerr << "Unknown data format " << format << std::endl;
+    return -1;
+  }
+  d.kblock = vm.count("kblock") > 0;
+  mr_recon::set_number_of_threads(threads);
+
+  double t0 = BrukerMonotonicSeconds();
+  unsigned long int bytes = 0;
+  if (!WriteSyntheticDataset(d, study, expno, &bytes)) {
+    std::cerr << "Failed to write " << study << "/" << expno << std::endl;
+    return -1;
+  }
+  double t = BrukerMonotonicSeconds() - t0;
+
+  std::cout << "Wrote " << study << "/" << expno << ": " << d.Describe() << ", " << d.Profiles() << " profiles, "
+	    << bytes/(1024.0*1024.0) << " MB in " << t << " s" << std::endl;
+  return 0;
+}
@@ -0,0 +1,138 @@
+// syntheticdataset.hpp
+// Synthetic ParaVision experiments (subject, acqp, method and fid)
+// for the conversion benchmarks
+//
+
+#ifndef SYNTHETIC_DATASET_HPP
+#define SYNTHETIC_DATASET_HPP
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <math.h>
+
+#include "brukerfidexporter.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+struct SyntheticDataset
+{
+  SyntheticDataset()
+    : samples(128), channels(4), phase_encodes(128), partitions(1), slices(1), echoes(1),
+      repetitions(1), phase_factor(1), format(BrukerRawDataProfile::GO_32BIT_SGN_INT), kblock(false)
+  {
+  }
+
+  unsigned long int Profiles() const
+  {
+    return static_cast<unsigned long int>(phase_encodes)*partitions*slices*echoes*repetitions;
+  }
+
+  std::string Describe() const
+  {
+    std::stringstream s;
+    s << samples << "x" << phase_encodes;
+    if (partitions > 1) s << "x" << partitions;
+    s << " c" << channels << " s" << slices << " e" << echoes << " r" << repetitions << " pf" << phase_factor
+      << (format == BrukerRawDataProfile::GO_16BIT_SGN_INT ? " int16" : (format == BrukerRawDataProfile::GO_32BIT_SGN_INT ? " int32" : " float"))
+      << (kblock ? " kblock" : "");
+    return s.str();
+  }
+
+  unsigned int samples;
+  unsigned int channels;
+  unsigned int phase_encodes;
+  unsigned int partitions;
+  unsigned int slices;
+  unsigned int echoes;
+  unsigned int repetitions;
+  unsigned int phase_factor;
+  BrukerRawDataProfile::BrukerDataFormat format;
+  bool kblock;
+};
+
+inline float Gaussian(unsigned int i, unsigned int n)
+{
+  double x = (static_cast<double>(i) - n/2) / (n/8.0 + 1.0);
+  return static_cast<float>(exp(-x*x));
+}
+
+/* Writes study/subject and study/expno/{acqp,method,fid}. The k-space is a Gaussian peak at the
+   center plus noise and is written one repetition at a time, so large experiments fit in memory. */
+inline bool WriteSyntheticDataset(const SyntheticDataset& d, std::string study, std::string expno, unsigned long int* fid_bytes = 0)
+{
+  std::string directory = study + "/" + expno;
+  if (!BrukerFidExporter::MakeDirectories(directory) || !BrukerFidExporter::WriteSubjectFile(study + "/subject")) {
+    return false;
+  }
+
+  BrukerFidExporter exporter(d.format);
+  exporter.SetNumberOfChannels(d.channels);
+  exporter.SetNumberOfEchoes(d.echoes);
+  exporter.SetPhaseFactor(d.phase_factor);
+  exporter.SetKBlockFormat(d.kblock);
+
+  std::vector<int> dims;
+  dims.push_back(d.samples*d.channels);
+  dims.push_back(d.phase_encodes);
+  dims.push_back(d.partitions);
+  dims.push_back(d.slices*d.echoes);
+  mr_recon::ComplexFloatArray kspace(&dims);
+  if (kspace.get_number_of_elements() == 0) return false;
+
+  std::vector<float> gx(d.samples), gy(d.phase_encodes), gz(d.partitions);
+  /* Centered on index n/2 like the k-space of the converter */
+  for (unsigned int i = 0; i < d.samples; i++) gx[i] = Gaussian(i, d.samples);
+  for (unsigned int i = 0; i < d.phase_encodes; i++) gy[i] = Gaussian(i, d.phase_encodes);
+  for (unsigned int i = 0; i < d.partitions; i++) gz[i] = Gaussian(i, d.partitions);
+
+  const float peak = 1000.0f;
+  const float noise = 10.0f;
+  if (!exporter.OpenFid(directory + "/fid", d.samples*d.channels, peak + noise)) return false;
+
+  long lines = static_cast<long>(d.phase_encodes)*d.partitions*d.slices*d.echoes;
+  for (unsigned int r = 0; r < d.repetitions; r++) {
+    mr_recon::parallel_for(0, lines, [&](long first, long last) {
+	for (long line = first; line < last; line++) {
+	  unsigned int y = line % d.phase_encodes;
+	  unsigned int z = (line / d.phase_encodes) % d.partitions;
+	  /* xorshift noise, seeded per line and repetition */
+	  unsigned int state = static_cast<unsigned int>(line*2654435761u + r*40503u + 1u);
+	  std::complex<float>* out = &kspace[line*d.samples*d.channels];
+	  for (unsigned int c = 0; c < d.channels; c++) {
+	    float phase = 0.7f*c;
+	    for (unsigned int s = 0; s < d.samples; s++) {
+	      state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+	      float n_re = noise*((state & 0xffff)/32768.0f - 1.0f);
+	      float n_im = noise*((state >> 16)/32768.0f - 1.0f);
+	      float a = peak*gx[s]*gy[y]*gz[z];
+	      out[c*d.samples + s] = std::complex<float>(a*cosf(phase) + n_re, a*sinf(phase) + n_im);
+	    }
+	  }
+	}
+      }, 16);
+
+    std::vector<const std::complex<float>*> profiles;
+    if (!exporter.GetProfileOrder(mr_recon::ComplexFloatArrayView(kspace), profiles) || !exporter.WriteProfiles(profiles)) {
+      exporter.CloseFid();
+      return false;
+    }
+  }
+  if (fid_bytes) *fid_bytes = exporter.GetBytesWritten();
+  if (!exporter.CloseFid()) return false;
+
+  dims.push_back(d.repetitions);
+  return exporter.WriteParameterFiles(directory, dims);
+}
+
+/* Parses the raw data format names of the tools, 16, 32 or float */
+inline bool ParseDataFormat(std::string name, BrukerRawDataProfile::BrukerDataFormat& format)
+{
+  if (name == "16" || name == "GO_16BIT_SGN_INT") format = BrukerRawDataProfile::GO_16BIT_SGN_INT;
+  else if (name == "32" || name == "GO_32BIT_SGN_INT") format = BrukerRawDataProfile::GO_32BIT_SGN_INT;
+  else if (name == "float" || name == "GO_32BIT_FLOAT") format = BrukerRawDataProfile::GO_32BIT_FLOAT;
+  else return false;
+  return true;
+}
+
+#endif //SYNTHETIC_DATASET_HPP
@@ -0,0 +1,187 @@
+#include "chunkeddatasetsink.hpp"
+#include "brukertrace.hpp"
+#include "brukermemory.hpp"
+
+#include <sstream>
+#include <iostream>
+#include <string.h>
+
+void HDF5LayoutOptions::FillDefaults(unsigned int samples, unsigned int channels, unsigned long int profiles_per_repetition)
+{
+  /* A chunk holds the headers and variable length descriptors of its acquisitions, the
+     samples themselves go to the HDF5 global heap */
+  unsigned long int element = sizeof(HDF5Acquisition);
+
+  /* One chunk per repetition so that reading a repetition touches a single chunk. Larger
+     repetitions are split into the fewest equal chunks of at most about 1 MB, the chunk
+     size rounded up so that a repetition needs no extra chunk for a remainder */
+  if (chunk_profiles == 0) {
+    unsigned long int target = (1UL << 20);
+    unsigned long int p = profiles_per_repetition ? profiles_per_repetition : 1;
+    unsigned long int chunks = (p*element + target - 1) / target;
+    chunk_profiles = static_cast<unsigned int>((p + chunks - 1) / chunks);
+  }
+
+  /* Room for a few chunks, never below the HDF5 default of 1 MB */
+  if (cache_bytes == 0) {
+    cache_bytes = 4UL*chunk_profiles*element;
+    if (cache_bytes < (1UL << 20)) cache_bytes = (1UL << 20);
+  }
+
+  /* Page align the file allocations of at least a page, which are the descriptor chunks
+     and the global heap collections of the samples; smaller objects are packed */
+  if (alignment == 0) {
+    alignment = 4096;
+  }
+  if (alignment_threshold == 0) {
+    alignment_threshold = alignment;
+  }
+}
+
+ChunkedDatasetSink::ChunkedDatasetSink(std::string filename, std::string group, const HDF5LayoutOptions& layout)
+  : m_Layout(layout),
+    m_File(-1),
+    m_Group(-1),
+    m_Type(-1),
+    m_Data(-1),
+    m_ulWritten(0),
+    m_ulDataElementSize(sizeof(float)),
+    m_ulAccountedBytes(0)
+{
+  if (m_Layout.chunk_profiles == 0) m_Layout.chunk_profiles = 1;
+
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  if (m_Layout.alignment > 1) {
+    H5Pset_alignment(fapl, m_Layout.alignment_threshold, m_Layout.alignment);
+  }
+  m_File = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  H5Pclose(fapl);
+  if (m_File < 0) {
+    std::cerr << "ChunkedDatasetSink: unable to create " << filename << std::endl;
+    return;
+  }
+
+  m_Group = H5Gcreate2(m_File, group.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  m_Type = CreateAcquisitionType(filename + ".types.tmp");
+  if (m_Type < 0) {
+    std::cerr << "ChunkedDatasetSink: no ISMRMRD acquisition type for " << filename << std::endl;
+    return;
+  }
+  m_ulDataElementSize = GetVlenElementSize(m_Type, "data");
+  if (m_ulDataElementSize == 0) m_ulDataElementSize = sizeof(float);
+
+  hsize_t dims[1] = { 0 };
+  hsize_t maxdims[1] = { H5S_UNLIMITED };
+  hsize_t chunk[1] = { m_Layout.chunk_profiles };
+  hid_t space = H5Screate_simple(1, dims, maxdims);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 1, chunk);
+  hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+  if (m_Layout.cache_bytes) {
+    /* Number of slots should be a prime about 100 times the number of chunks that fit */
+    size_t slots = 100*(m_Layout.cache_bytes / (m_Layout.chunk_profiles*sizeof(HDF5Acquisition)) + 1) + 1;
+    H5Pset_chunk_cache(dapl, slots, m_Layout.cache_bytes, 1.0);
+  }
+  m_Data = H5Dcreate2(m_Group, "data", m_Type, space, H5P_DEFAULT, dcpl, dapl);
+  H5Pclose(dapl);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+
+  if (m_Data < 0) {
+    std::cerr << "ChunkedDatasetSink: unable to create acquisition dataset in " << filename << std::endl;
+  }
+
+  m_Pending.reserve(m_Layout.chunk_profiles);
+  m_SampleOffsets.reserve(m_Layout.chunk_profiles);
+}
+
+ChunkedDatasetSink::~ChunkedDatasetSink()
+{
+  Close();
+}
+
+void ChunkedDatasetSink::WriteHeader(const ISMRMRD::IsmrmrdHeader& h)
+{
+  std::stringstream str;
+  ISMRMRD::serialize(h, str);
+  if (!WriteIsmrmrdXmlHeader(m_Group, str.str())) {
+    std::cerr << "ChunkedDatasetSink: unable to write XML header" << std::endl;
+  }
+}
+
+void ChunkedDatasetSink::AppendAcquisition(const ISMRMRD::Acquisition& acq)
+{
+  HDF5Acquisition a;
+  a.head = acq.getHead();
+
+  unsigned long int n = static_cast<unsigned long int>(acq.getNumberOfSamples())*acq.getActiveChannels()*2;
+  unsigned long int offset = m_Samples.size();
+  m_Samples.resize(offset + n);
+  memcpy(&m_Samples[offset], acq.getDataPtr(), n*sizeof(float));
+
+  a.traj.len = 0;
+  a.traj.p = 0;
+  a.data.len = n*sizeof(float)/m_ulDataElementSize;  /* complex samples for ISMRMRD */
+  a.data.p = 0; /* resolved when the chunk is written, m_Samples may still move */
+
+  m_Pending.push_back(a);
+  m_SampleOffsets.push_back(offset);
+
+  /* The buffers keep their capacity between chunks, so this only changes while they grow */
+  unsigned long int held = m_Samples.capacity()*sizeof(float) + m_Pending.capacity()*sizeof(HDF5Acquisition) +
+    m_SampleOffsets.capacity()*sizeof(unsigned long int);
+  if (held > m_ulAccountedBytes) {
+    BrukerMemory::Allocated(BrukerMemory::MEMORY_OUTPUT_BUFFERS, held - m_ulAccountedBytes);
+    m_ulAccountedBytes = held;
+  }
+
+  if (m_Pending.size() >= m_Layout.chunk_profiles) {
+    Flush();
+  }
+}
+
+void ChunkedDatasetSink::Flush()
+{
+  if (m_Pending.empty() || m_Data < 0) return;
+
+  for (size_t i = 0; i < m_Pending.size(); i++) {
+    m_Pending[i].data.p = m_Pending[i].data.len ? &m_Samples[m_SampleOffsets[i]] : 0;
+  }
+
+  BrukerTraceScope trace("hdf5_write", "hdf5", m_Samples.size()*sizeof(float));
+  hsize_t count[1] = { m_Pending.size() };
+  hsize_t start[1] = { m_ulWritten };
+  hsize_t dims[1] = { m_ulWritten + m_Pending.size() };
+  H5Dset_extent(m_Data, dims);
+
+  hid_t fspace = H5Dget_space(m_Data);
+  H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, 0, count, 0);
+  hid_t mspace = H5Screate_simple(1, count, 0);
+  if (H5Dwrite(m_Data, m_Type, mspace, fspace, H5P_DEFAULT, &m_Pending[0]) < 0) {
+    std::cerr << "ChunkedDatasetSink: failed to write acquisitions " << m_ulWritten
+	      << " to " << dims[0]-1 << std::endl;
+  }
+  H5Sclose(mspace);
+  H5Sclose(fspace);
+
+  m_ulWritten += m_Pending.size();
+  m_Pending.clear();
+  m_SampleOffsets.clear();
+  m_Samples.clear();
+}
+
+void ChunkedDatasetSink::Close()
+{
+  Flush();
+  if (m_Data >= 0) H5Dclose(m_Data);
+  if (m_Type >= 0) H5Tclose(m_Type);
+  if (m_Group >= 0) H5Gclose(m_Group);
+  if (m_File >= 0) H5Fclose(m_File);
+  m_Data = m_Type = m_Group = m_File = -1;
+
+  std::vector<HDF5Acquisition>().swap(m_Pending);
+  std::vector<float>().swap(m_Samples);
+  std::vector<unsigned long int>().swap(m_SampleOffsets);
+  BrukerMemory::Released(BrukerMemory::MEMORY_OUTPUT_BUFFERS, m_ulAccountedBytes);
+  m_ulAccountedBytes = 0;
+}
@@ -0,0 +1,73 @@
+/*****************************************************
+ *
+ *  ISMRMRD dataset writer with a tunable HDF5 layout
+ *
+ *  Writes the standard <group>/xml and <group>/data
+ *  datasets, with the acquisition type that ISMRMRD
+ *  itself uses, but lets the caller choose the chunk
+ *  size of the acquisition dataset, the raw data
+ *  chunk cache and the file space alignment.
+ *  Acquisitions are buffered and written one chunk at
+ *  a time.
+ *
+ *****************************************************/
+
+#ifndef CHUNKED_DATASET_SINK_HPP
+#define CHUNKED_DATASET_SINK_HPP
+
+#include "acquisitionsink.hpp"
+#include "ismrmrdhdf5types.hpp"
+
+#include <vector>
+
+struct HDF5LayoutOptions
+{
+  HDF5LayoutOptions()
+    : chunk_profiles(0), cache_bytes(0), alignment(0), alignment_threshold(0) {}
+
+  unsigned int chunk_profiles;             /* acquisitions per chunk of <group>/data */
+  unsigned long int cache_bytes;           /* raw data chunk cache size */
+  /* File space alignment in bytes, 1 disables. The chunks of <group>/data hold headers and
+     variable length descriptors, the samples are in global heap collections; the alignment
+     applies to those chunks and collections, not to each readout */
+  unsigned long int alignment;
+  unsigned long int alignment_threshold;   /* allocations at least this large are aligned */
+
+  /* Derives the settings left at 0 from the profile size and the profiles per repetition */
+  void FillDefaults(unsigned int samples, unsigned int channels, unsigned long int profiles_per_repetition);
+};
+
+class ChunkedDatasetSink : public AcquisitionSink
+{
+public:
+  ChunkedDatasetSink(std::string filename, std::string group, const HDF5LayoutOptions& layout);
+  ~ChunkedDatasetSink();
+
+  bool IsOpen() { return m_Data >= 0; }
+
+  void WriteHeader(const ISMRMRD::IsmrmrdHeader& h);
+  void AppendAcquisition(const ISMRMRD::Acquisition& acq);
+  void Flush();
+  void Close();
+
+  const HDF5LayoutOptions& GetLayout() { return m_Layout; }
+
+protected:
+  HDF5LayoutOptions m_Layout;
+
+  hid_t m_File;
+  hid_t m_Group;
+  hid_t m_Type;
+  hid_t m_Data;
+
+  unsigned long int m_ulWritten;
+  unsigned long int m_ulDataElementSize;  /* bytes of one element of the data member */
+
+  /* Acquisitions waiting to be written, the samples live in one contiguous buffer */
+  std::vector<HDF5Acquisition> m_Pending;
+  std::vector<float> m_Samples;
+  std::vector<unsigned long int> m_SampleOffsets;
+  unsigned long int m_ulAccountedBytes;  /* capacity of the buffers above reported to BrukerMemory */
+};
+
+#endif //CHUNKED_DATASET_SINK_HPP
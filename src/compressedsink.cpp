@@ -0,0 +1,370 @@
+#include "compressedsink.hpp"
+#include "ismrmrdhdf5types.hpp"
+#include "brukerfidfollower.hpp"
+#include "brukertrace.hpp"
+#include "brukermemory.hpp"
+
+#include <zlib.h>
+#if !H5_VERSION_GE(1,10,3)
+#include <hdf5_hl.h>
+#endif
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+
+CompressedSink::CompressedSink(std::string filename, std::string group,
+			       unsigned int samples, unsigned int channels,
+			       int compression_level, unsigned int threads,
+			       unsigned int profiles_per_chunk)
+  : m_File(-1),
+    m_Group(-1),
+    m_HeaderType(-1),
+    m_Headers(-1),
+    m_Samples(-1),
+    m_uiSamples(samples),
+    m_uiChannels(channels),
+    m_iCompressionLevel(compression_level),
+    m_uiProfilesPerChunk(profiles_per_chunk),
+    m_ulChunkBytes(0),
+    m_pCurrent(0),
+    m_ulNextBlock(0),
+    m_ulProfilesWritten(0),
+    m_ulPendingHead(0),
+    m_ulPendingCount(0),
+    m_ulInFlight(0),
+    m_ulMaxInFlight(0),
+    m_bDone(false),
+    m_bClosed(false),
+    m_ullRawBytes(0),
+    m_ullCompressedBytes(0),
+    m_dStartTime(0.0),
+    m_dElapsed(0.0)
+{
+  unsigned long int profile_bytes = static_cast<unsigned long int>(m_uiSamples)*m_uiChannels*2*sizeof(float);
+
+  /* Default to chunks of about 1 MB, which deflate well and keep the number of chunks down */
+  if (m_uiProfilesPerChunk == 0) {
+    m_uiProfilesPerChunk = static_cast<unsigned int>((1UL << 20) / (profile_bytes ? profile_bytes : 1));
+    if (m_uiProfilesPerChunk == 0) m_uiProfilesPerChunk = 1;
+  }
+  m_ulChunkBytes = profile_bytes*m_uiProfilesPerChunk;
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  m_ulMaxInFlight = 2*threads;
+  m_Pending.assign(m_ulMaxInFlight, 0);
+  m_Compressed.assign(m_ulMaxInFlight, 0);
+
+  m_File = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (m_File < 0) {
+    std::cerr << "CompressedSink: unable to create " << filename << std::endl;
+    return;
+  }
+  m_Group = H5Gcreate2(m_File, group.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  /* Acquisition headers, compressed by HDF5 itself since they are small */
+  m_HeaderType = CreateAcquisitionHeaderType(filename + ".types.tmp");
+  if (m_HeaderType < 0) {
+    std::cerr << "CompressedSink: no ISMRMRD acquisition header type for " << filename << std::endl;
+    return;
+  }
+  {
+    hsize_t dims[1] = { 0 };
+    hsize_t maxdims[1] = { H5S_UNLIMITED };
+    hsize_t chunk[1] = { m_uiProfilesPerChunk };
+    hid_t space = H5Screate_simple(1, dims, maxdims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 1, chunk);
+    H5Pset_shuffle(dcpl);
+    H5Pset_deflate(dcpl, m_iCompressionLevel);
+    m_Headers = H5Dcreate2(m_Group, "acquisition_headers", m_HeaderType, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+  }
+
+  /* Samples, the chunks are compressed by us and written directly */
+  {
+    hsize_t dims[4] = { 0, m_uiChannels, m_uiSamples, 2 };
+    hsize_t maxdims[4] = { H5S_UNLIMITED, m_uiChannels, m_uiSamples, 2 };
+    hsize_t chunk[4] = { m_uiProfilesPerChunk, m_uiChannels, m_uiSamples, 2 };
+    hid_t space = H5Screate_simple(4, dims, maxdims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 4, chunk);
+    H5Pset_shuffle(dcpl);
+    H5Pset_deflate(dcpl, m_iCompressionLevel);
+    m_Samples = H5Dcreate2(m_Group, "samples", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+  }
+
+  if (m_Headers < 0 || m_Samples < 0) {
+    std::cerr << "CompressedSink: unable to create datasets in " << filename << std::endl;
+  }
+
+  for (unsigned int i = 0; i < threads; i++) {
+    m_Workers.push_back(std::thread(&CompressedSink::CompressWorker, this));
+  }
+  m_Writer = std::thread(&CompressedSink::WriterLoop, this);
+}
+
+CompressedSink::~CompressedSink()
+{
+  Close();
+}
+
+/* Bytes held by a block, for the memory accounting */
+static unsigned long int BlockBytes(const std::vector<ISMRMRD::ISMRMRD_AcquisitionHeader>& headers,
+				    const std::vector<float>& samples, const std::vector<unsigned char>& shuffled,
+				    const std::vector<unsigned char>& compressed)
+{
+  return headers.capacity()*sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader) + samples.capacity()*sizeof(float) +
+    shuffled.capacity() + compressed.capacity();
+}
+
+void CompressedSink::WriteHeader(const ISMRMRD::IsmrmrdHeader& h)
+{
+  std::stringstream str;
+  ISMRMRD::serialize(h, str);
+
+  std::lock_guard<std::mutex> lock(m_H5Mutex);
+  if (!WriteIsmrmrdXmlHeader(m_Group, str.str())) {
+    std::cerr << "CompressedSink: unable to write XML header" << std::endl;
+  }
+}
+
+void CompressedSink::AppendAcquisition(const ISMRMRD::Acquisition& acq)
+{
+  if (m_dStartTime == 0.0) m_dStartTime = BrukerMonotonicSeconds();
+
+  if (!m_pCurrent) {
+    /* Written blocks are reused, so that the steady state allocates nothing */
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if (!m_FreeBlocks.empty()) {
+	m_pCurrent = m_FreeBlocks.back();
+	m_FreeBlocks.pop_back();
+      }
+    }
+    if (!m_pCurrent) {
+      m_pCurrent = new Block;
+      m_pCurrent->headers.reserve(m_uiProfilesPerChunk);
+      m_pCurrent->samples.assign(m_ulChunkBytes/sizeof(float), 0.0f);
+      BrukerMemory::Allocated(BrukerMemory::MEMORY_OUTPUT_BUFFERS,
+			      BlockBytes(m_pCurrent->headers, m_pCurrent->samples, m_pCurrent->shuffled, m_pCurrent->compressed));
+    }
+    m_pCurrent->index = 0;
+    m_pCurrent->profiles = 0;
+    m_pCurrent->deflated = false;
+    m_pCurrent->headers.clear();
+  }
+
+  unsigned long int profile_floats = static_cast<unsigned long int>(m_uiSamples)*m_uiChannels*2;
+  unsigned long int n = static_cast<unsigned long int>(acq.getNumberOfSamples())*acq.getActiveChannels()*2;
+  if (n > profile_floats) n = profile_floats;
+
+  m_pCurrent->headers.push_back(acq.getHead());
+  memcpy(&m_pCurrent->samples[m_pCurrent->profiles*profile_floats], acq.getDataPtr(), n*sizeof(float));
+  m_pCurrent->profiles++;
+
+  if (m_pCurrent->profiles == m_uiProfilesPerChunk) {
+    SubmitBlock();
+  }
+}
+
+void CompressedSink::SubmitBlock()
+{
+  if (!m_pCurrent) return;
+
+  /* Edge chunks are stored full size, the tail of a reused block must be zeroed */
+  unsigned long int used = static_cast<unsigned long int>(m_pCurrent->profiles)*m_uiSamples*m_uiChannels*2;
+  if (used < m_pCurrent->samples.size()) {
+    std::fill(m_pCurrent->samples.begin() + used, m_pCurrent->samples.end(), 0.0f);
+  }
+
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  while (m_ulInFlight >= m_ulMaxInFlight) m_SlotFree.wait(lock);
+  m_ulInFlight++;
+  m_pCurrent->index = m_ulNextBlock++;
+  /* Pending blocks are in flight, so the ring cannot overflow */
+  m_Pending[(m_ulPendingHead + m_ulPendingCount) % m_ulMaxInFlight] = m_pCurrent;
+  m_ulPendingCount++;
+  m_pCurrent = 0;
+  m_WorkAvailable.notify_one();
+}
+
+void CompressedSink::CompressWorker()
+{
+  BrukerTrace::SetThreadName("compress");
+  while (true) {
+    Block* b = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      while (m_ulPendingCount == 0 && !m_bDone) m_WorkAvailable.wait(lock);
+      if (m_ulPendingCount == 0) return;
+      b = m_Pending[m_ulPendingHead];
+      m_ulPendingHead = (m_ulPendingHead + 1) % m_ulMaxInFlight;
+      m_ulPendingCount--;
+    }
+
+    CompressBlock(b);
+
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Compressed[b->index % m_ulMaxInFlight] = b;
+    }
+    m_BlockCompressed.notify_all();
+  }
+}
+
+void CompressedSink::CompressBlock(Block* b)
+{
+  BrukerTraceScope trace("compress_block", "compress", b->samples.size()*sizeof(float));
+  unsigned long int accounted = BlockBytes(b->headers, b->samples, b->shuffled, b->compressed);
+
+  /* Byte shuffle with the element size of float, identical to the HDF5 shuffle filter,
+     into a buffer that stays with the block so reused blocks do not allocate */
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(&b->samples[0]);
+  unsigned long int elements = b->samples.size();
+  std::vector<unsigned char>& shuffled = b->shuffled;
+  shuffled.resize(elements*sizeof(float));
+  for (unsigned int j = 0; j < sizeof(float); j++) {
+    unsigned char* out = &shuffled[j*elements];
+    for (unsigned long int i = 0; i < elements; i++) {
+      out[i] = in[i*sizeof(float)+j];
+    }
+  }
+
+  uLongf compressed_size = compressBound(shuffled.size());
+  unsigned long int capacity = b->compressed.capacity();
+  b->compressed.resize(compressed_size);
+  BrukerMemory::Allocated(BrukerMemory::MEMORY_OUTPUT_BUFFERS, b->compressed.capacity() - capacity);
+  accounted += b->compressed.capacity() - capacity;
+  if (compress2(&b->compressed[0], &compressed_size, &shuffled[0], shuffled.size(), m_iCompressionLevel) != Z_OK ||
+      compressed_size >= shuffled.size()) {
+    /* Incompressible, store the shuffled bytes and mark deflate as skipped */
+    memcpy(&b->compressed[0], &shuffled[0], shuffled.size());
+    b->compressed.resize(shuffled.size());
+  } else {
+    b->compressed.resize(compressed_size);
+    b->deflated = true;
+  }
+
+  unsigned long int held = BlockBytes(b->headers, b->samples, b->shuffled, b->compressed);
+  if (held > accounted) BrukerMemory::Allocated(BrukerMemory::MEMORY_OUTPUT_BUFFERS, held - accounted);
+  else BrukerMemory::Released(BrukerMemory::MEMORY_OUTPUT_BUFFERS, accounted - held);
+}
+
+void CompressedSink::WriterLoop()
+{
+  BrukerTrace::SetThreadName("hdf5_writer");
+  unsigned long int next = 0;
+  while (true) {
+    Block* b = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      /* At most m_ulMaxInFlight blocks from next on are in flight, so their slots differ */
+      Block*& slot = m_Compressed[next % m_ulMaxInFlight];
+      while (!slot && !(m_bDone && next == m_ulNextBlock)) {
+	m_BlockCompressed.wait(lock);
+      }
+      if (!slot) return;
+      b = slot;
+      slot = 0;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_H5Mutex);
+      WriteBlock(b);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_ulInFlight--;
+      m_FreeBlocks.push_back(b);
+    }
+    m_SlotFree.notify_all();
+    next++;
+  }
+}
+
+void CompressedSink::WriteBlock(Block* b)
+{
+  BrukerTraceScope trace("hdf5_write_chunk", "hdf5", b->compressed.size());
+  /* Bit 1 marks deflate, the second filter in the pipeline, as skipped */
+  uint32_t filter_mask = b->deflated ? 0x0 : 0x2;
+
+  hsize_t first = b->index*m_uiProfilesPerChunk;
+  hsize_t total = first + b->profiles;
+
+  /* Headers */
+  hsize_t hdims[1] = { total };
+  H5Dset_extent(m_Headers, hdims);
+  hid_t fspace = H5Dget_space(m_Headers);
+  hsize_t hstart[1] = { first };
+  hsize_t hcount[1] = { b->profiles };
+  H5Sselect_hyperslab(fspace, H5S_SELECT_SET, hstart, 0, hcount, 0);
+  hid_t mspace = H5Screate_simple(1, hcount, 0);
+  H5Dwrite(m_Headers, m_HeaderType, mspace, fspace, H5P_DEFAULT, &b->headers[0]);
+  H5Sclose(mspace);
+  H5Sclose(fspace);
+
+  /* Samples */
+  hsize_t sdims[4] = { total, m_uiChannels, m_uiSamples, 2 };
+  H5Dset_extent(m_Samples, sdims);
+  hsize_t offset[4] = { first, 0, 0, 0 };
+#if H5_VERSION_GE(1,10,3)
+  herr_t err = H5Dwrite_chunk(m_Samples, H5P_DEFAULT, filter_mask, offset, b->compressed.size(), &b->compressed[0]);
+#else
+  herr_t err = H5DOwrite_chunk(m_Samples, H5P_DEFAULT, filter_mask, offset, b->compressed.size(), &b->compressed[0]);
+#endif
+  if (err < 0) {
+    std::cerr << "CompressedSink: direct chunk write failed for block " << b->index << std::endl;
+  }
+
+  m_ullRawBytes += static_cast<unsigned long long>(b->profiles)*m_uiSamples*m_uiChannels*2*sizeof(float);
+  m_ullCompressedBytes += b->compressed.size();
+  m_ulProfilesWritten = total;
+}
+
+void CompressedSink::Close()
+{
+  if (m_bClosed) return;
+  m_bClosed = true;
+
+  SubmitBlock();
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_bDone = true;
+  }
+  m_WorkAvailable.notify_all();
+  m_BlockCompressed.notify_all();
+  for (size_t i = 0; i < m_Workers.size(); i++) m_Workers[i].join();
+  m_BlockCompressed.notify_all();
+  if (m_Writer.joinable()) m_Writer.join();
+
+  for (size_t i = 0; i < m_FreeBlocks.size(); i++) {
+    Block* b = m_FreeBlocks[i];
+    BrukerMemory::Released(BrukerMemory::MEMORY_OUTPUT_BUFFERS, BlockBytes(b->headers, b->samples, b->shuffled, b->compressed));
+    delete b;
+  }
+  m_FreeBlocks.clear();
+
+  if (m_dStartTime > 0.0) m_dElapsed = BrukerMonotonicSeconds() - m_dStartTime;
+
+  if (m_Samples >= 0) H5Dclose(m_Samples);
+  if (m_Headers >= 0) H5Dclose(m_Headers);
+  if (m_HeaderType >= 0) H5Tclose(m_HeaderType);
+  if (m_Group >= 0) H5Gclose(m_Group);
+  if (m_File >= 0) H5Fclose(m_File);
+  m_Samples = m_Headers = m_HeaderType = m_Group = m_File = -1;
+}
+
+void CompressedSink::PrintStatistics(std::ostream& s)
+{
+  double ratio = m_ullCompressedBytes ? static_cast<double>(m_ullRawBytes)/m_ullCompressedBytes : 0.0;
+  double mbs = m_dElapsed > 0.0 ? m_ullRawBytes/(1024.0*1024.0)/m_dElapsed : 0.0;
+  s << "Compressed " << m_ullRawBytes/(1024.0*1024.0) << " MB of samples to "
+    << m_ullCompressedBytes/(1024.0*1024.0) << " MB (ratio " << ratio << ") at "
+    << mbs << " MB/s with " << m_Workers.size() << " threads" << std::endl;
+}
@@ -0,0 +1,110 @@
+/*****************************************************
+ *
+ *  Compressed HDF5 output
+ *
+ *  ISMRMRD stores acquisition samples as variable
+ *  length data, which HDF5 filters cannot compress.
+ *  This sink writes the same information as a
+ *  fixed size layout that can be compressed:
+ *
+ *    <group>/xml                  ISMRMRD XML header
+ *    <group>/acquisition_headers  [N] AcquisitionHeader
+ *    <group>/samples              [N][nc][nx][2] float
+ *
+ *  Sample chunks are shuffled and deflated on worker
+ *  threads and handed to HDF5 with direct chunk
+ *  writes, so compression does not serialize the
+ *  writer. The chunks are ordinary shuffle+deflate
+ *  chunks and can be read by any HDF5 reader.
+ *
+ *****************************************************/
+
+#ifndef COMPRESSED_SINK_HPP
+#define COMPRESSED_SINK_HPP
+
+#include "acquisitionsink.hpp"
+
+#include <hdf5.h>
+
+#include <ostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class CompressedSink : public AcquisitionSink
+{
+public:
+  CompressedSink(std::string filename, std::string group,
+		 unsigned int samples, unsigned int channels,
+		 int compression_level = 4, unsigned int threads = 0,
+		 unsigned int profiles_per_chunk = 0);
+  ~CompressedSink();
+
+  bool IsOpen() { return m_File >= 0 && m_Headers >= 0 && m_Samples >= 0; }
+
+  void WriteHeader(const ISMRMRD::IsmrmrdHeader& h);
+  void AppendAcquisition(const ISMRMRD::Acquisition& acq);
+  void Close();
+
+  void PrintStatistics(std::ostream& s);
+
+protected:
+  struct Block {
+    unsigned long int index;
+    unsigned int profiles;
+    bool deflated;
+    std::vector<ISMRMRD::ISMRMRD_AcquisitionHeader> headers;
+    std::vector<float> samples;
+    std::vector<unsigned char> shuffled;
+    std::vector<unsigned char> compressed;
+  };
+
+  void SubmitBlock();
+  void CompressWorker();
+  void WriterLoop();
+  void CompressBlock(Block* b);
+  void WriteBlock(Block* b);
+
+  hid_t m_File;
+  hid_t m_Group;
+  hid_t m_HeaderType;
+  hid_t m_Headers;
+  hid_t m_Samples;
+
+  unsigned int m_uiSamples;
+  unsigned int m_uiChannels;
+  int m_iCompressionLevel;
+  unsigned int m_uiProfilesPerChunk;
+  unsigned long int m_ulChunkBytes;
+
+  Block* m_pCurrent;
+  unsigned long int m_ulNextBlock;
+  unsigned long int m_ulProfilesWritten;
+
+  /* Blocks waiting for compression, and compressed blocks waiting to be written in order */
+  std::vector<Block*> m_Pending;     /* ring of m_ulMaxInFlight entries, oldest at m_ulPendingHead */
+  unsigned long int m_ulPendingHead;
+  unsigned long int m_ulPendingCount;
+  std::vector<Block*> m_Compressed;  /* by index modulo m_ulMaxInFlight, 0 while not compressed */
+  std::vector<Block*> m_FreeBlocks;  /* written blocks, ready for reuse */
+  unsigned long int m_ulInFlight;
+  unsigned long int m_ulMaxInFlight;
+  bool m_bDone;
+  std::mutex m_Mutex;
+  std::mutex m_H5Mutex; /* HDF5 is not thread safe, all HDF5 calls after setup hold this */
+  std::condition_variable m_WorkAvailable;
+  std::condition_variable m_BlockCompressed;
+  std::condition_variable m_SlotFree;
+
+  std::vector<std::thread> m_Workers;
+  std::thread m_Writer;
+  bool m_bClosed;
+
+  unsigned long long m_ullRawBytes;
+  unsigned long long m_ullCompressedBytes;
+  double m_dStartTime;
+  double m_dElapsed;
+};
+
+#endif //COMPRESSED_SINK_HPP
@@ -0,0 +1,130 @@
+// ismrmrd_to_bruker.cpp
+// Writes the acquisitions of an ISMRMRD dataset as a Bruker fid with
+// a minimal acqp and method, e.g. to make test data for the converter
+//
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <algorithm>
+
+#include "brukerfidexporter.hpp"
+#include "brukerfidfollower.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char** argv)
+{
+    std::string in_filename;
+    std::string in_group;
+    std::string out_directory;
+    int bits;
+    unsigned int threads;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+            ("help,h", "produce help message")
+            ("filename,f", po::value<std::string>(&in_filename), "Input ISMRMRD file")
+            ("in-group,g", po::value<std::string>(&in_group)->default_value("dataset"), "Input group name")
+            ("outdir,o", po::value<std::string>(&out_directory)->default_value("bruker"), "Output directory for fid, acqp and method")
+            ("bits,b", po::value<int>(&bits)->default_value(32), "Sample format: 16 or 32 bit integers, 0 for float")
+            ("kblock", "Pad profiles to 1024 bytes (Standard_KBlock_Format)")
+            ("subject", "Also write a placeholder subject file next to the output directory")
+            ("threads,t", po::value<unsigned int>(&threads)->default_value(0), "Threads, 0 for one per core")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || !vm.count("filename")) {
+        std::cout << desc << std::endl;
+        return vm.count("help") ? 0 : -1;
+    }
+
+    BrukerRawDataProfile::BrukerDataFormat format;
+    if (bits == 16) {
+        format = BrukerRawDataProfile::GO_16BIT_SGN_INT;
+    } else if (bits == 32) {
+        format = BrukerRawDataProfile::GO_32BIT_SGN_INT;
+    } else if (bits == 0) {
+        format = BrukerRawDataProfile::GO_32BIT_FLOAT;
+    } else {
+        std::cerr << "Unsupported sample format: " << bits << " bits" << std::endl;
+        return -1;
+    }
+    mr_recon::set_number_of_threads(threads);
+
+    ISMRMRD::Dataset d(in_filename.c_str(), in_group.c_str(), false);
+    uint32_t acquisitions = d.getNumberOfAcquisitions();
+    if (acquisitions == 0) {
+        std::cerr << "No acquisitions in " << in_filename << std::endl;
+        return -1;
+    }
+
+    double t0 = BrukerMonotonicSeconds();
+
+    // First pass for the extent of k-space, the repetitions are not in the header
+    ISMRMRD::Acquisition acq;
+    int nx = 0, nc = 0, ky = 0, kz = 0, slices = 0, echoes = 0, repetitions = 0;
+    for (uint32_t i = 0; i < acquisitions; i++) {
+        d.readAcquisition(i, acq);
+        if (i == 0) {
+            nx = acq.number_of_samples();
+            nc = acq.active_channels();
+        } else if (acq.number_of_samples() != nx || acq.active_channels() != nc) {
+            std::cerr << "Acquisition " << i << " has a different size than the first one" << std::endl;
+            return -1;
+        }
+        ky = std::max(ky, static_cast<int>(acq.idx().kspace_encode_step_1) + 1);
+        kz = std::max(kz, static_cast<int>(acq.idx().kspace_encode_step_2) + 1);
+        slices = std::max(slices, static_cast<int>(acq.idx().slice) + 1);
+        echoes = std::max(echoes, static_cast<int>(acq.idx().contrast) + 1);
+        repetitions = std::max(repetitions, static_cast<int>(acq.idx().repetition) + 1);
+    }
+
+    std::vector<int> dims;
+    // The echoes of a slice are separate objects in the fid, object = slice*echoes + echo
+    dims.push_back(nx*nc); dims.push_back(ky); dims.push_back(kz); dims.push_back(slices*echoes); dims.push_back(repetitions);
+    mr_recon::ComplexFloatArray kspace(&dims);
+    if (kspace.get_number_of_elements() == 0) {
+        std::cerr << "Unable to allocate k-space" << std::endl;
+        return -1;
+    }
+    std::cout << "K-space " << nx << " samples x " << nc << " channels x " << ky << " x " << kz
+              << " x " << slices << " slices x " << echoes << " echoes x " << repetitions << " repetitions" << std::endl;
+
+    // Second pass scatters the acquisitions, channels follow each other in kx as in the converter
+    mr_recon::ComplexFloatArrayView kv(kspace);
+    for (uint32_t i = 0; i < acquisitions; i++) {
+        d.readAcquisition(i, acq);
+        std::complex<float>* line = &kv(0, acq.idx().kspace_encode_step_1, acq.idx().kspace_encode_step_2,
+                                        acq.idx().slice*echoes + acq.idx().contrast, acq.idx().repetition);
+        std::copy(acq.getDataPtr(), acq.getDataPtr() + nx*nc, line);
+    }
+    double t_read = BrukerMonotonicSeconds() - t0;
+
+    t0 = BrukerMonotonicSeconds();
+    BrukerFidExporter exporter(format);
+    exporter.SetNumberOfChannels(nc);
+    exporter.SetNumberOfEchoes(echoes);
+    exporter.SetKBlockFormat(vm.count("kblock") > 0);
+    if (!exporter.Export(out_directory, kv)) {
+        return -1;
+    }
+    if (vm.count("subject") && !BrukerFidExporter::WriteSubjectFile(out_directory + "/../subject")) {
+        return -1;
+    }
+    double t_write = BrukerMonotonicSeconds() - t0;
+
+    std::cout << "Read " << acquisitions << " acquisitions in " << t_read << " s, wrote "
+              << exporter.GetBytesWritten() << " bytes of fid in " << t_write << " s ("
+              << exporter.GetBytesWritten()/(1024.0*1024.0)/t_write << " MB/s)" << std::endl;
+
+    return 0;
+}
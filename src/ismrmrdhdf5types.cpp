@@ -0,0 +1,116 @@
+#include "ismrmrdhdf5types.hpp"
+
+#include "ismrmrd/dataset.h"
+
+#include <iostream>
+#include <stddef.h>
+#include <unistd.h>
+
+/* Read once per process, copies are handed out */
+static hid_t s_AcquisitionType = -1;
+
+static bool MemberMatches(hid_t compound, const char* name, size_t offset, size_t size, H5T_class_t type_class)
+{
+  int i = H5Tget_member_index(compound, name);
+  if (i < 0 || H5Tget_member_offset(compound, i) != offset || H5Tget_member_class(compound, i) != type_class) {
+    return false;
+  }
+  hid_t member = H5Tget_member_type(compound, i);
+  bool ok = (H5Tget_size(member) == size);
+  H5Tclose(member);
+  return ok;
+}
+
+static hid_t ReadLibraryAcquisitionType(const std::string& scratch_filename)
+{
+  try {
+    ISMRMRD::Dataset d(scratch_filename.c_str(), "dataset", true);
+    ISMRMRD::Acquisition acq;
+    acq.resize(1, 1);
+    d.appendAcquisition(acq);
+  } catch (...) {
+    std::cerr << "ISMRMRD types: unable to write " << scratch_filename << std::endl;
+    unlink(scratch_filename.c_str());
+    return -1;
+  }
+
+  hid_t native = -1;
+  hid_t file = H5Fopen(scratch_filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file >= 0) {
+    hid_t data = H5Dopen2(file, "dataset/data", H5P_DEFAULT);
+    if (data >= 0) {
+      hid_t t = H5Dget_type(data);
+      native = H5Tget_native_type(t, H5T_DIR_ASCEND);
+      H5Tclose(t);
+      H5Dclose(data);
+    }
+    H5Fclose(file);
+  }
+  unlink(scratch_filename.c_str());
+
+  if (native < 0) {
+    std::cerr << "ISMRMRD types: no acquisition dataset in " << scratch_filename << std::endl;
+    return -1;
+  }
+  if (H5Tget_size(native) != sizeof(HDF5Acquisition) ||
+      !MemberMatches(native, "head", HOFFSET(HDF5Acquisition, head), sizeof(ISMRMRD::ISMRMRD_AcquisitionHeader), H5T_COMPOUND) ||
+      !MemberMatches(native, "traj", HOFFSET(HDF5Acquisition, traj), sizeof(hvl_t), H5T_VLEN) ||
+      !MemberMatches(native, "data", HOFFSET(HDF5Acquisition, data), sizeof(hvl_t), H5T_VLEN)) {
+    std::cerr << "ISMRMRD types: the acquisition layout of this ISMRMRD library does not match, "
+	      << "use the default writer" << std::endl;
+    H5Tclose(native);
+    return -1;
+  }
+  return native;
+}
+
+hid_t CreateAcquisitionType(const std::string& scratch_filename)
+{
+  if (s_AcquisitionType < 0) s_AcquisitionType = ReadLibraryAcquisitionType(scratch_filename);
+  return (s_AcquisitionType < 0) ? -1 : H5Tcopy(s_AcquisitionType);
+}
+
+hid_t CreateAcquisitionHeaderType(const std::string& scratch_filename)
+{
+  hid_t t = CreateAcquisitionType(scratch_filename);
+  if (t < 0) return -1;
+  hid_t head = H5Tget_member_type(t, H5Tget_member_index(t, "head"));
+  H5Tclose(t);
+  return head;
+}
+
+size_t GetVlenElementSize(hid_t acquisition_type, const char* member)
+{
+  int i = H5Tget_member_index(acquisition_type, member);
+  if (i < 0) return 0;
+  hid_t vlen = H5Tget_member_type(acquisition_type, i);
+  hid_t base = H5Tget_super(vlen);
+  size_t size = (base >= 0) ? H5Tget_size(base) : 0;
+  if (base >= 0) H5Tclose(base);
+  H5Tclose(vlen);
+  return size;
+}
+
+bool WriteIsmrmrdXmlHeader(hid_t group, const std::string& xml)
+{
+  hsize_t dims[1] = { 1 };
+  hid_t space = H5Screate_simple(1, dims, dims);
+  hid_t type = H5Tcopy(H5T_C_S1);
+  H5Tset_size(type, H5T_VARIABLE);
+
+  if (H5Lexists(group, "xml", H5P_DEFAULT) > 0) {
+    H5Ldelete(group, "xml", H5P_DEFAULT);
+  }
+
+  bool ok = false;
+  hid_t dset = H5Dcreate2(group, "xml", type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  if (dset >= 0) {
+    const char* buff[1] = { xml.c_str() };
+    ok = (H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff) >= 0);
+    H5Dclose(dset);
+  }
+
+  H5Tclose(type);
+  H5Sclose(space);
+  return ok;
+}
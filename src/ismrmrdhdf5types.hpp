@@ -0,0 +1,45 @@
+/*****************************************************
+ *
+ *  HDF5 datatypes of the ISMRMRD file layout
+ *
+ *  The acquisition compound type is not rebuilt here
+ *  but taken from ISMRMRD itself: the library writes
+ *  one acquisition to a scratch file and the type of
+ *  its <group>/data dataset is read back as a native
+ *  memory type. Datasets created with it are what
+ *  ISMRMRD::Dataset writes, whatever the version of
+ *  the library, and a layout that no longer fits
+ *  HDF5Acquisition is refused instead of written.
+ *
+ *****************************************************/
+
+#ifndef ISMRMRD_HDF5_TYPES_HPP
+#define ISMRMRD_HDF5_TYPES_HPP
+
+#include <hdf5.h>
+#include <string>
+
+#include "ismrmrd/ismrmrd.h"
+
+/* Memory layout of one element of <group>/data, samples and trajectory are variable length */
+typedef struct HDF5Acquisition {
+  ISMRMRD::ISMRMRD_AcquisitionHeader head;
+  hvl_t traj;
+  hvl_t data;
+} HDF5Acquisition;
+
+/* Compound type of HDF5Acquisition as ISMRMRD::Dataset writes it, the caller closes it.
+   The first call lets the library write scratch_filename, which is removed again; the
+   type is kept for later calls. -1 if the library's layout does not match HDF5Acquisition. */
+hid_t CreateAcquisitionType(const std::string& scratch_filename);
+
+/* The "head" member of the above, ISMRMRD_AcquisitionHeader, -1 on failure */
+hid_t CreateAcquisitionHeaderType(const std::string& scratch_filename);
+
+/* Bytes of one element of the variable length member "data" or "traj", what hvl_t::len counts */
+size_t GetVlenElementSize(hid_t acquisition_type, const char* member);
+
+/* Writes the XML header as <group>/xml the same way ISMRMRD::Dataset::writeHeader does */
+bool WriteIsmrmrdXmlHeader(hid_t group, const std::string& xml);
+
+#endif //ISMRMRD_HDF5_TYPES_HPP
@@ -0,0 +1,34 @@
+#include "brukerallocationcounter.hpp"
+
+#include <atomic>
+
+/* Constant initialized only, the counting operator new may run before any constructor */
+static bool s_bEnabled = false;
+static thread_local unsigned long int s_ulThreadAllocations = 0;
+static std::atomic<unsigned long int> s_ulTotalAllocations(0);
+
+bool BrukerAllocationCounter::IsEnabled()
+{
+  return s_bEnabled;
+}
+
+unsigned long int BrukerAllocationCounter::GetThreadAllocations()
+{
+  return s_ulThreadAllocations;
+}
+
+unsigned long int BrukerAllocationCounter::GetTotalAllocations()
+{
+  return s_ulTotalAllocations.load(std::memory_order_relaxed);
+}
+
+void BrukerAllocationCounter::Enable()
+{
+  s_bEnabled = true;
+}
+
+void BrukerAllocationCounter::Count()
+{
+  s_ulThreadAllocations++;
+  s_ulTotalAllocations.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+/*****************************************************
+ *
+ *  Allocation counting
+ *
+ *  Counts the heap allocations of each thread and of
+ *  the whole process, through operator new and the C
+ *  allocation functions, so that a test can check
+ *  that the steady state of a pipeline does not
+ *  allocate in any of its threads. Counting only
+ *  happens in programs that link the counting
+ *  allocator (src/bench/countingallocator.cpp);
+ *  everywhere else IsEnabled() is false and the
+ *  counts stay zero.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_ALLOCATIONCOUNTER_HPP
+#define BRUKER_ALLOCATIONCOUNTER_HPP
+
+class BrukerAllocationCounter
+{
+
+public:
+  /* True if the allocations of this program are counted */
+  static bool IsEnabled();
+
+  /* Allocations made by the calling thread so far */
+  static unsigned long int GetThreadAllocations();
+
+  /* Allocations made by all threads so far */
+  static unsigned long int GetTotalAllocations();
+
+  /* Called by the counting allocator */
+  static void Enable();
+  static void Count();
+};
+
+#endif //BRUKER_ALLOCATIONCOUNTER_HPP
@@ -0,0 +1,375 @@
+#include "brukerasyncfidreader.hpp"
+#include "brukertrace.hpp"
+
+#include <iostream>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* Largest gap of unused bytes (KBlock padding) that is read through rather than starting a new read */
+#define MAX_READ_GAP 65536
+
+BrukerAsyncFidReader::BrukerAsyncFidReader(unsigned int queue_depth, unsigned long int block_size)
+  : m_iFile(-1),
+    m_uiQueueDepth(queue_depth ? queue_depth : 1),
+    m_ulBlockSize(block_size ? block_size : 4096),
+    m_ulNextSubmit(0),
+    m_ulCurrentBatch(0),
+    m_ulNextProfile(0),
+    m_bCurrentReady(false),
+    m_bUring(false),
+    m_pRing(0),
+    m_ulBytesRead(0),
+    m_pStatistics(0),
+    m_BufferMemory(BrukerMemory::MEMORY_READ_BUFFERS),
+    m_ulRequested(0),
+    m_ulNextRead(0),
+    m_bStopReads(false)
+{
+
+}
+
+BrukerAsyncFidReader::~BrukerAsyncFidReader()
+{
+  Close();
+}
+
+bool BrukerAsyncFidReader::Open(std::string filename)
+{
+  Close();
+  m_iFile = open(filename.c_str(), O_RDONLY);
+  if (m_iFile < 0) {
+    std::cerr << "BrukerAsyncFidReader: unable to open " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void BrukerAsyncFidReader::Close()
+{
+  StopReadThread();
+#ifdef HAVE_LIBURING
+  if (m_pRing) {
+    struct io_uring* ring = static_cast<struct io_uring*>(m_pRing);
+    /* Drain reads that are still in flight before the buffers go away */
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+      if (m_Slots[i].batch >= 0 && !m_Slots[i].complete) WaitFor(i);
+    }
+    io_uring_queue_exit(ring);
+    delete ring;
+    m_pRing = 0;
+  }
+#endif
+  m_bUring = false;
+  FreeBuffers();
+
+  if (m_iFile >= 0) {
+    close(m_iFile);
+    m_iFile = -1;
+  }
+}
+
+void BrukerAsyncFidReader::StopReadThread()
+{
+  if (!m_ReadThread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(m_ReadMutex);
+    m_bStopReads = true;
+  }
+  m_ReadWake.notify_all();
+  m_ReadThread.join();
+}
+
+void BrukerAsyncFidReader::ReadLoop()
+{
+  std::unique_lock<std::mutex> lock(m_ReadMutex);
+  while (true) {
+    while (!m_bStopReads && m_ulNextRead >= m_ulRequested) m_ReadWake.wait(lock);
+    if (m_bStopReads) return;
+
+    /* Batches are submitted in order, so the next one is in its slot already */
+    unsigned int slot = static_cast<unsigned int>(m_ulNextRead % m_uiQueueDepth);
+    lock.unlock();
+    long result;
+    {
+      BrukerTraceScope trace("pread_batch", "io", m_Batches[m_Slots[slot].batch].length);
+      result = ReadBlocking(slot, 0);
+    }
+    lock.lock();
+    m_Slots[slot].result = result;
+    m_Slots[slot].complete = true;
+    m_ulNextRead++;
+    m_ReadDone.notify_all();
+  }
+}
+
+void BrukerAsyncFidReader::FreeBuffers()
+{
+  for (size_t i = 0; i < m_Slots.size(); i++) {
+    free(m_Slots[i].buffer);
+  }
+  m_Slots.clear();
+  m_BufferMemory.Set(0);
+}
+
+bool BrukerAsyncFidReader::Start(BrukerRawDataProfile* first, ProfileFilter filter, void* user)
+{
+  if (m_iFile < 0) return false;
+
+  StopReadThread();
+  m_ulRequested = 0;
+  m_ulNextRead = 0;
+  m_bStopReads = false;
+
+  m_Profiles.clear();
+  m_Batches.clear();
+  m_ulNextSubmit = 0;
+  m_ulCurrentBatch = 0;
+  m_ulNextProfile = 0;
+  m_bCurrentReady = false;
+
+  /* Blocks must at least hold the largest profile */
+  for (BrukerRawDataProfile* p = first; p; p = p->GetNext()) {
+    if (filter && !filter(p, user)) continue;
+    m_Profiles.push_back(p);
+    if (p->GetReadSize() > m_ulBlockSize) m_ulBlockSize = p->GetReadSize();
+  }
+
+  /* Group profiles that follow each other in the file into one read */
+  for (unsigned long int i = 0; i < m_Profiles.size(); i++) {
+    unsigned long int pos = m_Profiles[i]->GetFilePosition();
+    unsigned long int end = pos + m_Profiles[i]->GetReadSize();
+    bool extend = false;
+    if (!m_Batches.empty()) {
+      Batch& b = m_Batches.back();
+      BrukerRawDataProfile* prev = m_Profiles[i-1];
+      unsigned long int prev_end = prev->GetFilePosition() + prev->GetReadSize();
+      extend = (pos >= prev_end) && (pos - prev_end <= MAX_READ_GAP) && (end - b.offset <= m_ulBlockSize);
+    }
+    if (extend) {
+      Batch& b = m_Batches.back();
+      b.length = end - b.offset;
+      b.count++;
+    } else {
+      Batch b;
+      b.offset = pos;
+      b.length = end - pos;
+      b.first = i;
+      b.count = 1;
+      m_Batches.push_back(b);
+    }
+  }
+
+  /* Page aligned buffers, one per read in flight */
+  FreeBuffers();
+  for (unsigned int i = 0; i < m_uiQueueDepth; i++) {
+    Slot s;
+    s.buffer = 0;
+    s.batch = -1;
+    s.complete = false;
+    s.result = 0;
+    if (posix_memalign(reinterpret_cast<void**>(&s.buffer), 4096, m_ulBlockSize) != 0) {
+      std::cerr << "BrukerAsyncFidReader: unable to allocate read buffers" << std::endl;
+      FreeBuffers();
+      return false;
+    }
+    m_Slots.push_back(s);
+  }
+  m_BufferMemory.Set(m_Slots.size()*m_ulBlockSize);
+
+#ifdef HAVE_LIBURING
+  if (!m_pRing) {
+    struct io_uring* ring = new struct io_uring;
+    if (io_uring_queue_init(m_uiQueueDepth, ring, 0) == 0) {
+      m_pRing = ring;
+      m_bUring = true;
+    } else {
+      delete ring;
+      std::cerr << "BrukerAsyncFidReader: io_uring unavailable, falling back to pread" << std::endl;
+    }
+  }
+  if (m_bUring) {
+    struct io_uring* ring = static_cast<struct io_uring*>(m_pRing);
+    std::vector<struct iovec> iov(m_Slots.size());
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+      iov[i].iov_base = m_Slots[i].buffer;
+      iov[i].iov_len = m_ulBlockSize;
+    }
+    io_uring_unregister_buffers(ring);
+    if (io_uring_register_buffers(ring, &iov[0], iov.size()) != 0) {
+      std::cerr << "BrukerAsyncFidReader: io_uring unavailable, falling back to pread" << std::endl;
+      io_uring_queue_exit(ring);
+      delete ring;
+      m_pRing = 0;
+      m_bUring = false;
+    }
+  }
+#endif
+
+  if (!m_bUring) {
+    m_ReadThread = std::thread(&BrukerAsyncFidReader::ReadLoop, this);
+  }
+
+  for (unsigned int i = 0; i < m_uiQueueDepth && m_ulNextSubmit < m_Batches.size(); i++) {
+    if (!Submit(i, m_ulNextSubmit++)) return false;
+  }
+
+  return true;
+}
+
+bool BrukerAsyncFidReader::Submit(unsigned int slot, unsigned long int batch)
+{
+  Slot& s = m_Slots[slot];
+  if (!m_bUring) {
+    /* Hand the read to the read thread */
+    {
+      std::lock_guard<std::mutex> lock(m_ReadMutex);
+      s.batch = static_cast<long>(batch);
+      s.complete = false;
+      s.result = 0;
+      m_ulRequested++;
+    }
+    m_ReadWake.notify_one();
+    return true;
+  }
+
+  s.batch = static_cast<long>(batch);
+  s.complete = false;
+  s.result = 0;
+
+#ifdef HAVE_LIBURING
+  if (m_bUring) {
+    struct io_uring* ring = static_cast<struct io_uring*>(m_pRing);
+    struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+    if (!sqe) {
+      /* Cannot happen with one slot per queue entry, but do not lose the read */
+      return ReadSync(slot);
+    }
+    const Batch& b = m_Batches[batch];
+    io_uring_prep_read_fixed(sqe, m_iFile, s.buffer, b.length, b.offset, slot);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(slot)));
+    if (io_uring_submit(ring) < 0) {
+      return ReadSync(slot);
+    }
+  }
+#endif
+
+  return true;
+}
+
+long BrukerAsyncFidReader::ReadBlocking(unsigned int slot, unsigned long int done)
+{
+  Slot& s = m_Slots[slot];
+  const Batch& b = m_Batches[s.batch];
+  while (done < b.length) {
+    ssize_t r = pread(m_iFile, s.buffer + done, b.length - done, b.offset + done);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {
+      std::cerr << "BrukerAsyncFidReader: Unable to read sufficient bytes at offset " << b.offset + done << std::endl;
+      return -1;
+    }
+    done += r;
+  }
+  return static_cast<long>(done);
+}
+
+bool BrukerAsyncFidReader::ReadSync(unsigned int slot)
+{
+  Slot& s = m_Slots[slot];
+  long r = ReadBlocking(slot, (s.result > 0) ? static_cast<unsigned long int>(s.result) : 0);
+  if (r < 0) return false;
+  s.result = r;
+  s.complete = true;
+  return true;
+}
+
+bool BrukerAsyncFidReader::WaitFor(unsigned int slot)
+{
+  Slot& s = m_Slots[slot];
+  BrukerTraceScope trace("read_batch", "io", m_Batches[s.batch].length);
+
+#ifdef HAVE_LIBURING
+  if (m_bUring) {
+    struct io_uring* ring = static_cast<struct io_uring*>(m_pRing);
+    while (!s.complete) {
+      struct io_uring_cqe* cqe = 0;
+      int ret = io_uring_wait_cqe(ring, &cqe);
+      if (ret == -EINTR) continue;
+      if (ret < 0) {
+	std::cerr << "BrukerAsyncFidReader: io_uring_wait_cqe failed" << std::endl;
+	return false;
+      }
+      unsigned int done_slot = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+      if (done_slot < m_Slots.size()) {
+	m_Slots[done_slot].complete = true;
+	m_Slots[done_slot].result = cqe->res;
+      }
+      io_uring_cqe_seen(ring, cqe);
+    }
+    if (s.result < 0) {
+      std::cerr << "BrukerAsyncFidReader: read failed with error " << -s.result << std::endl;
+      return false;
+    }
+    if (static_cast<unsigned long int>(s.result) < m_Batches[s.batch].length) {
+      /* Short read, fetch the rest synchronously */
+      s.complete = false;
+      if (!ReadSync(slot)) return false;
+    }
+    m_ulBytesRead += m_Batches[s.batch].length;
+    return true;
+  }
+#endif
+
+  {
+    std::unique_lock<std::mutex> lock(m_ReadMutex);
+    while (!s.complete) m_ReadDone.wait(lock);
+  }
+  if (s.result < 0) return false;
+  m_ulBytesRead += m_Batches[s.batch].length;
+  return true;
+}
+
+BrukerRawDataProfile* BrukerAsyncFidReader::NextProfile()
+{
+  const char* data = 0;
+  BrukerRawDataProfile* p = NextProfile(&data);
+  if (p) p->DecodeData(data, m_pStatistics);
+  return p;
+}
+
+BrukerRawDataProfile* BrukerAsyncFidReader::NextProfile(const char** data)
+{
+  while (m_ulCurrentBatch < m_Batches.size()) {
+    unsigned int slot = static_cast<unsigned int>(m_ulCurrentBatch % m_uiQueueDepth);
+    Slot& s = m_Slots[slot];
+
+    if (!m_bCurrentReady) {
+      if (!WaitFor(slot)) return 0;
+      m_bCurrentReady = true;
+      m_ulNextProfile = 0;
+    }
+
+    const Batch& b = m_Batches[m_ulCurrentBatch];
+    if (m_ulNextProfile < b.count) {
+      BrukerRawDataProfile* p = m_Profiles[b.first + m_ulNextProfile++];
+      *data = s.buffer + (p->GetFilePosition() - b.offset);
+      return p;
+    }
+
+    /* Batch used up, reuse its buffer for the next read */
+    s.batch = -1;
+    m_ulCurrentBatch++;
+    m_bCurrentReady = false;
+    if (m_ulNextSubmit < m_Batches.size()) {
+      if (!Submit(slot, m_ulNextSubmit++)) return 0;
+    }
+  }
+  return 0;
+}
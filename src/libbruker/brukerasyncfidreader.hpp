@@ -0,0 +1,111 @@
+/*****************************************************
+ *
+ *  Asynchronous reader for Bruker fid files
+ *
+ *  Consecutive profiles of the profile list are
+ *  grouped into large reads. On Linux with liburing
+ *  a configurable number of these reads is kept in
+ *  flight with io_uring into registered buffers;
+ *  otherwise a helper thread issues the same number
+ *  of reads ahead with pread.
+ *
+ *  Profiles are handed back in list order with their
+ *  data decoded, ready for conversion.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_ASYNCFIDREADER_HPP
+#define BRUKER_ASYNCFIDREADER_HPP
+
+#include "brukerrawdata.hpp"
+#include "brukersignalstatistics.hpp"
+#include "brukermemory.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class BrukerAsyncFidReader
+{
+
+public:
+  typedef bool (*ProfileFilter)(BrukerRawDataProfile* p, void* user);
+
+  BrukerAsyncFidReader(unsigned int queue_depth = 8, unsigned long int block_size = 4UL*1024*1024);
+  ~BrukerAsyncFidReader();
+
+  bool Open(std::string filename);
+  void Close();
+
+  /* Plans the reads for the linked profiles starting at first. Profiles
+     rejected by the filter are not read and not returned. */
+  bool Start(BrukerRawDataProfile* first, ProfileFilter filter = 0, void* user = 0);
+
+  /* Next profile in list order with its data decoded, 0 at the end or on error */
+  BrukerRawDataProfile* NextProfile();
+
+  /* As above without decoding, data points to the GetReadSize() raw bytes of the profile
+     and stays valid until the next call */
+  BrukerRawDataProfile* NextProfile(const char** data);
+
+  /* Collects signal statistics while the profiles are decoded, 0 to stop */
+  void SetStatistics(BrukerSignalStatistics* statistics) { m_pStatistics = statistics; }
+
+  bool UsingIoUring() { return m_bUring; }
+  unsigned long int GetBytesRead() { return m_ulBytesRead; }
+
+protected:
+  struct Batch {
+    unsigned long int offset;
+    unsigned long int length;
+    unsigned long int first;   /* index into m_Profiles */
+    unsigned long int count;
+  };
+
+  struct Slot {
+    char* buffer;
+    long batch;     /* batch in this slot, -1 when free */
+    bool complete;
+    long result;
+  };
+
+  bool Submit(unsigned int slot, unsigned long int batch);
+  bool WaitFor(unsigned int slot);
+  bool ReadSync(unsigned int slot);
+  long ReadBlocking(unsigned int slot, unsigned long int done);
+  void ReadLoop();
+  void StopReadThread();
+  void FreeBuffers();
+
+  int m_iFile;
+  unsigned int m_uiQueueDepth;
+  unsigned long int m_ulBlockSize;
+
+  std::vector<BrukerRawDataProfile*> m_Profiles;
+  std::vector<Batch> m_Batches;
+  std::vector<Slot> m_Slots;
+
+  unsigned long int m_ulNextSubmit;   /* next batch to submit */
+  unsigned long int m_ulCurrentBatch; /* batch currently being handed out */
+  unsigned long int m_ulNextProfile;  /* next profile within the current batch */
+  bool m_bCurrentReady;
+
+  bool m_bUring;
+  void* m_pRing;
+  unsigned long int m_ulBytesRead;
+  BrukerSignalStatistics* m_pStatistics;
+  BrukerMemoryScope m_BufferMemory;
+
+  /* Without io_uring, batches m_ulNextRead to m_ulRequested-1 are read by m_ReadThread */
+  std::thread m_ReadThread;
+  std::mutex m_ReadMutex;
+  std::condition_variable m_ReadWake;
+  std::condition_variable m_ReadDone;
+  unsigned long int m_ulRequested;
+  unsigned long int m_ulNextRead;
+  bool m_bStopReads;
+};
+
+#endif //BRUKER_ASYNCFIDREADER_HPP
@@ -0,0 +1,388 @@
+#include "brukerfidexporter.hpp"
+#include "ndarraykernels.hpp"
+#include "parallel.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <climits>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Fewest profiles a thread is given at a time */
+#define MIN_PROFILES_PER_THREAD 16
+
+static void WriteParameter(std::ostream& s, std::string name, std::string value)
+{
+  s << "##$" << name << "=" << value << std::endl;
+}
+
+template <class T> static void WriteParameter(std::ostream& s, std::string name, T value)
+{
+  std::stringstream v;
+  v << value;
+  WriteParameter(s, name, v.str());
+}
+
+/* Arrays are written as ##$NAME=( n ) followed by the values, wrapped like ParaVision does */
+template <class T> static void WriteArrayParameter(std::ostream& s, std::string name, const std::vector<T>& values,
+						   std::vector<int> dimensions = std::vector<int>())
+{
+  if (dimensions.empty()) dimensions.push_back(values.size());
+  s << "##$" << name << "=( ";
+  for (size_t i = 0; i < dimensions.size(); i++) {
+    s << (i ? ", " : "") << dimensions[i];
+  }
+  s << " )" << std::endl;
+
+  std::stringstream line;
+  for (size_t i = 0; i < values.size(); i++) {
+    std::stringstream v;
+    v << values[i];
+    if (line.str().size() + v.str().size() + 1 > 72) {
+      s << line.str() << std::endl;
+      line.str("");
+    }
+    line << (line.str().empty() ? "" : " ") << v.str();
+  }
+  s << line.str() << std::endl;
+}
+
+static void WriteHeader(std::ostream& s, std::string title)
+{
+  s << "##TITLE=" << title << std::endl;
+  s << "##JCAMPDX=4.24" << std::endl;
+  s << "##DATATYPE=Parameter Values" << std::endl;
+  s << "##ORIGIN=bruker_to_ismrmrd" << std::endl;
+}
+
+bool BrukerFidExporter::MakeDirectories(std::string directory)
+{
+  for (size_t pos = directory.find('/', 1); ; pos = directory.find('/', pos+1)) {
+    std::string d = directory.substr(0, pos);
+    if (!d.empty() && mkdir(d.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    if (pos == std::string::npos) return true;
+  }
+}
+
+static std::vector<int> EncodingSteps(int n)
+{
+  std::vector<int> steps(n);
+  for (int i = 0; i < n; i++) steps[i] = i - n/2;
+  return steps;
+}
+
+BrukerFidExporter::BrukerFidExporter(BrukerRawDataProfile::BrukerDataFormat format, unsigned long int block_size)
+  : m_Format(format),
+    m_ulBlockSize(block_size ? block_size : 4096),
+    m_uiChannels(1),
+    m_uiEchoes(1),
+    m_uiPhaseFactor(1),
+    m_bKBlock(false),
+    m_iFile(-1),
+    m_uiProfileLength(0),
+    m_fScale(0.0f),
+    m_ulBytesWritten(0)
+{
+
+}
+
+BrukerFidExporter::~BrukerFidExporter()
+{
+  CloseFid();
+}
+
+unsigned long int BrukerFidExporter::GetProfileStride()
+{
+  unsigned long int word = (m_Format == BrukerRawDataProfile::GO_16BIT_SGN_INT) ? sizeof(short) : 4;
+  unsigned long int stride = static_cast<unsigned long int>(m_uiProfileLength)*2*word;
+  if (m_bKBlock && (stride % 1024)) {
+    stride = ((stride / 1024)+1)*1024;
+  }
+  return stride;
+}
+
+float BrukerFidExporter::FindMaxValue(const std::vector<const std::complex<float>*>& profiles, unsigned int profile_length)
+{
+  float max_val = 0.0f;
+  std::mutex max_mutex;
+  mr_recon::parallel_for(0, profiles.size(), [&](long first, long last) {
+      float local_max = 0.0f;
+      for (long i = first; i < last; i++) {
+	float m = mr_recon::max_abs(reinterpret_cast<const float*>(profiles[i]), 2*profile_length);
+	if (m > local_max) local_max = m;
+      }
+      std::lock_guard<std::mutex> lock(max_mutex);
+      if (local_max > max_val) max_val = local_max;
+    }, MIN_PROFILES_PER_THREAD);
+  return max_val;
+}
+
+bool BrukerFidExporter::OpenFid(std::string filename, unsigned int profile_length, float max_value)
+{
+  CloseFid();
+
+  if (m_Format == BrukerRawDataProfile::GO_FORMAT_NONE || m_Format >= BrukerRawDataProfile::GO_DATA_FORMAT_MAX) {
+    std::cerr << "BrukerFidExporter: Data Format not set, unable to write" << std::endl;
+    return false;
+  }
+
+  m_iFile = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (m_iFile < 0) {
+    std::cerr << "BrukerFidExporter: unable to open " << filename << std::endl;
+    return false;
+  }
+
+  /* Same headroom as BrukerRawDataProfile::WriteData */
+  m_uiProfileLength = profile_length;
+  switch (m_Format) {
+  case BrukerRawDataProfile::GO_16BIT_SGN_INT:
+    m_fScale = (max_value != 0.0f) ? SHRT_MAX / (max_value * 1.1) : 0.0f;
+    break;
+  case BrukerRawDataProfile::GO_32BIT_SGN_INT:
+    m_fScale = (max_value != 0.0f) ? INT_MAX / (max_value * 1.1) : 0.0f;
+    break;
+  default:
+    m_fScale = 1.0f;
+  }
+  m_ulBytesWritten = 0;
+  return true;
+}
+
+bool BrukerFidExporter::WriteProfiles(const std::vector<const std::complex<float>*>& profiles)
+{
+  if (m_iFile < 0) {
+    std::cerr << "BrukerFidExporter: No fid file open" << std::endl;
+    return false;
+  }
+
+  unsigned long int stride = GetProfileStride();
+  unsigned long int per_block = m_ulBlockSize / stride;
+  if (per_block == 0) per_block = 1;
+
+  for (unsigned long int b = 0; b < profiles.size(); b += per_block) {
+    unsigned long int count = std::min(per_block, profiles.size() - b);
+    /* The KBlock padding stays zero, only the data part of each profile is overwritten */
+    if (m_Buffer.size() != count*stride) m_Buffer.assign(count*stride, 0);
+
+    char* buffer = &m_Buffer[0];
+    unsigned int values = 2*m_uiProfileLength;
+    BrukerRawDataProfile::BrukerDataFormat format = m_Format;
+    float scale = m_fScale;
+    mr_recon::parallel_for(0, count, [&](long first, long last) {
+	for (long i = first; i < last; i++) {
+	  const float* in = reinterpret_cast<const float*>(profiles[b+i]);
+	  char* out = buffer + i*stride;
+	  if (format == BrukerRawDataProfile::GO_16BIT_SGN_INT) {
+	    mr_recon::quantize(in, scale, reinterpret_cast<short*>(out), values);
+	  } else if (format == BrukerRawDataProfile::GO_32BIT_SGN_INT) {
+	    mr_recon::quantize(in, scale, reinterpret_cast<int*>(out), values);
+	  } else {
+	    memcpy(out, in, values*sizeof(float));
+	  }
+	}
+      }, MIN_PROFILES_PER_THREAD);
+
+    unsigned long int done = 0;
+    while (done < m_Buffer.size()) {
+      ssize_t w = write(m_iFile, buffer + done, m_Buffer.size() - done);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) {
+	std::cerr << "BrukerFidExporter: Unable to write sufficient bytes to fid" << std::endl;
+	return false;
+      }
+      done += w;
+    }
+    m_ulBytesWritten += done;
+  }
+  return true;
+}
+
+bool BrukerFidExporter::CloseFid()
+{
+  if (m_iFile < 0) return true;
+  bool ok = (close(m_iFile) == 0);
+  m_iFile = -1;
+  m_Buffer.clear();
+  if (!ok) {
+    std::cerr << "BrukerFidExporter: Error closing fid" << std::endl;
+  }
+  return ok;
+}
+
+bool BrukerFidExporter::WriteParameterFiles(std::string directory, const std::vector<int>& dimensions)
+{
+  if (dimensions.size() < 5 || dimensions[0] % m_uiChannels || dimensions[3] % m_uiEchoes || dimensions[1] % m_uiPhaseFactor) {
+    std::cerr << "BrukerFidExporter: Invalid k-space dimensions for parameter files" << std::endl;
+    return false;
+  }
+
+  int samples = dimensions[0] / m_uiChannels;
+  int ny = dimensions[1];
+  int nz = dimensions[2];
+  int objects = dimensions[3];
+  int repetitions = dimensions[4];
+  int acq_dim = (nz > 1) ? 3 : 2;
+
+  std::vector<int> acq_size;
+  acq_size.push_back(2*samples);
+  acq_size.push_back(ny);
+  if (acq_dim > 2) acq_size.push_back(nz);
+
+  std::vector<int> matrix(acq_size);
+  matrix[0] = samples;
+
+  std::vector<int> obj_order(objects);
+  for (int i = 0; i < objects; i++) obj_order[i] = i;
+
+  std::vector<float> zeros(objects, 0.0f);
+  std::vector<float> grad_matrix;
+  for (int i = 0; i < objects; i++) {
+    for (int j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) grad_matrix.push_back(j == k ? 1.0f : 0.0f);
+    }
+  }
+  std::vector<int> grad_dims;
+  grad_dims.push_back(objects); grad_dims.push_back(3); grad_dims.push_back(3);
+
+  std::string format;
+  switch (m_Format) {
+  case BrukerRawDataProfile::GO_16BIT_SGN_INT: format = "GO_16BIT_SGN_INT"; break;
+  case BrukerRawDataProfile::GO_32BIT_SGN_INT: format = "GO_32BIT_SGN_INT"; break;
+  default: format = "GO_32BIT_FLOAT";
+  }
+
+  std::ofstream acqp((directory + "/acqp").c_str());
+  WriteHeader(acqp, "Parameter List, ParaVision");
+  WriteParameter(acqp, "ACQ_dim", acq_dim);
+  WriteArrayParameter(acqp, "ACQ_size", acq_size);
+  WriteParameter(acqp, "NI", objects);
+  WriteArrayParameter(acqp, "ACQ_obj_order", obj_order);
+  WriteParameter(acqp, "NSLICES", objects / m_uiEchoes);
+  WriteParameter(acqp, "ACQ_n_echo_images", m_uiEchoes);
+  WriteParameter(acqp, "ACQ_phase_factor", m_uiPhaseFactor);
+  WriteParameter(acqp, "ACQ_rare_factor", m_uiPhaseFactor);
+  WriteParameter(acqp, "NR", repetitions);
+  /* The spatial phases only need the right size, the encoding steps come from the method */
+  WriteParameter(acqp, "ACQ_spatial_size_1", ny);
+  WriteArrayParameter(acqp, "ACQ_spatial_phase_1", std::vector<float>(ny, 0.0f));
+  if (acq_dim > 2) {
+    WriteParameter(acqp, "ACQ_spatial_size_2", nz);
+    WriteArrayParameter(acqp, "ACQ_spatial_phase_2", std::vector<float>(nz, 0.0f));
+  }
+  WriteParameter(acqp, "GO_block_size", m_bKBlock ? "Standard_KBlock_Format" : "continuous");
+  WriteParameter(acqp, "GO_raw_data_format", format);
+  WriteParameter(acqp, "SW", "0.1");
+  WriteParameter(acqp, "ACQ_slice_thick", "1.0");
+  WriteArrayParameter(acqp, "ACQ_read_offset", zeros);
+  WriteArrayParameter(acqp, "ACQ_phase1_offset", zeros);
+  WriteArrayParameter(acqp, "ACQ_phase2_offset", zeros);
+  WriteArrayParameter(acqp, "ACQ_slice_offset", zeros);
+  WriteArrayParameter(acqp, "ACQ_grad_matrix", grad_matrix, grad_dims);
+  acqp << "##END=" << std::endl;
+
+  std::ofstream method((directory + "/method").c_str());
+  WriteHeader(method, "Parameter List, ParaVision");
+  WriteParameter(method, "PVM_EncNReceivers", m_uiChannels);
+  WriteArrayParameter(method, "PVM_Matrix", matrix);
+  WriteArrayParameter(method, "PVM_EncMatrix", matrix);
+  WriteArrayParameter(method, "PVM_AntiAlias", std::vector<float>(acq_dim, 1.0f));
+  WriteArrayParameter(method, "PVM_Fov", std::vector<float>(acq_dim, 100.0f));
+  WriteArrayParameter(method, "PVM_EncSteps1", EncodingSteps(ny));
+  if (acq_dim > 2) {
+    WriteArrayParameter(method, "PVM_EncSteps2", EncodingSteps(nz));
+  }
+  method << "##END=" << std::endl;
+
+  if (!acqp || !method) {
+    std::cerr << "BrukerFidExporter: Unable to write parameter files in " << directory << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool BrukerFidExporter::WriteSubjectFile(std::string filename)
+{
+  std::ofstream subject(filename.c_str());
+  WriteHeader(subject, "Parameter List, ParaVision");
+  WriteArrayParameter(subject, "SUBJECT_name_string", std::vector<std::string>(1, "<Synthetic>"), std::vector<int>(1, 64));
+  WriteArrayParameter(subject, "SUBJECT_study_name", std::vector<std::string>(1, "<Synthetic>"), std::vector<int>(1, 64));
+  WriteArrayParameter(subject, "SUBJECT_study_instance_uid", std::vector<std::string>(1, "<0.0.0>"), std::vector<int>(1, 64));
+  WriteParameter(subject, "SUBJECT_entry", "SUBJ_ENTRY_HeadFirst");
+  WriteParameter(subject, "SUBJECT_position", "SUBJ_POS_Supine");
+  WriteArrayParameter(subject, "SUBJECT_date", std::vector<std::string>(1, "<00:00:00  1 Jan 2000>"), std::vector<int>(1, 64));
+  subject << "##END=" << std::endl;
+
+  if (!subject) {
+    std::cerr << "BrukerFidExporter: Unable to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool BrukerFidExporter::GetProfileOrder(const mr_recon::ComplexFloatArrayView& kspace,
+					std::vector<const std::complex<float>*>& profiles)
+{
+  std::vector<int> dims(5);
+  for (int i = 0; i < 5; i++) dims[i] = kspace.get_size(i);
+
+  if (kspace.get_number_of_dimensions() > 5 || kspace.get_number_of_elements() == 0 || kspace.get_stride(0) != 1) {
+    std::cerr << "BrukerFidExporter: k-space must be [kx, ky, kz, objects, repetitions] with contiguous kx" << std::endl;
+    return false;
+  }
+  if (dims[0] % m_uiChannels || dims[3] % m_uiEchoes || dims[1] % m_uiPhaseFactor) {
+    std::cerr << "BrukerFidExporter: k-space " << dims[0] << " x " << dims[1] << " x " << dims[3]
+	      << " does not divide into " << m_uiChannels << " channels, phase factor " << m_uiPhaseFactor
+	      << " and " << m_uiEchoes << " echoes" << std::endl;
+    return false;
+  }
+
+  /* Profile order of BrukerProfileListGenerator::GetProfileList:
+     repetitions, kz, ky / phase factor, slices, phase factor, echoes */
+  int slices = dims[3] / m_uiEchoes;
+  int pf = m_uiPhaseFactor;
+  int echoes = m_uiEchoes;
+  profiles.reserve(profiles.size() + static_cast<unsigned long int>(dims[1])*dims[2]*dims[3]*dims[4]);
+  for (int r = 0; r < dims[4]; r++) {
+    for (int kz = 0; kz < dims[2]; kz++) {
+      for (int e1 = 0; e1 < dims[1] / pf; e1++) {
+	for (int ns = 0; ns < slices; ns++) {
+	  for (int ph = 0; ph < pf; ph++) {
+	    for (int ne = 0; ne < echoes; ne++) {
+	      profiles.push_back(&kspace(0, e1*pf + ph, kz, ns*echoes + ne, r));
+	    }
+	  }
+	}
+      }
+    }
+  }
+  return true;
+}
+
+bool BrukerFidExporter::Export(std::string directory, const mr_recon::ComplexFloatArrayView& kspace)
+{
+  std::vector<const std::complex<float>*> profiles;
+  if (!GetProfileOrder(kspace, profiles)) return false;
+
+  if (!MakeDirectories(directory)) {
+    std::cerr << "BrukerFidExporter: Unable to create " << directory << std::endl;
+    return false;
+  }
+
+  std::vector<int> dims(5);
+  for (int i = 0; i < 5; i++) dims[i] = kspace.get_size(i);
+
+  float max_val = FindMaxValue(profiles, dims[0]);
+  if (!OpenFid(directory + "/fid", dims[0], max_val)) return false;
+  if (!WriteProfiles(profiles)) {
+    CloseFid();
+    return false;
+  }
+  if (!CloseFid()) return false;
+
+  return WriteParameterFiles(directory, dims);
+}
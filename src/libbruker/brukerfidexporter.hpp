@@ -0,0 +1,86 @@
+/*****************************************************
+ *
+ *  Bulk exporter of k-space to a Bruker fid
+ *
+ *  Writes a k-space array [kx, ky, kz, objects,
+ *  repetitions] as a fid together with a minimal
+ *  acqp and method, in the profile order that
+ *  BrukerProfileListGenerator expects, so that the
+ *  result converts back with bruker_to_ismrmrd.
+ *
+ *  The maximum for the integer scaling is found in
+ *  one parallel pass. Profiles are quantized in
+ *  parallel into large blocks, which are written
+ *  sequentially without seeking.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_FIDEXPORTER_HPP
+#define BRUKER_FIDEXPORTER_HPP
+
+#include "brukerrawdata.hpp"
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+#include <complex>
+
+class BrukerFidExporter
+{
+
+public:
+  BrukerFidExporter(BrukerRawDataProfile::BrukerDataFormat format = BrukerRawDataProfile::GO_32BIT_SGN_INT,
+		    unsigned long int block_size = 4UL*1024*1024);
+  ~BrukerFidExporter();
+
+  /* Channels are stored one after the other in dimension 0, [samples, channels] */
+  void SetNumberOfChannels(unsigned int channels) { m_uiChannels = channels ? channels : 1; }
+  /* Pads every profile to a multiple of 1024 bytes as ParaVision does by default */
+  void SetKBlockFormat(bool kblock) { m_bKBlock = kblock; }
+  /* The objects are slices times echo images, object = slice*echoes + echo */
+  void SetNumberOfEchoes(unsigned int echoes) { m_uiEchoes = echoes ? echoes : 1; }
+  /* Consecutive ky lines acquired per slice, ACQ_phase_factor */
+  void SetPhaseFactor(unsigned int phase_factor) { m_uiPhaseFactor = phase_factor ? phase_factor : 1; }
+
+  /* Writes directory/fid, directory/acqp and directory/method, missing directories are created */
+  bool Export(std::string directory, const mr_recon::ComplexFloatArrayView& kspace);
+
+  /* Creates the directory and any missing parents, like mkdir -p */
+  static bool MakeDirectories(std::string directory);
+
+  /* Writes a subject file with placeholder values, the converter reads it from the study directory */
+  static bool WriteSubjectFile(std::string filename);
+
+  /* Largest absolute real or imaginary value of the profiles */
+  static float FindMaxValue(const std::vector<const std::complex<float>*>& profiles, unsigned int profile_length);
+
+  /* Streaming interface, profiles of profile_length complex values are appended in the order given */
+  bool OpenFid(std::string filename, unsigned int profile_length, float max_value);
+  bool WriteProfiles(const std::vector<const std::complex<float>*>& profiles);
+  bool CloseFid();
+
+  bool WriteParameterFiles(std::string directory, const std::vector<int>& dimensions);
+
+  /* Appends the profiles of kspace [kx, ky, kz, objects, repetitions] in fid order */
+  bool GetProfileOrder(const mr_recon::ComplexFloatArrayView& kspace, std::vector<const std::complex<float>*>& profiles);
+
+  unsigned long int GetBytesWritten() { return m_ulBytesWritten; }
+  /* Bytes between consecutive profiles in the fid */
+  unsigned long int GetProfileStride();
+
+protected:
+  BrukerRawDataProfile::BrukerDataFormat m_Format;
+  unsigned long int m_ulBlockSize;
+  unsigned int m_uiChannels;
+  unsigned int m_uiEchoes;
+  unsigned int m_uiPhaseFactor;
+  bool m_bKBlock;
+
+  int m_iFile;
+  unsigned int m_uiProfileLength;
+  float m_fScale;
+  std::vector<char> m_Buffer;
+  unsigned long int m_ulBytesWritten;
+};
+
+#endif //BRUKER_FIDEXPORTER_HPP
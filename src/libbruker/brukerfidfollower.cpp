@@ -0,0 +1,75 @@
+#include "brukerfidfollower.hpp"
+
+#include <iostream>
+#include <sys/stat.h>
+#include <time.h>
+
+BrukerFidFollower::BrukerFidFollower(std::string filename, double timeout_seconds)
+  : m_FileName(filename),
+    m_dTimeout(timeout_seconds),
+    m_ulFileSize(0)
+{
+
+}
+
+BrukerFidFollower::~BrukerFidFollower()
+{
+
+}
+
+unsigned long int BrukerFidFollower::PollFileSize()
+{
+  struct stat st;
+  if (stat(m_FileName.c_str(), &st) == 0) {
+    m_ulFileSize = static_cast<unsigned long int>(st.st_size);
+  }
+  return m_ulFileSize;
+}
+
+unsigned long int BrukerFidFollower::GetCurrentFileSize()
+{
+  return PollFileSize();
+}
+
+bool BrukerFidFollower::WaitForBytes(unsigned long int end_position)
+{
+  /* Fast path, the bytes were already there last time we looked */
+  if (m_ulFileSize >= end_position) {
+    return true;
+  }
+
+  unsigned long int last_size = m_ulFileSize;
+  double last_growth = BrukerMonotonicSeconds();
+
+  /* Poll with a short interval that backs off while the file is idle */
+  long sleep_ns = 100000; /* 0.1 ms */
+  const long max_sleep_ns = 20000000; /* 20 ms */
+
+  while (PollFileSize() < end_position) {
+    double now = BrukerMonotonicSeconds();
+    if (m_ulFileSize != last_size) {
+      last_size = m_ulFileSize;
+      last_growth = now;
+      sleep_ns = 100000;
+    } else if (now - last_growth > m_dTimeout) {
+      std::cerr << "BrukerFidFollower: " << m_FileName << " stopped growing at " << m_ulFileSize
+		<< " bytes, waiting for " << end_position << " bytes" << std::endl;
+      return false;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = sleep_ns;
+    nanosleep(&ts, 0);
+    if (sleep_ns < max_sleep_ns) sleep_ns *= 2;
+  }
+
+  return true;
+}
+
+double BrukerMonotonicSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + 1.0e-9*static_cast<double>(ts.tv_nsec);
+}
@@ -0,0 +1,45 @@
+/*****************************************************
+ *
+ *  Class for following a Bruker fid file that is
+ *  still being written by the acquisition
+ *
+ *  The follower polls the size of the file and
+ *  blocks until a requested byte range is on disk
+ *  or until the file has stopped growing for
+ *  longer than a timeout.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_FIDFOLLOWER_HPP
+#define BRUKER_FIDFOLLOWER_HPP
+
+#include <string>
+
+class BrukerFidFollower
+{
+
+public:
+  BrukerFidFollower(std::string filename, double timeout_seconds = 30.0);
+  ~BrukerFidFollower();
+
+  /* Blocks until at least end_position bytes are in the file.
+     Returns false if the file did not grow for timeout seconds. */
+  bool WaitForBytes(unsigned long int end_position);
+
+  unsigned long int GetCurrentFileSize();
+
+  void SetTimeout(double timeout_seconds) { m_dTimeout = timeout_seconds; }
+  double GetTimeout() { return m_dTimeout; }
+
+protected:
+  unsigned long int PollFileSize();
+
+  std::string m_FileName;
+  double m_dTimeout;
+  unsigned long int m_ulFileSize;
+};
+
+/* Monotonic wall clock in seconds, used for per-profile latency measurements */
+double BrukerMonotonicSeconds();
+
+#endif //BRUKER_FIDFOLLOWER_HPP
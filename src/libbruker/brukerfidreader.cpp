@@ -0,0 +1,178 @@
+#include "brukerfidreader.hpp"
+#include "brukertrace.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Largest gap of unused bytes that is read through rather than starting a new read */
+#define MAX_READ_GAP 65536
+
+BrukerFidReader::BrukerFidReader(unsigned long int block_size)
+  : m_pGenerator(0),
+    m_iFile(-1),
+    m_ulBlockSize(block_size ? block_size : 4096),
+    m_uiSamples(0),
+    m_uiChannels(0),
+    m_ulChannelBytes(0),
+    m_bInterleaved(false)
+{
+
+}
+
+BrukerFidReader::~BrukerFidReader()
+{
+  Close();
+}
+
+bool BrukerFidReader::Open(std::string filename, BrukerProfileListGenerator& gen)
+{
+  Close();
+
+  if (gen.GetNumberOfSamples() <= 0 || gen.GetNumberOfChannels() <= 0 || gen.GetProfileDataLength() == 0) {
+    std::cerr << "BrukerFidReader: The profile layout has not been set up" << std::endl;
+    return false;
+  }
+
+  m_iFile = open(filename.c_str(), O_RDONLY);
+  if (m_iFile < 0) {
+    std::cerr << "BrukerFidReader: unable to open " << filename << std::endl;
+    return false;
+  }
+
+  m_pGenerator = &gen;
+  m_uiSamples = static_cast<unsigned int>(gen.GetNumberOfSamples());
+  m_uiChannels = static_cast<unsigned int>(gen.GetNumberOfChannels());
+
+  m_bInterleaved = (gen.GetChannelLayout() == BrukerRawDataProfile::CHANNELS_INTERLEAVED && m_uiChannels > 1);
+
+  m_ProfileDecoder.SetDataFormat(gen.GetDataFormat());
+  m_ProfileDecoder.SetProfileLength(m_uiSamples*m_uiChannels);
+  m_ProfileDecoder.SetNumberOfChannels(m_uiChannels);
+  m_ProfileDecoder.SetChannelLayout(gen.GetChannelLayout());
+  m_ChannelDecoder.SetDataFormat(gen.GetDataFormat());
+  m_ChannelDecoder.SetProfileLength(m_uiSamples);
+  m_ulChannelBytes = m_ChannelDecoder.GetReadSize();
+  if (m_ulChannelBytes == 0) {
+    std::cerr << "BrukerFidReader: Unknown data format" << std::endl;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void BrukerFidReader::Close()
+{
+  if (m_iFile >= 0) {
+    close(m_iFile);
+    m_iFile = -1;
+  }
+  m_pGenerator = 0;
+}
+
+bool BrukerFidReader::GetOffset(int ky, int kz, int slice, int echo, int repetition, unsigned long int& offset, int channel)
+{
+  if (!m_pGenerator || channel >= static_cast<int>(m_uiChannels)) return false;
+  if (!m_pGenerator->GetProfilePosition(ky, kz, slice, echo, repetition, offset)) return false;
+  /* The channels of a profile follow each other, unless they are interleaved */
+  if (channel > 0 && !m_bInterleaved) offset += channel*m_ulChannelBytes;
+  return true;
+}
+
+unsigned long int BrukerFidReader::GetReadSize(int channel)
+{
+  return (channel < 0 || m_bInterleaved) ? m_ProfileDecoder.GetReadSize() : m_ulChannelBytes;
+}
+
+void BrukerFidReader::Decode(const char* data, int channel, float* destination)
+{
+  if (channel < 0) {
+    m_ProfileDecoder.DecodeData(data, destination);
+  } else if (!m_bInterleaved) {
+    m_ChannelDecoder.DecodeData(data, destination);
+  } else {
+    /* A channel of interleaved samples is taken from the decoded profile */
+    static thread_local std::vector<float> profile;
+    if (profile.size() < 2UL*m_uiSamples*m_uiChannels) profile.resize(2UL*m_uiSamples*m_uiChannels);
+    m_ProfileDecoder.DecodeData(data, &profile[0]);
+    memcpy(destination, &profile[2UL*m_uiSamples*channel], 2UL*m_uiSamples*sizeof(float));
+  }
+}
+
+bool BrukerFidReader::ReadRaw(unsigned long int offset, unsigned long int size, char* buffer)
+{
+  if (m_iFile < 0) return false;
+  unsigned long int done = 0;
+  while (done < size) {
+    ssize_t r = pread(m_iFile, buffer + done, size - done, offset + done);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {
+      std::cerr << "BrukerFidReader: Unable to read " << size << " bytes at " << offset << std::endl;
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+bool BrukerFidReader::ReadProfile(int ky, int kz, int slice, int echo, int repetition, float* destination, int channel)
+{
+  unsigned long int offset = 0;
+  if (!destination || !GetOffset(ky, kz, slice, echo, repetition, offset, channel)) return false;
+
+  unsigned long int size = GetReadSize(channel);
+  static thread_local std::vector<char> buffer;
+  if (buffer.size() < size) buffer.resize(size);
+  if (!ReadRaw(offset, size, &buffer[0])) return false;
+  Decode(&buffer[0], channel, destination);
+  return true;
+}
+
+bool BrukerFidReader::ReadProfiles(const std::vector<Request>& requests)
+{
+  /* Offsets first, then the requests in file order so that neighbours share a read */
+  std::vector<std::pair<unsigned long int, size_t> > order(requests.size());
+  for (size_t i = 0; i < requests.size(); i++) {
+    const Request& r = requests[i];
+    if (!r.destination || !GetOffset(r.ky, r.kz, r.slice, r.echo, r.repetition, order[i].first, r.channel)) {
+      std::cerr << "BrukerFidReader: No profile ky " << r.ky << ", kz " << r.kz << ", slice " << r.slice
+		<< ", echo " << r.echo << ", repetition " << r.repetition << ", channel " << r.channel << std::endl;
+      return false;
+    }
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end());
+
+  /* One buffer per thread, grown to the largest read and reused */
+  static thread_local std::vector<char> buffer;
+
+  size_t i = 0;
+  while (i < order.size()) {
+    unsigned long int offset = order[i].first;
+    unsigned long int end = offset + GetReadSize(requests[order[i].second].channel);
+    size_t j = i + 1;
+    while (j < order.size()) {
+      unsigned long int p = order[j].first;
+      unsigned long int e = p + GetReadSize(requests[order[j].second].channel);
+      if (p > end + MAX_READ_GAP || std::max(end, e) - offset > m_ulBlockSize) break;
+      end = std::max(end, e);
+      j++;
+    }
+
+    if (buffer.size() < end - offset) buffer.resize(end - offset);
+    {
+      BrukerTraceScope trace("read_range", "io", end - offset);
+      if (!ReadRaw(offset, end - offset, &buffer[0])) return false;
+    }
+
+    for (size_t k = i; k < j; k++) {
+      const Request& r = requests[order[k].second];
+      Decode(&buffer[order[k].first - offset], r.channel, r.destination);
+    }
+    i = j;
+  }
+  return true;
+}
@@ -0,0 +1,82 @@
+/*****************************************************
+ *
+ *  Random access reader for Bruker fid files
+ *
+ *  Fetches single profiles, or single channels of
+ *  them, by encoding step, slice, echo, repetition
+ *  and channel without a profile list: the position
+ *  in the fid is computed in O(1) from the layout
+ *  worked out by BrukerProfileListGenerator.
+ *
+ *  All reads are preads on one file descriptor and
+ *  keep no state in the reader, so any number of
+ *  threads can read through the same instance.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_FIDREADER_HPP
+#define BRUKER_FIDREADER_HPP
+
+#include "brukerrawdata.hpp"
+
+#include <string>
+#include <vector>
+
+class BrukerFidReader
+{
+
+public:
+  /* One profile to read, channel -1 reads all channels */
+  struct Request {
+    int ky;              /* encoding steps as BrukerRawDataProfile::GetEncodeStep1/2, 0 is the center */
+    int kz;
+    int slice;           /* as BrukerRawDataProfile::GetSliceNo */
+    int echo;
+    int repetition;
+    int channel;
+    float* destination;  /* interleaved complex values, GetNumberOfSamples() per channel read */
+  };
+
+  BrukerFidReader(unsigned long int block_size = 4UL*1024*1024);
+  ~BrukerFidReader();
+
+  /* gen must have read the parameters with SetupLayout or GetProfileList and outlive the reader */
+  bool Open(std::string filename, BrukerProfileListGenerator& gen);
+  void Close();
+
+  unsigned int GetNumberOfSamples() { return m_uiSamples; }
+  unsigned int GetNumberOfChannels() { return m_uiChannels; }
+
+  /* File offset of a profile, or of one of its channels; false if there is no such profile.
+     With interleaved channels this is the offset of the whole profile. */
+  bool GetOffset(int ky, int kz, int slice, int echo, int repetition, unsigned long int& offset, int channel = -1);
+
+  /* Reads and decodes one profile [samples, channels], or one channel [samples], to destination */
+  bool ReadProfile(int ky, int kz, int slice, int echo, int repetition, float* destination, int channel = -1);
+
+  /* Reads a batch of profiles, requests that are close in the fid are read together.
+     Stops at the first request without a profile or failed read and returns false. */
+  bool ReadProfiles(const std::vector<Request>& requests);
+
+  /* Reads size raw bytes at offset */
+  bool ReadRaw(unsigned long int offset, unsigned long int size, char* buffer);
+
+protected:
+  /* Bytes to read for a profile or one channel */
+  unsigned long int GetReadSize(int channel);
+  void Decode(const char* data, int channel, float* destination);
+
+  BrukerProfileListGenerator* m_pGenerator;
+  int m_iFile;
+  unsigned long int m_ulBlockSize;
+  unsigned int m_uiSamples;
+  unsigned int m_uiChannels;
+  unsigned long int m_ulChannelBytes;  /* raw bytes of one channel in a profile */
+  bool m_bInterleaved;
+
+  /* Decoders for a whole profile and for one channel, they hold no data */
+  BrukerRawDataProfile m_ProfileDecoder;
+  BrukerRawDataProfile m_ChannelDecoder;
+};
+
+#endif //BRUKER_FIDREADER_HPP
@@ -0,0 +1,29 @@
+#include "brukerjson.hpp"
+
+std::string BrukerJSONString(const std::string& v)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  std::string out = "\"";
+  for (size_t i = 0; i < v.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(v[i]);
+    switch (c) {
+    case '"':  out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\b': out += "\\b"; break;
+    case '\f': out += "\\f"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      if (c < 0x20) {
+	out += "\\u00";
+	out += hex[c >> 4];
+	out += hex[c & 0xf];
+      } else {
+	out += v[i];
+      }
+    }
+  }
+  return out + "\"";
+}
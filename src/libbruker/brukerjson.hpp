@@ -0,0 +1,21 @@
+/*****************************************************
+ *
+ *  JSON helpers
+ *
+ *  Shared by the writers of the profile, trace and
+ *  other JSON reports, which contain host names, file
+ *  names and parameter values that may hold any
+ *  character.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_JSON_HPP
+#define BRUKER_JSON_HPP
+
+#include <string>
+
+/* v as a quoted JSON string. Quotes and backslashes are escaped, the common control characters
+   as \b \f \n \r \t and the other characters below 0x20 as \u00XX */
+std::string BrukerJSONString(const std::string& v);
+
+#endif //BRUKER_JSON_HPP
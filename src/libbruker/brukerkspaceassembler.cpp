@@ -0,0 +1,224 @@
+#include "brukerkspaceassembler.hpp"
+#include "parallel.hpp"
+#include "brukertrace.hpp"
+#include "brukermemory.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Largest gap of unused bytes (KBlock padding) that is read through rather than starting a new read */
+#define MAX_READ_GAP 65536
+
+/* Fewest profiles a thread is given at a time */
+#define MIN_PROFILES_PER_THREAD 16
+
+static bool CompareFilePosition(BrukerRawDataProfile* a, BrukerRawDataProfile* b)
+{
+  return a->GetFilePosition() < b->GetFilePosition();
+}
+
+BrukerKSpaceAssembler::BrukerKSpaceAssembler(unsigned long int block_size)
+  : m_iFile(-1),
+    m_ulBlockSize(block_size ? block_size : 4096),
+    m_iKyMin(0),
+    m_iKzMin(0),
+    m_ulBytesRead(0),
+    m_ulProfilesSkipped(0)
+{
+
+}
+
+BrukerKSpaceAssembler::~BrukerKSpaceAssembler()
+{
+  Close();
+}
+
+bool BrukerKSpaceAssembler::Open(std::string filename)
+{
+  Close();
+  m_iFile = open(filename.c_str(), O_RDONLY);
+  if (m_iFile < 0) {
+    std::cerr << "BrukerKSpaceAssembler: unable to open " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void BrukerKSpaceAssembler::Close()
+{
+  if (m_iFile >= 0) {
+    close(m_iFile);
+    m_iFile = -1;
+  }
+}
+
+std::vector<int> BrukerKSpaceAssembler::GetDimensions(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first)
+{
+  std::vector<int> dims(5);
+  dims[0] = first ? first->GetProfileLength() : 0;
+  dims[1] = gen.GetMaxEncodingStep1() - gen.GetMinEncodingStep1() + 1;
+  dims[2] = gen.GetMaxEncodingStep2() - gen.GetMinEncodingStep2() + 1;
+  dims[3] = std::max(gen.GetNumberOfObjects(), 1);
+  dims[4] = std::max(gen.GetNumberOfRepetitions(), 1);
+  return dims;
+}
+
+std::vector<BrukerRawDataProfile*> BrukerKSpaceAssembler::SortedProfiles(BrukerRawDataProfile* first)
+{
+  std::vector<BrukerRawDataProfile*> profiles;
+  for (BrukerRawDataProfile* p = first; p; p = p->GetNext()) {
+    if (p->GetReadSize() > 0) profiles.push_back(p);
+  }
+  std::stable_sort(profiles.begin(), profiles.end(), CompareFilePosition);
+  return profiles;
+}
+
+bool BrukerKSpaceAssembler::Assemble(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, mr_recon::ComplexFloatArray& kspace)
+{
+  std::vector<int> dims = GetDimensions(gen, first);
+  if (*kspace.get_dimensions() != dims) {
+    kspace = mr_recon::ComplexFloatArray(&dims);
+  } else {
+    std::fill(kspace.get_data_ptr(), kspace.get_data_ptr() + kspace.get_number_of_elements(), mr_recon::ComplexFloat(0));
+  }
+  if (kspace.get_number_of_elements() == 0) {
+    std::cerr << "BrukerKSpaceAssembler: Unable to allocate k-space" << std::endl;
+    return false;
+  }
+
+  return Assemble(gen, first, mr_recon::ComplexFloatArrayView(kspace));
+}
+
+bool BrukerKSpaceAssembler::Assemble(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, const mr_recon::ComplexFloatArrayView& kspace)
+{
+  if (m_iFile < 0) {
+    std::cerr << "BrukerKSpaceAssembler: No fid file open" << std::endl;
+    return false;
+  }
+
+  std::vector<int> dims = GetDimensions(gen, first);
+  if (kspace.get_dimensions() != dims || kspace.get_stride(0) != 1) {
+    std::cerr << "BrukerKSpaceAssembler: k-space must be [" << dims[0] << ", " << dims[1] << ", "
+	      << dims[2] << ", " << dims[3] << ", " << dims[4] << "] with contiguous kx" << std::endl;
+    return false;
+  }
+
+  m_iKyMin = gen.GetMinEncodingStep1();
+  m_iKzMin = gen.GetMinEncodingStep2();
+  return ReadProfiles(SortedProfiles(first), kspace, -1);
+}
+
+bool BrukerKSpaceAssembler::AssembleRepetitions(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, RepetitionCallback callback, void* user)
+{
+  if (m_iFile < 0) {
+    std::cerr << "BrukerKSpaceAssembler: No fid file open" << std::endl;
+    return false;
+  }
+
+  std::vector<int> dims = GetDimensions(gen, first);
+  unsigned int repetitions = dims[4];
+  dims.pop_back();
+  mr_recon::ComplexFloatArray kspace(&dims);
+  if (kspace.get_number_of_elements() == 0) {
+    std::cerr << "BrukerKSpaceAssembler: Unable to allocate k-space" << std::endl;
+    return false;
+  }
+  BrukerMemoryScope kspace_memory(BrukerMemory::MEMORY_KSPACE, kspace.get_number_of_elements()*sizeof(mr_recon::ComplexFloat));
+
+  /* Repetitions are usually acquired one after the other, so each one is a contiguous part of the fid */
+  std::vector< std::vector<BrukerRawDataProfile*> > by_repetition(repetitions);
+  std::vector<BrukerRawDataProfile*> profiles = SortedProfiles(first);
+  for (size_t i = 0; i < profiles.size(); i++) {
+    if (profiles[i]->GetRepetitionNo() < repetitions) {
+      by_repetition[profiles[i]->GetRepetitionNo()].push_back(profiles[i]);
+    } else {
+      m_ulProfilesSkipped++;
+    }
+  }
+
+  m_iKyMin = gen.GetMinEncodingStep1();
+  m_iKzMin = gen.GetMinEncodingStep2();
+  for (unsigned int r = 0; r < repetitions; r++) {
+    std::fill(kspace.get_data_ptr(), kspace.get_data_ptr() + kspace.get_number_of_elements(), mr_recon::ComplexFloat(0));
+    if (!ReadProfiles(by_repetition[r], mr_recon::ComplexFloatArrayView(kspace), 0)) return false;
+    if (callback && !callback(r, kspace, user)) break;
+  }
+  return true;
+}
+
+bool BrukerKSpaceAssembler::ReadProfiles(const std::vector<BrukerRawDataProfile*>& profiles, const mr_recon::ComplexFloatArrayView& kspace, int repetition)
+{
+  std::atomic<bool> ok(true);
+  mr_recon::parallel_for(0, profiles.size(), [&](long first, long last) {
+      if (!ReadRange(profiles, first, last, kspace, repetition)) ok = false;
+    }, MIN_PROFILES_PER_THREAD);
+  return ok;
+}
+
+bool BrukerKSpaceAssembler::ReadRange(const std::vector<BrukerRawDataProfile*>& profiles, long first, long last,
+				      const mr_recon::ComplexFloatArrayView& kspace, int repetition)
+{
+  std::vector<char> buffer;
+  BrukerMemoryScope buffer_memory(BrukerMemory::MEMORY_READ_BUFFERS);
+  unsigned long int bytes_read = 0;
+  unsigned long int skipped = 0;
+  bool ok = true;
+
+  long i = first;
+  while (i < last && ok) {
+    /* Extend the read over following profiles while they are close and fit the block */
+    unsigned long int offset = profiles[i]->GetFilePosition();
+    unsigned long int end = offset + profiles[i]->GetReadSize();
+    long j = i + 1;
+    while (j < last) {
+      unsigned long int p = profiles[j]->GetFilePosition();
+      unsigned long int e = p + profiles[j]->GetReadSize();
+      if (p > end + MAX_READ_GAP || std::max(end, e) - offset > m_ulBlockSize) break;
+      end = std::max(end, e);
+      j++;
+    }
+
+    buffer.resize(end - offset);
+    buffer_memory.Set(buffer.capacity());
+    unsigned long int done = 0;
+    {
+      BrukerTraceScope trace("read_range", "io", buffer.size());
+      while (done < buffer.size()) {
+	ssize_t r = pread(m_iFile, &buffer[done], buffer.size() - done, offset + done);
+	if (r < 0 && errno == EINTR) continue;
+	if (r <= 0) {
+	  std::cerr << "BrukerKSpaceAssembler: Unable to read " << buffer.size() << " bytes at " << offset << std::endl;
+	  ok = false;
+	  break;
+	}
+	done += r;
+      }
+    }
+    bytes_read += done;
+
+    BrukerTraceScope trace("decode_batch", "decode", done);
+    for (long k = i; k < j && ok; k++) {
+      BrukerRawDataProfile* p = profiles[k];
+      int ky = p->GetEncodeStep1() - m_iKyMin;
+      int kz = p->GetEncodeStep2() - m_iKzMin;
+      int object = p->GetObjectNo();
+      int rep = (repetition >= 0) ? repetition : static_cast<int>(p->GetRepetitionNo());
+      if (static_cast<int>(p->GetProfileLength()) != kspace.get_size(0) ||
+	  ky < 0 || ky >= kspace.get_size(1) || kz < 0 || kz >= kspace.get_size(2) ||
+	  object >= kspace.get_size(3) || rep >= kspace.get_size(4)) {
+	skipped++;
+	continue;
+      }
+      float* destination = reinterpret_cast<float*>(&kspace(0, ky, kz, object, rep));
+      p->DecodeData(&buffer[p->GetFilePosition() - offset], destination);
+    }
+    i = j;
+  }
+
+  m_ulBytesRead += bytes_read;
+  if (skipped) m_ulProfilesSkipped += skipped;
+  return ok;
+}
@@ -0,0 +1,78 @@
+/*****************************************************
+ *
+ *  K-space assembler for Bruker fid files
+ *
+ *  Reads the profiles of a profile list and decodes
+ *  each one straight into its place in a k-space
+ *  array [kx, ky, kz, objects, repetitions], using
+ *  the encoding steps and object and repetition
+ *  numbers of the profiles. Contiguous profiles are
+ *  read together and ranges of profiles are handled
+ *  by several threads, each with its own preads.
+ *
+ *  Dimension 0 is the profile length, which covers
+ *  all channels: samples*channels, with the samples
+ *  of each channel contiguous.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_KSPACEASSEMBLER_HPP
+#define BRUKER_KSPACEASSEMBLER_HPP
+
+#include "brukerrawdata.hpp"
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+class BrukerKSpaceAssembler
+{
+
+public:
+  /* Called with the k-space [kx, ky, kz, objects] of each repetition, return false to stop */
+  typedef bool (*RepetitionCallback)(unsigned int repetition, mr_recon::ComplexFloatArray& kspace, void* user);
+
+  BrukerKSpaceAssembler(unsigned long int block_size = 4UL*1024*1024);
+  ~BrukerKSpaceAssembler();
+
+  bool Open(std::string filename);
+  void Close();
+
+  /* Dimensions [kx, ky, kz, objects, repetitions] of the k-space of a profile list */
+  std::vector<int> GetDimensions(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first);
+
+  /* Fills kspace with all profiles of the list, kspace is (re)allocated if its dimensions do not match.
+     Profiles that were not acquired are zero. */
+  bool Assemble(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, mr_recon::ComplexFloatArray& kspace);
+
+  /* As above into existing memory, which must have the dimensions from GetDimensions and a contiguous kx.
+     Elements without a profile are left as they are. */
+  bool Assemble(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, const mr_recon::ComplexFloatArrayView& kspace);
+
+  /* Assembles one repetition at a time into a single [kx, ky, kz, objects] array and hands it to the callback */
+  bool AssembleRepetitions(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, RepetitionCallback callback, void* user = 0);
+
+  unsigned long int GetBytesRead() { return m_ulBytesRead; }
+  unsigned long int GetProfilesSkipped() { return m_ulProfilesSkipped; }
+
+protected:
+  /* Reads and decodes profiles (sorted by file position) into kspace, repetition is the
+     index used for the last dimension or -1 to take it from the profile */
+  bool ReadProfiles(const std::vector<BrukerRawDataProfile*>& profiles, const mr_recon::ComplexFloatArrayView& kspace, int repetition);
+
+  bool ReadRange(const std::vector<BrukerRawDataProfile*>& profiles, long first, long last,
+		 const mr_recon::ComplexFloatArrayView& kspace, int repetition);
+
+  /* Profiles of the list sorted by file position */
+  std::vector<BrukerRawDataProfile*> SortedProfiles(BrukerRawDataProfile* first);
+
+  int m_iFile;
+  unsigned long int m_ulBlockSize;
+  int m_iKyMin;
+  int m_iKzMin;
+  std::atomic<unsigned long int> m_ulBytesRead;
+  std::atomic<unsigned long int> m_ulProfilesSkipped;
+};
+
+#endif //BRUKER_KSPACEASSEMBLER_HPP
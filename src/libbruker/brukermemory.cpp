@@ -0,0 +1,167 @@
+#include "brukermemory.hpp"
+
+#include <iomanip>
+#include <sstream>
+#include <limits>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+std::atomic<unsigned long int> BrukerMemory::s_Current[BrukerMemory::MEMORY_CATEGORY_MAX];
+std::atomic<unsigned long int> BrukerMemory::s_Peak[BrukerMemory::MEMORY_CATEGORY_MAX];
+std::atomic<unsigned long int> BrukerMemory::s_CurrentTotal(0);
+std::atomic<unsigned long int> BrukerMemory::s_PeakTotal(0);
+
+static const char* s_CategoryNames[BrukerMemory::MEMORY_CATEGORY_MAX] = {
+  "profile list",
+  "profile data",
+  "read buffers",
+  "k-space",
+  "output buffers"
+};
+
+static void UpdatePeak(std::atomic<unsigned long int>& peak, unsigned long int value)
+{
+  unsigned long int p = peak.load(std::memory_order_relaxed);
+  while (value > p && !peak.compare_exchange_weak(p, value, std::memory_order_relaxed)) {
+  }
+}
+
+void BrukerMemory::Allocated(MemoryCategory c, unsigned long int bytes)
+{
+  if (c >= MEMORY_CATEGORY_MAX || bytes == 0) return;
+  UpdatePeak(s_Peak[c], s_Current[c].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  UpdatePeak(s_PeakTotal, s_CurrentTotal.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void BrukerMemory::Released(MemoryCategory c, unsigned long int bytes)
+{
+  if (c >= MEMORY_CATEGORY_MAX || bytes == 0) return;
+  s_Current[c].fetch_sub(bytes, std::memory_order_relaxed);
+  s_CurrentTotal.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+unsigned long int BrukerMemory::GetCurrent(MemoryCategory c)
+{
+  return (c < MEMORY_CATEGORY_MAX) ? s_Current[c].load() : 0;
+}
+
+unsigned long int BrukerMemory::GetPeak(MemoryCategory c)
+{
+  return (c < MEMORY_CATEGORY_MAX) ? s_Peak[c].load() : 0;
+}
+
+unsigned long int BrukerMemory::GetCurrentTotal()
+{
+  return s_CurrentTotal.load();
+}
+
+unsigned long int BrukerMemory::GetPeakTotal()
+{
+  return s_PeakTotal.load();
+}
+
+const char* BrukerMemory::GetCategoryName(MemoryCategory c)
+{
+  return (c < MEMORY_CATEGORY_MAX) ? s_CategoryNames[c] : "unknown";
+}
+
+unsigned long int BrukerMemory::GetPeakResidentBytes()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  /* Kilobytes on Linux */
+  return static_cast<unsigned long int>(usage.ru_maxrss)*1024UL;
+}
+
+void BrukerMemory::PrintReport(std::ostream& s)
+{
+  s << "Peak memory: " << FormatSize(GetPeakTotal()) << " tracked";
+  unsigned long int rss = GetPeakResidentBytes();
+  if (rss) s << ", " << FormatSize(rss) << " resident";
+  s << std::endl;
+  for (int c = 0; c < MEMORY_CATEGORY_MAX; c++) {
+    MemoryCategory m = static_cast<MemoryCategory>(c);
+    if (GetPeak(m) == 0) continue;
+    s << "  " << std::setw(16) << std::left << GetCategoryName(m) << std::right
+      << " peak " << std::setw(10) << FormatSize(GetPeak(m))
+      << " current " << std::setw(10) << FormatSize(GetCurrent(m)) << std::endl;
+  }
+}
+
+bool BrukerMemory::ParseSize(std::string text, unsigned long int& bytes)
+{
+  const char* begin = text.c_str();
+  char* end = 0;
+  double value = strtod(begin, &end);
+  if (end == begin || value < 0.0) return false;
+
+  std::string unit(end);
+  double scale = 1.0;
+  if (unit == "" || unit == "B") scale = 1.0;
+  else if (unit == "K" || unit == "k" || unit == "KB") scale = 1024.0;
+  else if (unit == "M" || unit == "MB") scale = 1024.0*1024.0;
+  else if (unit == "G" || unit == "GB") scale = 1024.0*1024.0*1024.0;
+  else if (unit == "T" || unit == "TB") scale = 1024.0*1024.0*1024.0*1024.0;
+  else return false;
+
+  bytes = static_cast<unsigned long int>(value*scale);
+  return true;
+}
+
+std::string BrukerMemory::FormatSize(unsigned long int bytes)
+{
+  static const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+  double v = static_cast<double>(bytes);
+  int u = 0;
+  while (v >= 1024.0 && u < 4) {
+    v /= 1024.0;
+    u++;
+  }
+  std::stringstream s;
+  s << std::fixed << std::setprecision(u ? 1 : 0) << v << " " << units[u];
+  return s.str();
+}
+
+BrukerMemoryBudget::BrukerMemoryBudget(unsigned long int limit)
+  : m_ulLimit(limit),
+    m_ulReserved(0)
+{
+}
+
+bool BrukerMemoryBudget::Reserve(std::string what, unsigned long int bytes)
+{
+  m_Plan.push_back(std::make_pair(what, bytes));
+  if (!IsLimited()) return true;
+  if (bytes > GetRemaining()) {
+    std::cerr << "BrukerMemoryBudget: " << what << " needs " << BrukerMemory::FormatSize(bytes)
+	      << ", only " << BrukerMemory::FormatSize(GetRemaining()) << " of "
+	      << BrukerMemory::FormatSize(m_ulLimit) << " left" << std::endl;
+    m_Plan.pop_back();
+    return false;
+  }
+  m_ulReserved += bytes;
+  return true;
+}
+
+unsigned long int BrukerMemoryBudget::GetRemaining()
+{
+  if (!IsLimited()) return std::numeric_limits<unsigned long int>::max();
+  return (m_ulReserved < m_ulLimit) ? m_ulLimit - m_ulReserved : 0;
+}
+
+unsigned long int BrukerMemoryBudget::Share(std::string what, double fraction)
+{
+  if (!IsLimited()) return std::numeric_limits<unsigned long int>::max();
+  unsigned long int bytes = static_cast<unsigned long int>(GetRemaining()*fraction);
+  Reserve(what, bytes);
+  return bytes;
+}
+
+void BrukerMemoryBudget::PrintPlan(std::ostream& s)
+{
+  s << "Memory budget " << BrukerMemory::FormatSize(m_ulLimit) << ":" << std::endl;
+  for (size_t i = 0; i < m_Plan.size(); i++) {
+    s << "  " << std::setw(24) << std::left << m_Plan[i].first << std::right
+      << std::setw(10) << BrukerMemory::FormatSize(m_Plan[i].second) << std::endl;
+  }
+}
@@ -0,0 +1,123 @@
+/*****************************************************
+ *
+ *  Memory accounting and budgets
+ *
+ *  BrukerMemory counts the bytes held by the larger
+ *  allocations of libbruker and the converter (the
+ *  profile list, profile data, read buffers, k-space
+ *  arrays and output buffers) per category, and
+ *  keeps the high water mark of each category and
+ *  of the total.
+ *
+ *  BrukerMemoryBudget splits a memory limit between
+ *  the parts of a pipeline: fixed needs are reserved
+ *  first, the buffers that can shrink (queues, batch
+ *  sizes, worker counts) are sized from what is left.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_MEMORY_HPP
+#define BRUKER_MEMORY_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+
+class BrukerMemory
+{
+
+public:
+  typedef enum {
+    MEMORY_PROFILE_LIST = 0,   /* the BrukerRawDataProfile objects */
+    MEMORY_PROFILE_DATA,       /* decoded samples held by profiles */
+    MEMORY_READ_BUFFERS,       /* fid read buffers */
+    MEMORY_KSPACE,             /* assembled k-space and preview arrays */
+    MEMORY_OUTPUT_BUFFERS,     /* acquisitions and chunks waiting to be written */
+    MEMORY_CATEGORY_MAX
+  } MemoryCategory;
+
+  static void Allocated(MemoryCategory c, unsigned long int bytes);
+  static void Released(MemoryCategory c, unsigned long int bytes);
+
+  static unsigned long int GetCurrent(MemoryCategory c);
+  static unsigned long int GetPeak(MemoryCategory c);
+  static unsigned long int GetCurrentTotal();
+  static unsigned long int GetPeakTotal();
+
+  static const char* GetCategoryName(MemoryCategory c);
+
+  /* Peak resident set size of the process, 0 if unknown */
+  static unsigned long int GetPeakResidentBytes();
+
+  /* One line per category with the current and peak bytes */
+  static void PrintReport(std::ostream& s);
+
+  /* Sizes such as 4096, 512K, 256M or 2G */
+  static bool ParseSize(std::string text, unsigned long int& bytes);
+  static std::string FormatSize(unsigned long int bytes);
+
+protected:
+  static std::atomic<unsigned long int> s_Current[MEMORY_CATEGORY_MAX];
+  static std::atomic<unsigned long int> s_Peak[MEMORY_CATEGORY_MAX];
+  static std::atomic<unsigned long int> s_CurrentTotal;
+  static std::atomic<unsigned long int> s_PeakTotal;
+};
+
+/* Accounts bytes for the lifetime of the object, e.g. a local buffer */
+class BrukerMemoryScope
+{
+
+public:
+  BrukerMemoryScope(BrukerMemory::MemoryCategory c, unsigned long int bytes = 0)
+    : m_Category(c), m_ulBytes(0)
+  {
+    Set(bytes);
+  }
+
+  ~BrukerMemoryScope() { Set(0); }
+
+  /* Changes the accounted bytes, e.g. when the buffer has grown */
+  void Set(unsigned long int bytes)
+  {
+    if (bytes > m_ulBytes) BrukerMemory::Allocated(m_Category, bytes - m_ulBytes);
+    else if (bytes < m_ulBytes) BrukerMemory::Released(m_Category, m_ulBytes - bytes);
+    m_ulBytes = bytes;
+  }
+
+private:
+  BrukerMemoryScope(const BrukerMemoryScope&) = delete;
+  BrukerMemoryScope& operator=(const BrukerMemoryScope&) = delete;
+
+  BrukerMemory::MemoryCategory m_Category;
+  unsigned long int m_ulBytes;
+};
+
+class BrukerMemoryBudget
+{
+
+public:
+  /* A limit of 0 means no limit */
+  BrukerMemoryBudget(unsigned long int limit = 0);
+
+  bool IsLimited() { return m_ulLimit > 0; }
+  unsigned long int GetLimit() { return m_ulLimit; }
+
+  /* Sets memory aside for a need that cannot shrink, false if it does not fit */
+  bool Reserve(std::string what, unsigned long int bytes);
+
+  /* What is not reserved yet */
+  unsigned long int GetRemaining();
+
+  /* Reserves a fraction of the remaining memory and returns it, everything without a limit */
+  unsigned long int Share(std::string what, double fraction);
+
+  void PrintPlan(std::ostream& s);
+
+protected:
+  unsigned long int m_ulLimit;
+  unsigned long int m_ulReserved;
+  std::vector<std::pair<std::string, unsigned long int> > m_Plan;
+};
+
+#endif //BRUKER_MEMORY_HPP
@@ -0,0 +1,153 @@
+#include "brukerpreview.hpp"
+#include "ndarrayfft.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <math.h>
+
+BrukerPreview::BrukerPreview(std::string filename)
+  : m_sFilename(filename),
+    m_uiObject(0),
+    m_uiRepetition(0),
+    m_uiSamples(0),
+    m_uiChannels(1),
+    m_iKyMin(0),
+    m_ulExpected(0),
+    m_ulReceived(0),
+    m_KSpaceMemory(BrukerMemory::MEMORY_KSPACE),
+    m_bStarted(false),
+    m_bSucceeded(false)
+{
+
+}
+
+BrukerPreview::~BrukerPreview()
+{
+  if (m_Thread.joinable()) m_Thread.join();
+}
+
+bool BrukerPreview::Setup(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, unsigned int channels)
+{
+  if (!first) {
+    std::cerr << "BrukerPreview: No profiles" << std::endl;
+    return false;
+  }
+
+  m_uiChannels = channels ? channels : 1;
+  m_uiSamples = first->GetProfileLength() / m_uiChannels;
+  m_uiObject = (gen.GetNumberOfSlices() / 2) * (gen.GetNumberOfEchos() > 0 ? gen.GetNumberOfEchos() : 1);
+  m_uiRepetition = first->GetRepetitionNo();
+  m_iKyMin = gen.GetMinEncodingStep1();
+  int ny = gen.GetMaxEncodingStep1() - m_iKyMin + 1;
+
+  m_ulExpected = 0;
+  m_ulReceived = 0;
+  for (BrukerRawDataProfile* p = first; p; p = p->GetNext()) {
+    if (p->GetObjectNo() == m_uiObject && p->GetRepetitionNo() == m_uiRepetition) m_ulExpected++;
+  }
+  if (m_ulExpected == 0) {
+    /* The center slice is not in a partial profile list, use the first object listed */
+    m_uiObject = first->GetObjectNo();
+    for (BrukerRawDataProfile* p = first; p; p = p->GetNext()) {
+      if (p->GetObjectNo() == m_uiObject && p->GetRepetitionNo() == m_uiRepetition) m_ulExpected++;
+    }
+  }
+  if (m_ulExpected == 0 || m_uiSamples == 0 || ny < 1) {
+    std::cerr << "BrukerPreview: No profiles for the center slice" << std::endl;
+    return false;
+  }
+
+  std::vector<int> dims;
+  dims.push_back(m_uiSamples);
+  dims.push_back(ny);
+  dims.push_back(m_uiChannels);
+  m_KSpace = mr_recon::ComplexFloatArray(&dims);
+  m_KSpaceMemory.Set(m_KSpace.get_number_of_elements()*sizeof(mr_recon::ComplexFloat));
+  return m_KSpace.get_number_of_elements() > 0;
+}
+
+void BrukerPreview::AddProfile(BrukerRawDataProfile* p)
+{
+  AddProfile(p, p->GetDataPtr());
+}
+
+void BrukerPreview::AddProfile(BrukerRawDataProfile* p, const float* data)
+{
+  if (m_bStarted || p->GetObjectNo() != m_uiObject || p->GetRepetitionNo() != m_uiRepetition) return;
+
+  int ky = p->GetEncodeStep1() - m_iKyMin;
+  if (!data || ky < 0 || ky >= m_KSpace.get_size(1) || p->GetProfileLength() != m_uiSamples*m_uiChannels) return;
+
+  /* Partitions of a 3D scan add up to the center partition */
+  const mr_recon::ComplexFloat* in = reinterpret_cast<const mr_recon::ComplexFloat*>(data);
+  for (unsigned int c = 0; c < m_uiChannels; c++) {
+    mr_recon::ComplexFloat* out = &m_KSpace[(c*m_KSpace.get_size(1) + ky)*m_uiSamples];
+    for (unsigned int s = 0; s < m_uiSamples; s++) out[s] += in[c*m_uiSamples + s];
+  }
+
+  if (++m_ulReceived == m_ulExpected) Start();
+}
+
+void BrukerPreview::Start()
+{
+  m_bStarted = true;
+  m_Thread = std::thread(&BrukerPreview::Reconstruct, this);
+}
+
+bool BrukerPreview::Finish()
+{
+  if (!m_bStarted) {
+    if (m_ulReceived == 0) {
+      std::cerr << "BrukerPreview: No data received for the preview" << std::endl;
+      return false;
+    }
+    std::cerr << "BrukerPreview: Only " << m_ulReceived << " of " << m_ulExpected << " profiles for the preview" << std::endl;
+    Start();
+  }
+  if (m_Thread.joinable()) m_Thread.join();
+  return m_bSucceeded;
+}
+
+void BrukerPreview::Reconstruct()
+{
+  mr_recon::fft(m_KSpace, 0, true);
+  mr_recon::fft(m_KSpace, 1, true);
+
+  /* Root sum of squares over the channels, shifted so that the center of the field of view is in the middle */
+  int nx = m_KSpace.get_size(0);
+  int ny = m_KSpace.get_size(1);
+  m_Image = mr_recon::NDArray<float>(nx, ny);
+  for (int y = 0; y < ny; y++) {
+    for (int x = 0; x < nx; x++) {
+      float sum = 0.0f;
+      for (unsigned int c = 0; c < m_uiChannels; c++) sum += std::norm(m_KSpace[(c*ny + y)*nx + x]);
+      m_Image[((y + ny/2) % ny)*nx + (x + nx/2) % nx] = sqrtf(sum);
+    }
+  }
+
+  m_bSucceeded = m_sFilename.empty() || WritePGM(m_sFilename, m_Image);
+}
+
+bool BrukerPreview::WritePGM(std::string filename, mr_recon::NDArray<float>& image)
+{
+  int nx = image.get_size(0);
+  int ny = image.get_number_of_dimensions() > 1 ? image.get_size(1) : 1;
+  unsigned long int n = image.get_number_of_elements();
+
+  float max_val = 0.0f;
+  for (unsigned long int i = 0; i < n; i++) if (image[i] > max_val) max_val = image[i];
+  float scale = (max_val > 0.0f) ? 255.0f / max_val : 0.0f;
+
+  std::vector<unsigned char> pixels(n);
+  for (unsigned long int i = 0; i < n; i++) pixels[i] = static_cast<unsigned char>(image[i]*scale + 0.5f);
+
+  std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+  f << "P5" << std::endl << nx << " " << ny << std::endl << 255 << std::endl;
+  f.write(reinterpret_cast<const char*>(&pixels[0]), n);
+  if (!f) {
+    std::cerr << "BrukerPreview: Unable to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+/*****************************************************
+ *
+ *  Quick-look preview of a Bruker scan
+ *
+ *  Collects the k-space of the center slice (or, for
+ *  3D scans, the center partition) of the first
+ *  repetition from the profiles as they are
+ *  converted. As soon as all of its profiles have
+ *  been seen, a background thread reconstructs a
+ *  root-sum-of-squares magnitude image with the
+ *  built-in FFT and writes it as a PGM file, while
+ *  the conversion carries on.
+ *
+ *  The center partition of a 3D scan is the sum over
+ *  kz of the k-space planes, i.e. the zero position
+ *  of the kz transform, so only one plane is kept.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_PREVIEW_HPP
+#define BRUKER_PREVIEW_HPP
+
+#include "brukerrawdata.hpp"
+#include "types.hpp"
+#include "brukermemory.hpp"
+
+#include <string>
+#include <thread>
+
+class BrukerPreview
+{
+
+public:
+  BrukerPreview(std::string filename);
+  ~BrukerPreview();
+
+  /* Picks the center slice of the first echo in the first listed repetition and counts its
+     profiles, which hold samples*channels values */
+  bool Setup(BrukerProfileListGenerator& gen, BrukerRawDataProfile* first, unsigned int channels);
+
+  /* Takes the data of a decoded profile if it belongs to the preview */
+  void AddProfile(BrukerRawDataProfile* p);
+
+  /* As above for a profile decoded elsewhere, data holds its GetProfileLength() interleaved complex values */
+  void AddProfile(BrukerRawDataProfile* p, const float* data);
+
+  /* Waits for the reconstruction, which is started here if profiles are missing */
+  bool Finish();
+
+  /* Magnitude image [kx, ky] of the last reconstruction */
+  mr_recon::NDArray<float>& GetImage() { return m_Image; }
+
+  static bool WritePGM(std::string filename, mr_recon::NDArray<float>& image);
+
+protected:
+  void Start();
+  void Reconstruct();
+
+  std::string m_sFilename;
+  unsigned int m_uiObject;
+  unsigned int m_uiRepetition;
+  unsigned int m_uiSamples;
+  unsigned int m_uiChannels;
+  int m_iKyMin;
+  unsigned long int m_ulExpected;
+  unsigned long int m_ulReceived;
+
+  mr_recon::ComplexFloatArray m_KSpace;  /* [kx, ky, channels] */
+  BrukerMemoryScope m_KSpaceMemory;
+  mr_recon::NDArray<float> m_Image;
+  std::thread m_Thread;
+  bool m_bStarted;
+  bool m_bSucceeded;
+};
+
+#endif //BRUKER_PREVIEW_HPP
@@ -0,0 +1,102 @@
+#include "brukerprofileselection.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <stdlib.h>
+
+static const char* s_DimensionNames[BrukerProfileSelection::SELECT_DIMENSION_MAX] = {
+  "repetitions",
+  "slices",
+  "echoes",
+  "ky",
+  "kz"
+};
+
+BrukerProfileSelection::BrukerProfileSelection()
+{
+
+}
+
+static bool ParseIndex(const std::string& text, int& value)
+{
+  if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+  long v = strtol(text.c_str(), 0, 10);
+  if (v > std::numeric_limits<int>::max()) return false;
+  value = static_cast<int>(v);
+  return true;
+}
+
+bool BrukerProfileSelection::SetRanges(SelectionDimension d, std::string ranges)
+{
+  if (d >= SELECT_DIMENSION_MAX) return false;
+
+  std::vector<std::pair<int, int> > parsed;
+  std::stringstream s(ranges);
+  std::string item;
+  while (std::getline(s, item, ',')) {
+    std::string::size_type dash = item.find('-');
+    int first = 0;
+    int last = 0;
+    bool ok;
+    if (dash == std::string::npos) {
+      ok = ParseIndex(item, first);
+      last = first;
+    } else {
+      ok = ParseIndex(item.substr(0, dash), first);
+      if (dash + 1 == item.size()) {
+	last = std::numeric_limits<int>::max();
+      } else {
+	ok = ok && ParseIndex(item.substr(dash + 1), last);
+      }
+    }
+    if (!ok || last < first) {
+      std::cerr << "BrukerProfileSelection: Invalid range \"" << item << "\" for " << GetDimensionName(d) << std::endl;
+      return false;
+    }
+    parsed.push_back(std::make_pair(first, last));
+  }
+
+  if (parsed.empty() && !ranges.empty()) {
+    std::cerr << "BrukerProfileSelection: No ranges in \"" << ranges << "\" for " << GetDimensionName(d) << std::endl;
+    return false;
+  }
+
+  m_Ranges[d] = parsed;
+  m_Text[d] = ranges;
+  return true;
+}
+
+bool BrukerProfileSelection::IsSelected(SelectionDimension d, int value) const
+{
+  const std::vector<std::pair<int, int> >& r = m_Ranges[d];
+  if (r.empty()) return true;
+  for (size_t i = 0; i < r.size(); i++) {
+    if (value >= r[i].first && value <= r[i].second) return true;
+  }
+  return false;
+}
+
+bool BrukerProfileSelection::SelectsAll() const
+{
+  for (int d = 0; d < SELECT_DIMENSION_MAX; d++) {
+    if (!m_Ranges[d].empty()) return false;
+  }
+  return true;
+}
+
+const char* BrukerProfileSelection::GetDimensionName(SelectionDimension d)
+{
+  return (d < SELECT_DIMENSION_MAX) ? s_DimensionNames[d] : "unknown";
+}
+
+std::string BrukerProfileSelection::Describe() const
+{
+  std::stringstream s;
+  for (int d = 0; d < SELECT_DIMENSION_MAX; d++) {
+    if (m_Ranges[d].empty()) continue;
+    if (s.tellp() > 0) s << ", ";
+    s << s_DimensionNames[d] << " " << m_Text[d];
+  }
+  return s.str();
+}
@@ -0,0 +1,55 @@
+/*****************************************************
+ *
+ *  Selection of profiles for a partial conversion
+ *
+ *  Holds ranges of repetitions, slices, echoes and
+ *  ky/kz encoding steps, e.g. "0-9,20,100-" for the
+ *  first ten repetitions, repetition 20 and all from
+ *  100 on. A dimension without ranges selects all.
+ *
+ *  The profile list generator only creates profiles
+ *  that are selected, so the others are never read.
+ *  ky and kz are the 0 based ISMRMRD encoding steps.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_PROFILESELECTION_HPP
+#define BRUKER_PROFILESELECTION_HPP
+
+#include <string>
+#include <vector>
+
+class BrukerProfileSelection
+{
+
+public:
+  typedef enum {
+    SELECT_REPETITION = 0,
+    SELECT_SLICE,
+    SELECT_ECHO,
+    SELECT_KY,
+    SELECT_KZ,
+    SELECT_DIMENSION_MAX
+  } SelectionDimension;
+
+  BrukerProfileSelection();
+
+  /* Comma separated values and ranges a-b (inclusive) or a- (open), false if malformed */
+  bool SetRanges(SelectionDimension d, std::string ranges);
+
+  bool IsSelected(SelectionDimension d, int value) const;
+
+  bool SelectsAll(SelectionDimension d) const { return m_Ranges[d].empty(); }
+  bool SelectsAll() const;
+
+  static const char* GetDimensionName(SelectionDimension d);
+
+  /* E.g. "repetitions 0-9,20, echoes 1", empty if everything is selected */
+  std::string Describe() const;
+
+protected:
+  std::vector<std::pair<int, int> > m_Ranges[SELECT_DIMENSION_MAX];
+  std::string m_Text[SELECT_DIMENSION_MAX];
+};
+
+#endif //BRUKER_PROFILESELECTION_HPP
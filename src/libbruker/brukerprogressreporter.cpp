@@ -0,0 +1,142 @@
+#include "brukerprogressreporter.hpp"
+#include "brukerfidfollower.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+
+BrukerProgressReporter::BrukerProgressReporter(unsigned long int total_profiles, unsigned long int total_bytes,
+					       ProgressFormat format, double interval, std::ostream& s, bool single_line)
+  : m_ulProfiles(0),
+    m_ulBytes(0),
+    m_uiRepetition(0),
+    m_uiSlice(0),
+    m_ulTotalProfiles(total_profiles),
+    m_ulTotalBytes(total_bytes),
+    m_uiRepetitions(0),
+    m_uiSlices(0),
+    m_Format(format),
+    m_dInterval(interval > 0.0 ? interval : 1.0),
+    m_Stream(s),
+    m_bSingleLine(single_line && format == PROGRESS_TEXT),
+    m_dStart(BrukerMonotonicSeconds()),
+    m_dLastTime(m_dStart),
+    m_ulLastBytes(0),
+    m_bRunning(false),
+    m_bStop(false)
+{
+}
+
+BrukerProgressReporter::~BrukerProgressReporter()
+{
+  Stop();
+}
+
+bool BrukerProgressReporter::Start()
+{
+  if (m_bRunning) return true;
+  m_dStart = m_dLastTime = BrukerMonotonicSeconds();
+  m_ulLastBytes = GetBytes();
+  m_bStop = false;
+  try {
+    m_Thread = std::thread(&BrukerProgressReporter::Run, this);
+  } catch (std::exception& e) {
+    std::cerr << "BrukerProgressReporter: unable to start reporter thread: " << e.what() << std::endl;
+    return false;
+  }
+  m_bRunning = true;
+  return true;
+}
+
+void BrukerProgressReporter::Stop()
+{
+  if (!m_bRunning) return;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_bStop = true;
+  }
+  m_Wake.notify_one();
+  m_Thread.join();
+  m_bRunning = false;
+  Report(true);
+}
+
+void BrukerProgressReporter::Run()
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  while (!m_bStop) {
+    m_Wake.wait_for(lock, std::chrono::microseconds(static_cast<long>(m_dInterval*1.0e6)));
+    if (m_bStop) break;
+    Report(false);
+  }
+}
+
+/* h:mm:ss */
+static std::string FormatDuration(double seconds)
+{
+  long s = static_cast<long>(seconds + 0.5);
+  std::stringstream out;
+  out << s/3600 << ":" << std::setw(2) << std::setfill('0') << (s/60)%60 << ":" << std::setw(2) << std::setfill('0') << s%60;
+  return out.str();
+}
+
+void BrukerProgressReporter::Report(bool final)
+{
+  double now = BrukerMonotonicSeconds();
+  unsigned long int profiles = GetProfiles();
+  unsigned long int bytes = GetBytes();
+  unsigned int repetition = m_uiRepetition.load(std::memory_order_relaxed);
+  unsigned int slice = m_uiSlice.load(std::memory_order_relaxed);
+
+  double elapsed = now - m_dStart;
+  double mb = 1.0/(1024.0*1024.0);
+  double average = (elapsed > 0.0) ? bytes*mb/elapsed : 0.0;
+  double current = (now > m_dLastTime) ? (bytes - m_ulLastBytes)*mb/(now - m_dLastTime) : 0.0;
+  if (final) current = average;
+  m_dLastTime = now;
+  m_ulLastBytes = bytes;
+
+  /* The estimate uses the average rate, which is steadier than the last interval */
+  double eta = -1.0;
+  if (final) {
+    eta = 0.0;
+  } else if (profiles > 0 && m_ulTotalProfiles >= profiles) {
+    eta = elapsed*static_cast<double>(m_ulTotalProfiles - profiles)/static_cast<double>(profiles);
+  }
+
+  std::stringstream line;
+  line << std::fixed << std::setprecision(1);
+  if (m_Format == PROGRESS_JSON) {
+    line << "{\"elapsed_seconds\": " << elapsed
+	 << ", \"profiles\": " << profiles
+	 << ", \"total_profiles\": " << m_ulTotalProfiles
+	 << ", \"bytes\": " << bytes
+	 << ", \"total_bytes\": " << m_ulTotalBytes
+	 << ", \"mb_per_second\": " << current
+	 << ", \"average_mb_per_second\": " << average
+	 << ", \"eta_seconds\": " << eta
+	 << ", \"repetition\": " << repetition
+	 << ", \"repetitions\": " << m_uiRepetitions
+	 << ", \"slice\": " << slice
+	 << ", \"slices\": " << m_uiSlices
+	 << ", \"done\": " << (final ? "true" : "false") << "}" << std::endl;
+  } else {
+    if (m_bSingleLine) line << "\r";
+    line << "Converted " << profiles << "/" << m_ulTotalProfiles << " profiles";
+    if (m_ulTotalProfiles > 0) line << " (" << 100.0*profiles/m_ulTotalProfiles << "%)";
+    line << ", " << current << " MB/s";
+    if (final) {
+      line << " in " << FormatDuration(elapsed);
+    } else {
+      line << ", ETA " << (eta >= 0.0 ? FormatDuration(eta) : std::string("unknown"))
+	   << ", repetition " << repetition + 1 << "/" << m_uiRepetitions
+	   << ", slice " << slice + 1 << "/" << m_uiSlices;
+    }
+    /* Pad over the rest of a longer previous line */
+    if (m_bSingleLine) line << "    ";
+    if (!m_bSingleLine || final) line << std::endl;
+  }
+
+  m_Stream << line.str() << std::flush;
+}
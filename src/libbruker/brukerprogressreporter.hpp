@@ -0,0 +1,93 @@
+/*****************************************************
+ *
+ *  Progress reporting of a conversion
+ *
+ *  The converting thread counts profiles and bytes
+ *  with plain atomic stores; a reporter thread wakes
+ *  up periodically and prints the profiles done out
+ *  of the total, the throughput, the estimated time
+ *  left and the current repetition and slice, either
+ *  as text or as one JSON object per line.
+ *
+ *  Nothing is locked or printed in the profile loop.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_PROGRESSREPORTER_HPP
+#define BRUKER_PROGRESSREPORTER_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+
+class BrukerProgressReporter
+{
+
+public:
+  typedef enum {
+    PROGRESS_TEXT = 0,
+    PROGRESS_JSON
+  } ProgressFormat;
+
+  /* With single_line, text reports overwrite each other, meant for a terminal */
+  BrukerProgressReporter(unsigned long int total_profiles, unsigned long int total_bytes,
+			 ProgressFormat format = PROGRESS_TEXT, double interval = 1.0,
+			 std::ostream& s = std::cerr, bool single_line = false);
+  ~BrukerProgressReporter();
+
+  void SetNumberOfRepetitions(unsigned int r) { m_uiRepetitions = r; }
+  void SetNumberOfSlices(unsigned int s) { m_uiSlices = s; }
+
+  /* Starts the reporter thread */
+  bool Start();
+
+  /* Stops the thread and prints a final report */
+  void Stop();
+
+  /* Counts a converted profile. Only one thread may call this, which
+     therefore needs no atomic read-modify-write. */
+  void ProfileDone(unsigned long int bytes, unsigned int repetition, unsigned int slice)
+  {
+    m_ulProfiles.store(m_ulProfiles.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_ulBytes.store(m_ulBytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    m_uiRepetition.store(repetition, std::memory_order_relaxed);
+    m_uiSlice.store(slice, std::memory_order_relaxed);
+  }
+
+  unsigned long int GetProfiles() { return m_ulProfiles.load(std::memory_order_relaxed); }
+  unsigned long int GetBytes() { return m_ulBytes.load(std::memory_order_relaxed); }
+
+protected:
+  void Run();
+  void Report(bool final);
+
+  /* Written by the converting thread, kept away from the fields below */
+  std::atomic<unsigned long int> m_ulProfiles;
+  std::atomic<unsigned long int> m_ulBytes;
+  std::atomic<unsigned int> m_uiRepetition;
+  std::atomic<unsigned int> m_uiSlice;
+  char m_Padding[64];
+
+  unsigned long int m_ulTotalProfiles;
+  unsigned long int m_ulTotalBytes;
+  unsigned int m_uiRepetitions;
+  unsigned int m_uiSlices;
+  ProgressFormat m_Format;
+  double m_dInterval;
+  std::ostream& m_Stream;
+  bool m_bSingleLine;
+
+  double m_dStart;
+  double m_dLastTime;
+  unsigned long int m_ulLastBytes;
+
+  std::thread m_Thread;
+  std::mutex m_Mutex;
+  std::condition_variable m_Wake;
+  bool m_bRunning;
+  bool m_bStop;
+};
+
+#endif //BRUKER_PROGRESSREPORTER_HPP
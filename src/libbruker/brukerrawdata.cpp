@@ -1,5 +1,13 @@
 #include "brukerrawdata.hpp"
+#include "brukersignalstatistics.hpp"
+#include "brukermemory.hpp"
+#include "ndarraykernels.hpp"
 #include <iostream>
+#include <algorithm>
+#include <string.h>
+
+/* Largest gap between profiles that a stream reads through instead of seeking */
+#define MAX_SKIP_BYTES 65536
 
 BrukerRawDataProfile::BrukerRawDataProfile()
   : m_uiProfileLength(0),
@@ -13,16 +21,29 @@ BrukerRawDataProfile::BrukerRawDataProfile()
     m_uiRepetitionNo(0),
     m_ulFilePosition(0),
     m_pData(0),
+    m_uiAllocatedLength(0),
     m_pNext(0),
     m_pPrevious(0),
-    m_DataFormat(BrukerRawDataProfile::GO_FORMAT_NONE)
+    m_DataFormat(BrukerRawDataProfile::GO_FORMAT_NONE),
+    m_ChannelLayout(BrukerRawDataProfile::CHANNELS_SEQUENTIAL)
 {
-
+  BrukerMemory::Allocated(BrukerMemory::MEMORY_PROFILE_LIST, sizeof(BrukerRawDataProfile));
 }
 
 BrukerRawDataProfile::~BrukerRawDataProfile()
 {
   DeAllocateMemory();
+  BrukerMemory::Released(BrukerMemory::MEMORY_PROFILE_LIST, sizeof(BrukerRawDataProfile));
+}
+
+void BrukerRawDataProfile::SetChannelLayout(BrukerChannelLayout l)
+{
+  m_ChannelLayout = l;
+}
+
+BrukerRawDataProfile::BrukerChannelLayout BrukerRawDataProfile::GetChannelLayout()
+{
+  return m_ChannelLayout;
 }
 
 void BrukerRawDataProfile::SetProfileLength(unsigned int length)
@@ -159,81 +180,154 @@ BrukerRawDataProfile::BrukerDataFormat BrukerRawDataProfile::GetDataFormat()
   return m_DataFormat;
 }
 
-void BrukerRawDataProfile::ReadData(std::ifstream& fs)
+unsigned long int BrukerRawDataProfile::GetReadSize()
+{
+  switch (m_DataFormat) {
+  case GO_16BIT_SGN_INT:
+    return static_cast<unsigned long int>(m_uiProfileLength)*2*sizeof(short);
+  case GO_32BIT_SGN_INT:
+    return static_cast<unsigned long int>(m_uiProfileLength)*2*sizeof(int);
+  case GO_32BIT_FLOAT:
+    return static_cast<unsigned long int>(m_uiProfileLength)*2*sizeof(float);
+  default:
+    return 0;
+  }
+}
+
+void BrukerRawDataProfile::ReadData(std::ifstream& fs, BrukerSignalStatistics* statistics)
 {
   if (m_DataFormat == GO_FORMAT_NONE) {
     return;
   }
 
-  DeAllocateMemory();
-  m_pData = new float[m_uiProfileLength*2];
-  if (!m_pData) {
-    std::cerr << "BrukerRawDataProfile: memory allocation failed!" << std::endl;
+  if (m_DataFormat == GO_32BIT_FLOAT && !IsInterleaved()) {
+    /* No conversion needed, read straight into the profile */
+    if (static_cast<unsigned long>(fs.tellg()) != m_ulFilePosition) {
+      fs.seekg(static_cast<std::streampos>(m_ulFilePosition), std::ios::beg);
+    }
+    unsigned long int read_size = GetReadSize();
+    if (!AllocateMemory()) return;
+    fs.read((char*)m_pData, read_size);
+    if (static_cast<unsigned long int>(fs.gcount()) != read_size) {
+      std::cerr << "BrukerRawDataProfile: Unable to read sufficient bytes from stream" << std::endl;
+    } else if (statistics) {
+      statistics->DecodeProfile(m_DataFormat, reinterpret_cast<const char*>(m_pData), m_pData, m_uiProfileLength);
+    }
     return;
   }
 
-  if (static_cast<unsigned long>(fs.tellg()) != m_ulFilePosition) {
-    fs.seekg(static_cast<std::streampos>(m_ulFilePosition), std::ios::beg);
+  /* One read buffer per thread, grown to the largest profile and reused */
+  static thread_local std::vector<char> buffer;
+  if (ReadRawData(fs, buffer)) {
+    DecodeData(&buffer[0], statistics);
   }
-  
-  short* ShortBuffer = 0;
-  int* IntBuffer = 0;
+}
 
-  switch (m_DataFormat) {
+bool BrukerRawDataProfile::ReadRawData(std::ifstream& fs, std::vector<char>& buffer)
+{
+  unsigned long int position = static_cast<unsigned long int>(fs.tellg());
+  return ReadRawData(fs, buffer, position);
+}
 
-  case GO_16BIT_SGN_INT:
-    ShortBuffer = new short[m_uiProfileLength*2];
-    if (!ShortBuffer) {
-      std::cerr << "BrukerRawDataProfile: Unable to allocate short buffer" << std::endl;
-      return;
-    }
-    fs.read((char*)ShortBuffer, m_uiProfileLength*2*sizeof(short));
-    if (static_cast<unsigned int>(fs.gcount()) != m_uiProfileLength*2*sizeof(short)) {
-      std::cerr << "BrukerRawDataProfile: Unable to read sufficient bytes from stream" << std::endl;
-      return;
-    }
-    for (unsigned int i = 0; i < m_uiProfileLength; i++) {
-      m_pData[i*2  ] = ShortBuffer[i*2  ]; /* Real */
-      m_pData[i*2+1] = ShortBuffer[i*2+1]; /* Imag */
+bool BrukerRawDataProfile::ReadRawData(std::ifstream& fs, std::vector<char>& buffer, unsigned long int& position)
+{
+  unsigned long int read_size = GetReadSize();
+  if (read_size == 0) {
+    return false;
+  }
 
+  if (position != m_ulFilePosition) {
+    if (m_ulFilePosition > position && m_ulFilePosition - position <= MAX_SKIP_BYTES) {
+      /* KBlock padding and the like, cheaper to read through than to seek */
+      fs.ignore(static_cast<std::streamsize>(m_ulFilePosition - position));
+    } else {
+      fs.seekg(static_cast<std::streampos>(m_ulFilePosition), std::ios::beg);
     }
-    delete [] ShortBuffer;
-    ShortBuffer = 0;
+    position = m_ulFilePosition;
+  }
+
+  try {
+    if (buffer.size() < read_size) buffer.resize(read_size);
+  } catch (...) {
+    std::cerr << "BrukerRawDataProfile: Unable to allocate read buffer" << std::endl;
+    return false;
+  }
+
+  fs.read(&buffer[0], read_size);
+  if (static_cast<unsigned long int>(fs.gcount()) != read_size) {
+    std::cerr << "BrukerRawDataProfile: Unable to read sufficient bytes from stream" << std::endl;
+    /* Unknown, the next read seeks */
+    position = ~0UL;
+    return false;
+  }
+  position += read_size;
+  return true;
+}
+
+void BrukerRawDataProfile::DecodeData(const char* buffer, BrukerSignalStatistics* statistics)
+{
+  if (m_DataFormat == GO_FORMAT_NONE || !buffer) {
+    return;
+  }
+
+  if (!AllocateMemory()) return;
+
+  DecodeData(buffer, m_pData, statistics);
+}
+
+void BrukerRawDataProfile::DecodeData(const char* buffer, float* destination, BrukerSignalStatistics* statistics)
+{
+  if (m_DataFormat == GO_FORMAT_NONE || !buffer || !destination) {
+    return;
+  }
+
+  bool interleaved = IsInterleaved();
+  unsigned int channels = interleaved ? m_uiNumberOfChannels : 1;
+  unsigned int samples = m_uiProfileLength / channels;
+
+  /* Interleaved channels are counted while they are put in channel order */
+  if (statistics) {
+    statistics->DecodeProfile(m_DataFormat, buffer, destination, m_uiProfileLength, interleaved ? channels : 0);
+    return;
+  }
+
+  /* Interleaved channels are transposed to [samples, channels] while they are converted */
+  switch (m_DataFormat) {
+
+  case GO_16BIT_SGN_INT:
+    mr_recon::deinterleave_channels(reinterpret_cast<const short*>(buffer), destination, samples, channels);
     break;
 
   case GO_32BIT_SGN_INT:
-    IntBuffer = new int[m_uiProfileLength*2];
-    if (!IntBuffer) {
-      std::cerr << "BrukerRawDataProfile: Unable to allocate int buffer" << std::endl;
-      return;
-    }
-    fs.read((char*)IntBuffer, m_uiProfileLength*2*sizeof(int));
-    if (static_cast<unsigned int>(fs.gcount()) != m_uiProfileLength*2*sizeof(int)) {
-      std::cerr << "BrukerRawDataProfile: Unable to read sufficient bytes from stream" << std::endl;
-      return;
-    }
-    for (unsigned int i = 0; i < m_uiProfileLength; i++) {
-      m_pData[i*2  ] = IntBuffer[i*2  ]; /* Real */
-      m_pData[i*2+1] = IntBuffer[i*2+1]; /* Imag */
-      //std::cout << "(" << m_pData[i*2  ] << ", " << m_pData[i*2+1] << ")" << std::endl;
-    }
-    delete [] IntBuffer;
-    IntBuffer = 0;
+    mr_recon::deinterleave_channels(reinterpret_cast<const int*>(buffer), destination, samples, channels);
     break;
 
   case GO_32BIT_FLOAT:
-    fs.read((char*)m_pData, m_uiProfileLength*2*sizeof(float));
-    if (static_cast<unsigned int>(fs.gcount()) != m_uiProfileLength*2*sizeof(float)) {
-      std::cerr << "BrukerRawDataProfile: Unable to read sufficient bytes from stream" << std::endl;
-      return;
-    }
+    mr_recon::deinterleave_channels(reinterpret_cast<const float*>(buffer), destination, samples, channels);
     break;
 
   default:
-    std::cerr << "BrukerRawDataProfile: Unknow data type in read" << std::endl;
+    std::cerr << "BrukerRawDataProfile: Unknow data type in decode" << std::endl;
     return;
   }
+}
+
+bool BrukerRawDataProfile::AllocateMemory()
+{
+  /* Profiles that are read or decoded repeatedly keep their buffer */
+  if (m_pData && m_uiAllocatedLength == m_uiProfileLength) return true;
 
+  DeAllocateMemory();
+  try {
+    m_pData = new float[m_uiProfileLength*2];
+  } catch (...) {
+    std::cerr << "BrukerRawDataProfile: memory allocation failed!" << std::endl;
+    m_pData = 0;
+    return false;
+  }
+  m_uiAllocatedLength = m_uiProfileLength;
+  BrukerMemory::Allocated(BrukerMemory::MEMORY_PROFILE_DATA, m_uiAllocatedLength*2UL*sizeof(float));
+  return true;
 }
 
 void BrukerRawDataProfile::WriteData(std::ofstream& fs, float max_val)
@@ -334,20 +428,18 @@ void BrukerRawDataProfile::SetRawData(float* d)
 {
   if (!d) return;
 
-  if (!m_pData) {
-    try {
-      m_pData = new float[m_uiProfileLength*2];
-    } catch (...) {
-      std::cerr << "BrukerRawdataProfile: Unable to allocate memory for SetRawData" << std::endl;
-      return;
-    }
-  }
+  if (!m_pData && !AllocateMemory()) return;
 
   for (unsigned int i = 0; i < m_uiProfileLength*2; i++) m_pData[i] = d[i];
 }
 
 
 void BrukerRawDataProfile::SetRawDataFromArray(mr_recon::ComplexFloatArray& a, int ky_min, int kz_min)
+{
+  SetRawDataFromArray(mr_recon::ComplexFloatArrayView(a), ky_min, kz_min);
+}
+
+void BrukerRawDataProfile::SetRawDataFromArray(const mr_recon::ComplexFloatArrayView& a, int ky_min, int kz_min)
 {
   //This function expects the array to have dimensions [kx, ky, kz, objects, repetitions]
   if (ky_min <= - 10000) {
@@ -395,16 +487,53 @@ void BrukerRawDataProfile::SetRawDataFromArray(mr_recon::ComplexFloatArray& a, i
     return;
   }
 
-  unsigned long int index = 
-    m_uiRepetitionNo*(a.get_size(3)*a.get_size(2)*a.get_size(1)*a.get_size(0)) +
-    m_uiObjectNo*(a.get_size(2)*a.get_size(1)*a.get_size(0)) +
-    (m_iEncodeStep2-kz_min)*(a.get_size(1)*a.get_size(0)) +
-    (m_iEncodeStep1-ky_min)*(a.get_size(0));
+  std::complex<float>* line = &a(0, m_iEncodeStep1-ky_min, m_iEncodeStep2-kz_min, m_uiObjectNo, m_uiRepetitionNo);
+  long stride = a.get_stride(0);
 
-  float* data_p = (float*)(a.get_data_ptr());
-  data_p += (index*2);
+  if (stride == 1) {
+    this->SetRawData(reinterpret_cast<float*>(line));
+    return;
+  }
 
-  this->SetRawData(data_p);
+  if (!m_pData && !AllocateMemory()) return;
+  for (unsigned int i = 0; i < m_uiProfileLength; i++) {
+    m_pData[2*i] = line[i*stride].real();
+    m_pData[2*i+1] = line[i*stride].imag();
+  }
+}
+
+bool BrukerRawDataProfile::CopyRawDataToArray(const mr_recon::ComplexFloatArrayView& a)
+{
+  if (!m_pData) return false;
+
+  if (a.get_number_of_elements() != m_uiProfileLength) {
+    std::cerr << "BrukerRawDataProfile::CopyRawDataToArray: Mismatch between array elements = " 
+	      << a.get_number_of_elements() << " and uiProfileLength " << m_uiProfileLength << std::endl;
+    return false;
+  }
+
+  if (a.is_contiguous()) {
+    std::complex<float>* p = a.get_data_ptr();
+    for (unsigned int i = 0; i < m_uiProfileLength; i++) {
+      p[i] = std::complex<float>(m_pData[2*i], m_pData[2*i+1]);
+    }
+    return true;
+  }
+
+  if (a.get_number_of_dimensions() > 2) {
+    std::cerr << "BrukerRawDataProfile::CopyRawDataToArray: Strided views can have at most two dimensions" << std::endl;
+    return false;
+  }
+
+  /* Profile data is [samples, channels] with samples varying fastest */
+  int nx = a.get_size(0);
+  int nc = a.get_size(1);
+  for (int c = 0; c < nc; c++) {
+    for (int s = 0; s < nx; s++) {
+      a(s, c) = std::complex<float>(m_pData[2*(nx*c+s)], m_pData[2*(nx*c+s)+1]);
+    }
+  }
+  return true;
 }
 
 void BrukerRawDataProfile::DeAllocateMemory()
@@ -412,6 +541,8 @@ void BrukerRawDataProfile::DeAllocateMemory()
   if (m_pData) {
     delete [] m_pData;
     m_pData = 0;
+    BrukerMemory::Released(BrukerMemory::MEMORY_PROFILE_DATA, m_uiAllocatedLength*2UL*sizeof(float));
+    m_uiAllocatedLength = 0;
   }
 }
 
@@ -498,9 +629,7 @@ float BrukerRawDataProfile::GetMaxDataValue(bool include_all_linked_profiles)
     }
   } else {
     if (m_pData) {
-      for (unsigned int i = 0; i < m_uiProfileLength*2; i++) {
-	if (fabs(m_pData[i]) > max_val) max_val = m_pData[i];
-      }
+      max_val = mr_recon::max_abs(m_pData, m_uiProfileLength*2);
     }
   }
   return max_val;
@@ -510,6 +639,7 @@ float BrukerRawDataProfile::GetMaxDataValue(bool include_all_linked_profiles)
 BrukerProfileListGenerator::BrukerProfileListGenerator()
   : m_ACQ_dim(0),
     m_ACQ_size(0),
+    m_NumChannels(1),
     m_PVM_matrix(0),
     m_PVM_AntiAlias(0),
     m_NI(0),
@@ -535,7 +665,20 @@ BrukerProfileListGenerator::BrukerProfileListGenerator()
     m_ky_max(0),
     m_kz_min(0),
     m_kz_max(0),
-    m_1k_file_format(false)
+    m_1k_file_format(false),
+    m_data_format(BrukerRawDataProfile::GO_FORMAT_NONE),
+    m_profile_data_length(0),
+    m_expected_file_size(0),
+    m_e1_steps(0),
+    m_e2_steps(0),
+    m_profiles_per_repetition(0),
+    m_layout_ready(false),
+    m_channel_layout(BrukerRawDataProfile::CHANNELS_SEQUENTIAL),
+    m_selection(0),
+    m_fid_profiles(0),
+    m_selected_profiles(0),
+    m_selected_repetitions(0),
+    m_sequential_layout(false)
 {
 
 }
@@ -580,6 +723,16 @@ void BrukerProfileListGenerator::ExtractParametersFromAcq(BrukerParameterFile* a
     }
   }
 
+  /* The receivers in use, PVM_EncNReceivers takes precedence when there is a method file */
+  p = acqp->FindParameter(std::string("ACQ_ReceiverSelect"));
+  if (p) {
+    int selected = 0;
+    for (int i = 0; i < p->GetNumberOfValues(); i++) {
+      if (!p->GetValue(i)->GetStringValue().compare(std::string("Yes"))) selected++;
+    }
+    if (selected > 0) m_NumChannels = selected;
+  }
+
   if (method) {
     p = method->FindParameter(std::string("PVM_EncNReceivers"));
     if (p) {
@@ -801,37 +954,132 @@ void BrukerProfileListGenerator::ExtractParametersFromAcq(BrukerParameterFile* a
   }
 }
 
-BrukerRawDataProfile* BrukerProfileListGenerator::GetProfileList(BrukerParameterFile* acqp, BrukerParameterFile* method)
+bool BrukerProfileListGenerator::SetupLayout(BrukerParameterFile* acqp, BrukerParameterFile* method)
 {
-  
+  if (m_layout_ready) return true;
+
   ExtractParametersFromAcq(acqp, method);
   //PrintParameters();
 
-  BrukerRawDataProfile* first   = 0;
-  BrukerRawDataProfile* current = 0;
-  
-  unsigned long int position = 0;
+  if (!m_ACQ_size || !m_ACQ_obj_order || m_ACQ_phase_factor < 1) {
+    std::cerr << "BrukerProfileListGenerator: Incomplete acquisition parameters" << std::endl;
+    return false;
+  }
+  if (m_NumChannels < 1) m_NumChannels = 1;
 
-  unsigned long int profile_data_length = 0;
+  int data_size;
+  if (m_data_format == BrukerRawDataProfile::GO_32BIT_SGN_INT || m_data_format == BrukerRawDataProfile::GO_32BIT_FLOAT) {
+    data_size = 4;
+  } else {
+    data_size = 2;
+  }
+  m_profile_data_length = static_cast<unsigned long int>(m_ACQ_size[0])*m_NumChannels*data_size;
   if (m_1k_file_format) {
-    int data_size;
-    if (m_data_format == BrukerRawDataProfile::GO_32BIT_SGN_INT || m_data_format == BrukerRawDataProfile::GO_32BIT_FLOAT) {
-      data_size = 4;
-    } else {
-      data_size = 2;
-    }
-    profile_data_length = m_ACQ_size[0]*m_NumChannels*data_size;
-    if (profile_data_length % 1024) {
-      profile_data_length = ((profile_data_length / 1024)+1)*1024;
+    if (m_profile_data_length % 1024) {
+      m_profile_data_length = ((m_profile_data_length / 1024)+1)*1024;
     }
   }
 
+  m_e2_steps = (m_ACQ_dim <= 2) ? 1 : m_ACQ_size[2];
+  m_e1_steps = (m_ACQ_dim <= 1) ? 1 : (m_ACQ_size[1]/m_ACQ_phase_factor);
+  m_profiles_per_repetition =
+    static_cast<unsigned long int>(m_e2_steps)*m_e1_steps*m_NSLICES*m_ACQ_phase_factor*m_ACQ_n_echo_images;
+  m_expected_file_size = m_profiles_per_repetition*(m_NR > 0 ? m_NR : 0)*m_profile_data_length;
+
+  /* Inverse profile orders for GetProfilePosition, the first profile wins if an encoding step repeats */
+  m_ky_index.assign(m_ky_max - m_ky_min + 1, -1);
+  for (int i = 0; i < m_e1_steps*m_ACQ_phase_factor; i++) {
+    int ky = (m_ACQ_spatial_size_1 > 0) ? m_ky_profile_order[i] : 0;
+    if (ky >= m_ky_min && ky <= m_ky_max && m_ky_index[ky - m_ky_min] < 0) m_ky_index[ky - m_ky_min] = i;
+  }
+  m_kz_index.assign(m_kz_max - m_kz_min + 1, -1);
+  for (int i = 0; i < m_e2_steps; i++) {
+    int kz = (m_ACQ_spatial_size_2 > 0) ? m_kz_profile_order[i] : 0;
+    if (kz >= m_kz_min && kz <= m_kz_max && m_kz_index[kz - m_kz_min] < 0) m_kz_index[kz - m_kz_min] = i;
+  }
+  m_slice_index.clear();
+  for (int ns = 0; ns < m_NSLICES && ns < m_NI; ns++) {
+    int slice = m_ACQ_obj_order[ns];
+    if (slice < 0) continue;
+    if (slice >= static_cast<int>(m_slice_index.size())) m_slice_index.resize(slice + 1, -1);
+    if (m_slice_index[slice] < 0) m_slice_index[slice] = ns;
+  }
+
+  m_layout_ready = true;
+  return true;
+}
+
+bool BrukerProfileListGenerator::GetProfilePosition(int ky, int kz, int slice, int echo, int repetition, unsigned long int& position)
+{
+  if (!m_layout_ready || ky < m_ky_min || ky > m_ky_max || kz < m_kz_min || kz > m_kz_max ||
+      slice < 0 || slice >= static_cast<int>(m_slice_index.size()) ||
+      echo < 0 || echo >= m_ACQ_n_echo_images || repetition < 0 || repetition >= m_NR) {
+    return false;
+  }
+  int step1 = m_ky_index[ky - m_ky_min];
+  int step2 = m_kz_index[kz - m_kz_min];
+  int ns = m_slice_index[slice];
+  if (step1 < 0 || step2 < 0 || ns < 0) return false;
+
+  /* The loop order of GetProfileList: repetition, e2, e1, slice, phase, echo */
+  int e1 = step1 / m_ACQ_phase_factor;
+  int ph = step1 % m_ACQ_phase_factor;
+  unsigned long int index = static_cast<unsigned long int>(repetition)*m_profiles_per_repetition;
+  index += ((((static_cast<unsigned long int>(step2)*m_e1_steps + e1)*m_NSLICES + ns)*m_ACQ_phase_factor + ph)*m_ACQ_n_echo_images + echo);
+  position = index*m_profile_data_length;
+  return true;
+}
+
+BrukerRawDataProfile* BrukerProfileListGenerator::GetProfileList(BrukerParameterFile* acqp, BrukerParameterFile* method)
+{
+  if (!SetupLayout(acqp, method)) return 0;
+
+  BrukerRawDataProfile* first   = 0;
+  BrukerRawDataProfile* current = 0;
+  
+  unsigned long int position = 0;
+  unsigned long int profile_data_length = m_profile_data_length;
+  int e2_steps = m_e2_steps;
+  int e1_steps = m_e1_steps;
+  unsigned long int profiles_per_repetition = m_profiles_per_repetition;
+
+  /* The selection uses ISMRMRD encoding steps, which are centered on GetDimensionSize() */
+  int ky_offset = std::max(GetDimensionSize(1), 1) >> 1;
+  int kz_offset = std::max(GetDimensionSize(2), 1) >> 1;
+  const BrukerProfileSelection* sel = m_selection;
+
+  m_fid_profiles = 0;
+  m_selected_profiles = 0;
+  m_selected_repetitions = 0;
+  m_sequential_layout = true;
+  unsigned long int next_position = 0;
+
   for (int nr = 0; nr < m_NR; nr++) { /* Repeated measurements */
-    for (int e2 = 0; e2 < ((m_ACQ_dim <= 2) ? 1 : m_ACQ_size[2]); e2++) {
-      for (int e1 = 0; e1 < ((m_ACQ_dim <= 1) ? 1 : (m_ACQ_size[1]/m_ACQ_phase_factor)); e1++) {
+    m_fid_profiles += profiles_per_repetition;
+    if (sel && !sel->IsSelected(BrukerProfileSelection::SELECT_REPETITION, nr)) {
+      /* Skip the whole repetition without looking at its profiles */
+      position += profiles_per_repetition*profile_data_length;
+      continue;
+    }
+    unsigned long int listed = m_selected_profiles;
+    for (int e2 = 0; e2 < e2_steps; e2++) {
+      for (int e1 = 0; e1 < e1_steps; e1++) {
 	for (int ns = 0; ns < m_NSLICES; ns++) {
 	  for (int ph = 0; ph < m_ACQ_phase_factor; ph++) {
             for (int ne = 0; ne < m_ACQ_n_echo_images; ne++) {
+              if (sel) {
+                int ky = (m_ACQ_spatial_size_1 > 0) ? m_ky_profile_order[e1*m_ACQ_phase_factor+ph] : 0;
+                int kz = (m_ACQ_spatial_size_2 > 0) ? m_kz_profile_order[e2] : 0;
+                if (!sel->IsSelected(BrukerProfileSelection::SELECT_SLICE, m_ACQ_obj_order[ns]) ||
+                    !sel->IsSelected(BrukerProfileSelection::SELECT_ECHO, ne) ||
+                    !sel->IsSelected(BrukerProfileSelection::SELECT_KY, ky + ky_offset) ||
+                    !sel->IsSelected(BrukerProfileSelection::SELECT_KZ, kz + kz_offset)) {
+                  position += profile_data_length;
+                  continue;
+                }
+              }
+              m_selected_profiles++;
+
               BrukerRawDataProfile* new_p = new BrukerRawDataProfile();  
               if (!first) {
                 first = new_p;
@@ -841,8 +1089,11 @@ BrukerRawDataProfile* BrukerProfileListGenerator::GetProfileList(BrukerParameter
               }
               current = new_p;
 	    
-              current->SetProfileLength(m_ACQ_size[0]/2);
+              /* ACQ_size[0] counts the real and imaginary values of one receiver, each
+                 profile holds the samples of all receivers in the channel layout */
+              current->SetProfileLength((m_ACQ_size[0]/2)*m_NumChannels);
               current->SetNumberOfChannels(m_NumChannels);
+              current->SetChannelLayout(m_channel_layout);
               if (m_ACQ_spatial_size_1 > 0) {
                 current->SetEncodeStep1(m_ky_profile_order[e1*m_ACQ_phase_factor+ph]);
               } 
@@ -850,25 +1101,27 @@ BrukerRawDataProfile* BrukerProfileListGenerator::GetProfileList(BrukerParameter
                 current->SetEncodeStep2(m_kz_profile_order[e2]);
               } 
 	    
-              /* TODO: Deal with multichannel data */
-              //current->SetChannelNo(0);
-	    
               current->SetSliceNo(m_ACQ_obj_order[ns]);
 	    
               current->SetEchoNo(ne);
+
+              /* Objects (NI) are the slices times the echo images */
+              current->SetObjectNo(m_ACQ_obj_order[ns]*m_ACQ_n_echo_images + ne);
             
               current->SetRepetitionNo(nr);
 	    
               current->SetDataFormat(m_data_format);
 
               current->SetFilePosition(position);
+              if (position != next_position) m_sequential_layout = false;
+              next_position = position + current->GetReadSize();
               position += profile_data_length;
             }	    
 	  }
 	}
       }
     } 
-
+    if (m_selected_profiles > listed) m_selected_repetitions++;
   }
 
   return first;
@@ -2,13 +2,16 @@
 #define BRUKER_RAWDATA_HPP
 
 #include "brukerparameterparser.hpp"
+#include "brukerprofileselection.hpp"
 #include "ndarray.hpp"
 #include "types.hpp"
 
 #include <fstream>
+#include <vector>
 
 //#define MAX_READ_BUFFER 20480
 
+class BrukerSignalStatistics;
 
 class BrukerRawDataProfile {
 public:
@@ -21,6 +24,12 @@ public:
     GO_DATA_FORMAT_MAX
   } BrukerDataFormat;
 
+  /* How the receiver channels of a profile are stored in the fid */
+  typedef enum {
+    CHANNELS_SEQUENTIAL = 0,  /* all samples of one channel, then the next: the ISMRMRD layout */
+    CHANNELS_INTERLEAVED      /* sample by sample, with the channel running fastest */
+  } BrukerChannelLayout;
+
 
   BrukerRawDataProfile();
   ~BrukerRawDataProfile();
@@ -28,8 +37,13 @@ public:
   void SetProfileLength(unsigned int);
   unsigned int GetProfileLength();
 
+  /* The profile length covers all channels, GetProfileLength()/GetNumberOfChannels() samples each */
   void SetNumberOfChannels(unsigned int);
   unsigned int GetNumberOfChannels();
+
+  /* Decoding always produces [samples, channels], interleaved profiles are transposed */
+  void SetChannelLayout(BrukerChannelLayout l);
+  BrukerChannelLayout GetChannelLayout();
     
   void SetEncodeStep1(int e);
   int GetEncodeStep1();
@@ -64,7 +78,24 @@ public:
   void SetDataFormat(BrukerDataFormat f);
   BrukerDataFormat GetDataFormat();
 
-  void ReadData(std::ifstream& fs);
+  /* Number of bytes ReadData consumes from the fid for the current profile length and format */
+  unsigned long int GetReadSize();
+
+  /* With statistics, the signal statistics are collected while the data is decoded */
+  void ReadData(std::ifstream& fs, BrukerSignalStatistics* statistics = 0);
+
+  /* Reads the GetReadSize() bytes of the profile without decoding them, buffer is grown as needed */
+  bool ReadRawData(std::ifstream& fs, std::vector<char>& buffer);
+
+  /* As above for a fid read front to back: position is where the stream stands and is moved past
+     the profile, so consecutive profiles need no tellg or seekg; small gaps are read through */
+  bool ReadRawData(std::ifstream& fs, std::vector<char>& buffer, unsigned long int& position);
+
+  /* Converts GetReadSize() bytes of raw fid data to complex float */
+  void DecodeData(const char* buffer, BrukerSignalStatistics* statistics = 0);
+
+  /* As above, into GetProfileLength() interleaved complex values at destination instead of the profile */
+  void DecodeData(const char* buffer, float* destination, BrukerSignalStatistics* statistics = 0);
 
   void WriteData(std::ofstream& fs, float max_val);
 
@@ -72,6 +103,12 @@ public:
 
   void SetRawDataFromArray(mr_recon::ComplexFloatArray& a, int ky_min = -10000, int kz_min = -10000);
 
+  /* As above for a view [kx, ky, kz, objects, repetitions], which may be strided or borrowed memory */
+  void SetRawDataFromArray(const mr_recon::ComplexFloatArrayView& a, int ky_min = -10000, int kz_min = -10000);
+
+  /* Copies the profile data into a view with GetProfileLength() elements, e.g. an acquisition payload */
+  bool CopyRawDataToArray(const mr_recon::ComplexFloatArrayView& a);
+
   void DeleteLinkedProfiles();
 
   void DeleteNext();
@@ -98,12 +135,17 @@ protected:
   unsigned long int m_ulFilePosition;
 
   float* m_pData;
+  unsigned int m_uiAllocatedLength;  /* complex samples in m_pData, for the memory accounting */
 
   BrukerRawDataProfile* m_pNext;
   BrukerRawDataProfile* m_pPrevious;
 
   BrukerDataFormat m_DataFormat;
+  BrukerChannelLayout m_ChannelLayout;
+
+  bool IsInterleaved() { return m_ChannelLayout == CHANNELS_INTERLEAVED && m_uiNumberOfChannels > 1; }
   
+  bool AllocateMemory();
   void DeAllocateMemory();
 
   /* Some read buffers, these are declared static to avoid allocation and deallocation in all profile instances */
@@ -122,10 +164,30 @@ public:
   ~BrukerProfileListGenerator();
 
   BrukerRawDataProfile* GetProfileList(BrukerParameterFile* acqp, BrukerParameterFile* method = 0);
+
+  /* Reads the parameters and works out the layout of the fid without creating a profile list,
+     enough for GetProfilePosition. GetProfileList does this itself. */
+  bool SetupLayout(BrukerParameterFile* acqp, BrukerParameterFile* method = 0);
+
+  /* File position of a profile from its encoding steps (as GetEncodeStep1/2), slice (as GetSliceNo),
+     echo and repetition, computed in O(1); false if the fid has no such profile */
+  bool GetProfilePosition(int ky, int kz, int slice, int echo, int repetition, unsigned long int& position);
+
+  /* Only profiles in the selection are put in the list, 0 lists all. File positions and
+     the expected file size still describe the complete fid. */
+  void SetSelection(const BrukerProfileSelection* selection) { m_selection = selection; }
   
   void PrintParameters();
 
   int GetNumberOfChannels() { return m_NumChannels; }
+  /* Complex samples per channel in a profile of the fid, profiles hold this times GetNumberOfChannels() */
+  int GetNumberOfSamples() { return m_ACQ_size ? m_ACQ_size[0]/2 : 0; }
+
+  /* Order of the receiver channels within a profile, ParaVision stores them one after the
+     other; set before GetProfileList, the profiles decode to [samples, channels] either way */
+  void SetChannelLayout(BrukerRawDataProfile::BrukerChannelLayout l) { m_channel_layout = l; }
+  BrukerRawDataProfile::BrukerChannelLayout GetChannelLayout() { return m_channel_layout; }
+  BrukerRawDataProfile::BrukerDataFormat GetDataFormat() { return m_data_format; }
   int GetNumberOfDimensions() { return m_ACQ_dim; }
   int GetDimensionSize(int dimension = 0);
   int GetNumberOfObjects() {return m_NI;}
@@ -137,6 +199,20 @@ public:
   int GetMinEncodingStep2() { return m_kz_min; }
   int GetMaxEncodingStep2() { return m_kz_max; }
 
+  /* Bytes between consecutive profiles in the fid, including any KBlock padding */
+  unsigned long int GetProfileDataLength() { return m_profile_data_length; }
+  /* Size of the fid when the acquisition has completed */
+  unsigned long int GetExpectedFileSize() { return m_expected_file_size; }
+
+  /* Profiles in the fid and in the list returned by GetProfileList */
+  unsigned long int GetNumberOfFidProfiles() { return m_fid_profiles; }
+  unsigned long int GetNumberOfSelectedProfiles() { return m_selected_profiles; }
+  /* Repetitions with at least one profile in the list */
+  int GetNumberOfSelectedRepetitions() { return m_selected_repetitions; }
+  /* True if each listed profile starts where the one before it ends, from the start of the fid;
+     such a list is read with one stream and no seeks */
+  bool IsSequentialLayout() { return m_sequential_layout; }
+
 protected:
   void ExtractParametersFromAcq(BrukerParameterFile* acqp, BrukerParameterFile* method = 0);
   
@@ -172,6 +248,24 @@ protected:
   int m_kz_max;
   bool m_1k_file_format;
   BrukerRawDataProfile::BrukerDataFormat m_data_format;
+  unsigned long int m_profile_data_length;
+  unsigned long int m_expected_file_size;
+
+  /* Layout of the fid from SetupLayout */
+  int m_e1_steps;
+  int m_e2_steps;
+  unsigned long int m_profiles_per_repetition;
+  std::vector<int> m_ky_index;     /* ky - m_ky_min to e1*ACQ_phase_factor + phase, -1 if not acquired */
+  std::vector<int> m_kz_index;     /* kz - m_kz_min to e2 */
+  std::vector<int> m_slice_index;  /* slice number to its position in ACQ_obj_order */
+  bool m_layout_ready;
+  BrukerRawDataProfile::BrukerChannelLayout m_channel_layout;
+
+  const BrukerProfileSelection* m_selection;
+  unsigned long int m_fid_profiles;
+  unsigned long int m_selected_profiles;
+  int m_selected_repetitions;
+  bool m_sequential_layout;
 };
 
 
@@ -0,0 +1,134 @@
+#include "brukersignalstatistics.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <math.h>
+
+static void WriteStatistics(std::ostream& s, const mr_recon::SignalStatistics& st, std::string indent)
+{
+  double n = st.samples ? static_cast<double>(st.samples) : 1.0;
+  s << indent << "\"samples\": " << st.samples << "," << std::endl;
+  s << indent << "\"max_magnitude\": " << st.max_magnitude << "," << std::endl;
+  s << indent << "\"mean_real\": " << st.sum_real/n << "," << std::endl;
+  s << indent << "\"mean_imag\": " << st.sum_imag/n << "," << std::endl;
+  s << indent << "\"energy\": " << st.energy << "," << std::endl;
+  s << indent << "\"rms\": " << sqrt(st.energy/n) << "," << std::endl;
+  s << indent << "\"clipped_values\": " << st.clipped << std::endl;
+}
+
+BrukerSignalStatistics::BrukerSignalStatistics(unsigned int channels)
+  : m_ulProfiles(0),
+    m_Format(BrukerRawDataProfile::GO_FORMAT_NONE)
+{
+  Reset(channels);
+}
+
+void BrukerSignalStatistics::Reset(unsigned int channels)
+{
+  m_Channels.assign(channels ? channels : 1, mr_recon::SignalStatistics());
+  m_ulProfiles = 0;
+  m_Format = BrukerRawDataProfile::GO_FORMAT_NONE;
+}
+
+void BrukerSignalStatistics::DecodeProfile(BrukerRawDataProfile::BrukerDataFormat format, const char* buffer,
+					   float* destination, unsigned int profile_length, unsigned int interleaved_channels)
+{
+  if (interleaved_channels > 1) {
+    if (interleaved_channels > m_Channels.size()) m_Channels.resize(interleaved_channels);
+    unsigned long int samples = profile_length / interleaved_channels;
+    switch (format) {
+    case BrukerRawDataProfile::GO_16BIT_SGN_INT:
+      mr_recon::deinterleave_with_statistics(reinterpret_cast<const short*>(buffer), destination, samples, interleaved_channels, &m_Channels[0]);
+      break;
+    case BrukerRawDataProfile::GO_32BIT_SGN_INT:
+      mr_recon::deinterleave_with_statistics(reinterpret_cast<const int*>(buffer), destination, samples, interleaved_channels, &m_Channels[0]);
+      break;
+    case BrukerRawDataProfile::GO_32BIT_FLOAT:
+      mr_recon::deinterleave_with_statistics(reinterpret_cast<const float*>(buffer), destination, samples, interleaved_channels, &m_Channels[0]);
+      break;
+    default:
+      std::cerr << "BrukerSignalStatistics: Unknow data type in decode" << std::endl;
+      return;
+    }
+    m_Format = format;
+    m_ulProfiles++;
+    return;
+  }
+
+  /* Profiles that do not split into channels are counted as one channel */
+  unsigned int channels = m_Channels.size();
+  if (profile_length % channels) channels = 1;
+  unsigned long int samples = profile_length / channels;
+
+  for (unsigned int c = 0; c < channels; c++) {
+    float* out = destination + 2*c*samples;
+    switch (format) {
+    case BrukerRawDataProfile::GO_16BIT_SGN_INT:
+      mr_recon::convert_with_statistics(reinterpret_cast<const short*>(buffer) + 2*c*samples, out, samples, m_Channels[c]);
+      break;
+    case BrukerRawDataProfile::GO_32BIT_SGN_INT:
+      mr_recon::convert_with_statistics(reinterpret_cast<const int*>(buffer) + 2*c*samples, out, samples, m_Channels[c]);
+      break;
+    case BrukerRawDataProfile::GO_32BIT_FLOAT:
+      mr_recon::convert_with_statistics(reinterpret_cast<const float*>(buffer) + 2*c*samples, out, samples, m_Channels[c]);
+      break;
+    default:
+      std::cerr << "BrukerSignalStatistics: Unknow data type in decode" << std::endl;
+      return;
+    }
+  }
+  m_Format = format;
+  m_ulProfiles++;
+}
+
+void BrukerSignalStatistics::Merge(const BrukerSignalStatistics& s)
+{
+  if (s.m_Channels.size() > m_Channels.size()) m_Channels.resize(s.m_Channels.size());
+  for (size_t c = 0; c < s.m_Channels.size(); c++) m_Channels[c].add(s.m_Channels[c]);
+  m_ulProfiles += s.m_ulProfiles;
+  if (s.m_Format != BrukerRawDataProfile::GO_FORMAT_NONE) m_Format = s.m_Format;
+}
+
+mr_recon::SignalStatistics BrukerSignalStatistics::GetTotal()
+{
+  mr_recon::SignalStatistics total;
+  for (size_t c = 0; c < m_Channels.size(); c++) total.add(m_Channels[c]);
+  return total;
+}
+
+void BrukerSignalStatistics::WriteJSON(std::ostream& s)
+{
+  std::string format;
+  switch (m_Format) {
+  case BrukerRawDataProfile::GO_16BIT_SGN_INT: format = "GO_16BIT_SGN_INT"; break;
+  case BrukerRawDataProfile::GO_32BIT_SGN_INT: format = "GO_32BIT_SGN_INT"; break;
+  case BrukerRawDataProfile::GO_32BIT_FLOAT: format = "GO_32BIT_FLOAT"; break;
+  default: format = "";
+  }
+
+  s << "{" << std::endl;
+  s << "  \"profiles\": " << m_ulProfiles << "," << std::endl;
+  s << "  \"data_format\": \"" << format << "\"," << std::endl;
+  s << "  \"scan\": {" << std::endl;
+  WriteStatistics(s, GetTotal(), "    ");
+  s << "  }," << std::endl;
+  s << "  \"channels\": [" << std::endl;
+  for (size_t c = 0; c < m_Channels.size(); c++) {
+    s << "    {" << std::endl;
+    WriteStatistics(s, m_Channels[c], "      ");
+    s << "    }" << (c + 1 < m_Channels.size() ? "," : "") << std::endl;
+  }
+  s << "  ]" << std::endl;
+  s << "}" << std::endl;
+}
+
+bool BrukerSignalStatistics::WriteJSON(std::string filename)
+{
+  std::ofstream f(filename.c_str());
+  WriteJSON(f);
+  if (!f) {
+    std::cerr << "BrukerSignalStatistics: Unable to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
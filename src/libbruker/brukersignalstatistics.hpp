@@ -0,0 +1,59 @@
+/*****************************************************
+ *
+ *  Signal statistics of a Bruker fid
+ *
+ *  Collects the maximum magnitude, mean, energy and
+ *  number of values at the ADC rails per channel
+ *  while the profiles are decoded, so that quality
+ *  checks do not need a second pass over the data.
+ *
+ *  A profile holds the channels one after the other,
+ *  each with GetProfileLength()/channels samples.
+ *  Not thread safe, threads decoding in parallel
+ *  should use one instance each and Merge them.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_SIGNALSTATISTICS_HPP
+#define BRUKER_SIGNALSTATISTICS_HPP
+
+#include "brukerrawdata.hpp"
+#include "ndarraykernels.hpp"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+class BrukerSignalStatistics
+{
+
+public:
+  BrukerSignalStatistics(unsigned int channels = 1);
+
+  void Reset(unsigned int channels);
+  unsigned int GetNumberOfChannels() { return static_cast<unsigned int>(m_Channels.size()); }
+
+  /* Converts profile_length complex samples of raw fid data to float and adds them to the statistics.
+     With interleaved_channels > 1 the buffer holds that many channels sample by sample, they
+     are put one after the other in destination while they are counted. */
+  void DecodeProfile(BrukerRawDataProfile::BrukerDataFormat format, const char* buffer, float* destination,
+		     unsigned int profile_length, unsigned int interleaved_channels = 0);
+
+  void Merge(const BrukerSignalStatistics& s);
+
+  unsigned long int GetNumberOfProfiles() { return m_ulProfiles; }
+  const mr_recon::SignalStatistics& GetChannel(unsigned int channel) { return m_Channels[channel]; }
+  /* All channels together */
+  mr_recon::SignalStatistics GetTotal();
+
+  /* Writes the statistics of the scan and of every channel as JSON */
+  void WriteJSON(std::ostream& s);
+  bool WriteJSON(std::string filename);
+
+protected:
+  std::vector<mr_recon::SignalStatistics> m_Channels;
+  unsigned long int m_ulProfiles;
+  BrukerRawDataProfile::BrukerDataFormat m_Format;
+};
+
+#endif //BRUKER_SIGNALSTATISTICS_HPP
@@ -0,0 +1,107 @@
+#include "brukerstageprofiler.hpp"
+#include "brukerjson.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <time.h>
+
+BrukerStageProfiler::BrukerStageProfiler(bool enabled)
+  : m_bEnabled(enabled),
+    m_dStartWall(BrukerMonotonicSeconds()),
+    m_dStartCpu(ProcessCpuSeconds()),
+    m_dCpuClockOverhead(0.0)
+{
+  if (!m_bEnabled) return;
+
+  /* The cheapest of a few back to back reads */
+  for (int i = 0; i < 16; i++) {
+    double t0 = ThreadCpuSeconds();
+    double t1 = ThreadCpuSeconds();
+    if (i == 0 || t1 - t0 < m_dCpuClockOverhead) m_dCpuClockOverhead = t1 - t0;
+  }
+}
+
+double BrukerStageProfiler::ThreadCpuSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + 1.0e-9*static_cast<double>(ts.tv_nsec);
+}
+
+double BrukerStageProfiler::ProcessCpuSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + 1.0e-9*static_cast<double>(ts.tv_nsec);
+}
+
+unsigned int BrukerStageProfiler::AddStage(std::string name, unsigned int cpu_sample_interval)
+{
+  Stage s;
+  s.name = name;
+  s.cpu_sample_interval = cpu_sample_interval ? cpu_sample_interval : 1;
+  s.calls = 0;
+  s.sampled_calls = 0;
+  s.bytes = 0;
+  s.wall = 0.0;
+  s.cpu_sampled = 0.0;
+  s.begin_wall = 0.0;
+  s.begin_cpu = 0.0;
+  s.sampling = false;
+  m_Stages.push_back(s);
+  return static_cast<unsigned int>(m_Stages.size() - 1);
+}
+
+void BrukerStageProfiler::SetInfo(std::string key, std::string value)
+{
+  for (size_t i = 0; i < m_Info.size(); i++) {
+    if (m_Info[i].first == key) {
+      m_Info[i].second = value;
+      return;
+    }
+  }
+  m_Info.push_back(std::make_pair(key, value));
+}
+
+double BrukerStageProfiler::GetCpuSeconds(unsigned int stage)
+{
+  const Stage& s = m_Stages[stage];
+  if (s.sampled_calls == 0) return 0.0;
+  return s.cpu_sampled * static_cast<double>(s.calls) / static_cast<double>(s.sampled_calls);
+}
+
+void BrukerStageProfiler::WriteJSON(std::ostream& s)
+{
+  s << "{" << std::endl;
+  for (size_t i = 0; i < m_Info.size(); i++) {
+    s << "  " << BrukerJSONString(m_Info[i].first) << ": " << BrukerJSONString(m_Info[i].second) << "," << std::endl;
+  }
+  s << "  \"wall_seconds\": " << BrukerMonotonicSeconds() - m_dStartWall << "," << std::endl;
+  s << "  \"cpu_seconds\": " << ProcessCpuSeconds() - m_dStartCpu << "," << std::endl;
+  s << "  \"stages\": [" << std::endl;
+  for (size_t i = 0; i < m_Stages.size(); i++) {
+    const Stage& st = m_Stages[i];
+    s << "    {" << std::endl;
+    s << "      \"name\": " << BrukerJSONString(st.name) << "," << std::endl;
+    s << "      \"calls\": " << st.calls << "," << std::endl;
+    s << "      \"wall_seconds\": " << st.wall << "," << std::endl;
+    s << "      \"cpu_seconds\": " << GetCpuSeconds(i) << "," << std::endl;
+    s << "      \"cpu_sampled_calls\": " << st.sampled_calls << "," << std::endl;
+    s << "      \"bytes\": " << st.bytes << "," << std::endl;
+    s << "      \"mb_per_second\": " << (st.wall > 0.0 ? st.bytes/(1024.0*1024.0)/st.wall : 0.0) << std::endl;
+    s << "    }" << (i + 1 < m_Stages.size() ? "," : "") << std::endl;
+  }
+  s << "  ]" << std::endl;
+  s << "}" << std::endl;
+}
+
+bool BrukerStageProfiler::WriteJSON(std::string filename)
+{
+  std::ofstream f(filename.c_str());
+  WriteJSON(f);
+  if (!f) {
+    std::cerr << "BrukerStageProfiler: Unable to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
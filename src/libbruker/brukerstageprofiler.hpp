@@ -0,0 +1,126 @@
+/*****************************************************
+ *
+ *  Per-stage timing of a conversion
+ *
+ *  Accumulates wall time, CPU time, bytes and calls
+ *  for named stages such as parameter parsing, fid
+ *  reads, sample conversion and output, and writes
+ *  the breakdown as JSON.
+ *
+ *  Wall time comes from the monotonic clock on every
+ *  call. Reading the thread CPU clock costs a system
+ *  call, so stages that run once per profile can
+ *  sample it every n-th call instead; their CPU time
+ *  is extrapolated from the sampled calls, after
+ *  subtracting the measured cost of the clock.
+ *
+ *  A disabled profiler does nothing in Begin/End.
+ *  While BrukerTrace is enabled every call of an
+ *  enabled profiler is also a trace event.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_STAGEPROFILER_HPP
+#define BRUKER_STAGEPROFILER_HPP
+
+#include "brukerfidfollower.hpp"
+#include "brukertrace.hpp"
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <utility>
+
+class BrukerStageProfiler
+{
+
+public:
+  BrukerStageProfiler(bool enabled = true);
+
+  bool IsEnabled() { return m_bEnabled; }
+
+  /* Returns the index used in Begin and End */
+  unsigned int AddStage(std::string name, unsigned int cpu_sample_interval = 1);
+
+  void Begin(unsigned int stage)
+  {
+    if (!m_bEnabled) return;
+    Stage& s = m_Stages[stage];
+    s.sampling = (s.calls % s.cpu_sample_interval) == 0;
+    if (s.sampling) s.begin_cpu = ThreadCpuSeconds();
+    s.begin_wall = BrukerMonotonicSeconds();
+  }
+
+  void End(unsigned int stage, unsigned long int bytes = 0)
+  {
+    if (!m_bEnabled) return;
+    Stage& s = m_Stages[stage];
+    double end = BrukerMonotonicSeconds();
+    s.wall += end - s.begin_wall;
+    if (s.sampling) {
+      double cpu = ThreadCpuSeconds() - s.begin_cpu - m_dCpuClockOverhead;
+      if (cpu > 0.0) s.cpu_sampled += cpu;
+      s.sampled_calls++;
+    }
+    s.calls++;
+    s.bytes += bytes;
+    if (BrukerTrace::IsEnabled()) BrukerTrace::Complete(s.name.c_str(), "stage", s.begin_wall, end, bytes);
+  }
+
+  /* Extra key/value pairs for the JSON, e.g. the host and input */
+  void SetInfo(std::string key, std::string value);
+
+  double GetWallSeconds(unsigned int stage) { return m_Stages[stage].wall; }
+  double GetCpuSeconds(unsigned int stage);
+
+  void WriteJSON(std::ostream& s);
+  bool WriteJSON(std::string filename);
+
+  /* Thread and process CPU time in seconds */
+  static double ThreadCpuSeconds();
+  static double ProcessCpuSeconds();
+
+protected:
+  struct Stage {
+    std::string name;
+    unsigned int cpu_sample_interval;
+    unsigned long int calls;
+    unsigned long int sampled_calls;
+    unsigned long int bytes;
+    double wall;
+    double cpu_sampled;
+    double begin_wall;
+    double begin_cpu;
+    bool sampling;
+  };
+
+  bool m_bEnabled;
+  std::vector<Stage> m_Stages;
+  std::vector<std::pair<std::string, std::string> > m_Info;
+  double m_dStartWall;
+  double m_dStartCpu;
+  double m_dCpuClockOverhead;  /* CPU time of reading the thread CPU clock itself */
+};
+
+/* Times a stage for the lifetime of the object */
+class BrukerStageScope
+{
+
+public:
+  BrukerStageScope(BrukerStageProfiler& profiler, unsigned int stage, unsigned long int bytes = 0)
+    : m_Profiler(profiler), m_uiStage(stage), m_ulBytes(bytes)
+  {
+    m_Profiler.Begin(m_uiStage);
+  }
+
+  ~BrukerStageScope() { m_Profiler.End(m_uiStage, m_ulBytes); }
+
+  void SetBytes(unsigned long int bytes) { m_ulBytes = bytes; }
+
+private:
+  BrukerStageProfiler& m_Profiler;
+  unsigned int m_uiStage;
+  unsigned long int m_ulBytes;
+};
+
+#endif //BRUKER_STAGEPROFILER_HPP
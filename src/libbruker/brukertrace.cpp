@@ -0,0 +1,158 @@
+#include "brukertrace.hpp"
+#include "brukerjson.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <string.h>
+#include <unistd.h>
+
+namespace
+{
+  struct TraceEvent {
+    char name[32];
+    const char* category;
+    double begin;
+    double end;
+    unsigned long int bytes;
+  };
+
+  struct ThreadRing {
+    unsigned int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+    unsigned long int written;   /* events ever recorded, the next one goes to written % size */
+  };
+
+  /* Rings are registered once per thread and never freed, a thread that has exited
+     keeps its events in the trace and worker threads may outlive static destruction */
+  std::mutex s_Mutex;
+  std::vector<ThreadRing*> s_Rings;
+  unsigned int s_uiCapacity = 65536;
+  double s_dOrigin = 0.0;
+
+  thread_local ThreadRing* s_pRing = 0;
+
+  ThreadRing* GetRing()
+  {
+    if (s_pRing) return s_pRing;
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    ThreadRing* r = new ThreadRing;
+    r->tid = static_cast<unsigned int>(s_Rings.size()) + 1;
+    r->events.resize(s_uiCapacity);
+    r->written = 0;
+    s_Rings.push_back(r);
+    s_pRing = r;
+    return r;
+  }
+}
+
+std::atomic<bool> BrukerTrace::s_bEnabled(false);
+
+void BrukerTrace::Enable(unsigned int events_per_thread)
+{
+  std::lock_guard<std::mutex> lock(s_Mutex);
+  s_uiCapacity = events_per_thread ? events_per_thread : 1;
+  for (size_t i = 0; i < s_Rings.size(); i++) {
+    s_Rings[i]->events.resize(s_uiCapacity);
+    s_Rings[i]->written = 0;
+  }
+  s_dOrigin = BrukerMonotonicSeconds();
+  s_bEnabled = true;
+}
+
+void BrukerTrace::Disable()
+{
+  s_bEnabled = false;
+}
+
+void BrukerTrace::SetThreadName(const std::string& name)
+{
+  if (!IsEnabled()) return;
+  ThreadRing* r = GetRing();
+  std::lock_guard<std::mutex> lock(s_Mutex);
+  r->name = name;
+}
+
+void BrukerTrace::Complete(const char* name, const char* category, double begin, double end, unsigned long int bytes)
+{
+  if (!IsEnabled()) return;
+  ThreadRing* r = GetRing();
+  TraceEvent& e = r->events[r->written % r->events.size()];
+  strncpy(e.name, name, sizeof(e.name) - 1);
+  e.name[sizeof(e.name) - 1] = '\0';
+  e.category = category;
+  e.begin = begin;
+  e.end = end;
+  e.bytes = bytes;
+  r->written++;
+}
+
+unsigned long int BrukerTrace::GetRecordedEvents()
+{
+  std::lock_guard<std::mutex> lock(s_Mutex);
+  unsigned long int n = 0;
+  for (size_t i = 0; i < s_Rings.size(); i++) n += s_Rings[i]->written;
+  return n;
+}
+
+unsigned long int BrukerTrace::GetDroppedEvents()
+{
+  std::lock_guard<std::mutex> lock(s_Mutex);
+  unsigned long int n = 0;
+  for (size_t i = 0; i < s_Rings.size(); i++) {
+    const ThreadRing* r = s_Rings[i];
+    if (r->written > r->events.size()) n += r->written - r->events.size();
+  }
+  return n;
+}
+
+void BrukerTrace::WriteJSON(std::ostream& s)
+{
+  unsigned long int dropped = GetDroppedEvents();
+  std::lock_guard<std::mutex> lock(s_Mutex);
+  int pid = static_cast<int>(getpid());
+  bool first = true;
+
+  /* Timestamps in microseconds since Enable() */
+  std::ios::fmtflags flags = s.flags();
+  std::streamsize precision = s.precision();
+  s << std::fixed << std::setprecision(3);
+  s << "{\"traceEvents\":[" << std::endl;
+  for (size_t i = 0; i < s_Rings.size(); i++) {
+    const ThreadRing* r = s_Rings[i];
+    if (!r->name.empty()) {
+      s << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << r->tid
+	<< ",\"args\":{\"name\":" << BrukerJSONString(r->name) << "}}";
+      first = false;
+    }
+
+    unsigned long int size = r->events.size();
+    unsigned long int begin = (r->written > size) ? r->written - size : 0;
+    for (unsigned long int n = begin; n < r->written; n++) {
+      const TraceEvent& e = r->events[n % size];
+      s << (first ? "" : ",\n") << "{\"name\":" << BrukerJSONString(e.name) << ",\"cat\":" << BrukerJSONString(e.category)
+	<< ",\"ph\":\"X\",\"ts\":" << (e.begin - s_dOrigin)*1.0e6 << ",\"dur\":" << (e.end - e.begin)*1.0e6
+	<< ",\"pid\":" << pid << ",\"tid\":" << r->tid;
+      if (e.bytes) s << ",\"args\":{\"bytes\":" << e.bytes << "}";
+      s << "}";
+      first = false;
+    }
+  }
+  s << std::endl << "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << dropped << "}}" << std::endl;
+  s.flags(flags);
+  s.precision(precision);
+}
+
+bool BrukerTrace::WriteJSON(std::string filename)
+{
+  std::ofstream f(filename.c_str());
+  WriteJSON(f);
+  if (!f) {
+    std::cerr << "BrukerTrace: Unable to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+/*****************************************************
+ *
+ *  Trace event recording of a conversion
+ *
+ *  Records timed events (parsing, profile list
+ *  generation, fid reads, decode batches, HDF5
+ *  writes) and writes them as Chrome trace_event
+ *  JSON, which chrome://tracing and Perfetto load.
+ *
+ *  Every thread records into its own fixed size ring
+ *  buffer, so recording takes no lock and allocates
+ *  nothing after the first event of a thread. When a
+ *  ring is full the oldest events of that thread are
+ *  overwritten; the trace then holds the most recent
+ *  events and reports how many were dropped.
+ *
+ *  While tracing is disabled an event costs a single
+ *  relaxed load of a flag.
+ *
+ *****************************************************/
+
+#ifndef BRUKER_TRACE_HPP
+#define BRUKER_TRACE_HPP
+
+#include "brukerfidfollower.hpp"
+
+#include <atomic>
+#include <string>
+#include <ostream>
+
+class BrukerTrace
+{
+
+public:
+  /* Starts recording, every thread keeps its last events_per_thread events */
+  static void Enable(unsigned int events_per_thread = 65536);
+  static void Disable();
+
+  static bool IsEnabled() { return s_bEnabled.load(std::memory_order_relaxed); }
+
+  /* Name of the calling thread in the trace viewer, ignored while disabled */
+  static void SetThreadName(const std::string& name);
+
+  /* An event from begin to end, in BrukerMonotonicSeconds(). The name is copied
+     (up to 31 characters), category must be a string literal. */
+  static void Complete(const char* name, const char* category, double begin, double end, unsigned long int bytes = 0);
+
+  /* Events recorded and overwritten so far, over all threads */
+  static unsigned long int GetRecordedEvents();
+  static unsigned long int GetDroppedEvents();
+
+  /* Only call these while no other thread is recording, e.g. after the conversion */
+  static void WriteJSON(std::ostream& s);
+  static bool WriteJSON(std::string filename);
+
+protected:
+  static std::atomic<bool> s_bEnabled;
+};
+
+/* Records an event for the lifetime of the object */
+class BrukerTraceScope
+{
+
+public:
+  BrukerTraceScope(const char* name, const char* category, unsigned long int bytes = 0)
+    : m_pName(name), m_pCategory(category), m_ulBytes(bytes),
+      m_dBegin(BrukerTrace::IsEnabled() ? BrukerMonotonicSeconds() : -1.0)
+  {
+  }
+
+  ~BrukerTraceScope()
+  {
+    if (m_dBegin >= 0.0) BrukerTrace::Complete(m_pName, m_pCategory, m_dBegin, BrukerMonotonicSeconds(), m_ulBytes);
+  }
+
+  void SetBytes(unsigned long int bytes) { m_ulBytes = bytes; }
+
+private:
+  const char* m_pName;
+  const char* m_pCategory;
+  unsigned long int m_ulBytes;
+  double m_dBegin;
+};
+
+#endif //BRUKER_TRACE_HPP
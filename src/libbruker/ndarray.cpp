@@ -1,513 +1,520 @@
-#include "ndarray.hpp"
-
-#include "types.hpp"
-
-#include <vector>
-#include <iostream>
-#include <complex>
-
-using namespace std;
-using namespace mr_recon;
-
-template <class T> NDArray<T>::NDArray ()
-{
-	ndim = 0;
-	dims = 0; data = 0;
-	m_dimensions = new std::vector<int>;
-}
-
-template <class T> NDArray<T>::NDArray (vector<int> *dimensions)
-{
-	m_dimensions = new std::vector<int>;
-	*m_dimensions = *dimensions;
-	dims = 0; data = 0;
-	allocate_memory(dimensions);
-}
-
-template <class T> NDArray<T>::NDArray (int number_of_dimensions, int* dimensions)
-{
-	m_dimensions = new std::vector<int>;
-	for (int i = 0; i < number_of_dimensions; i++) 
-		m_dimensions->push_back(dimensions[i]);
-	dims = 0; data = 0;
-	allocate_memory(m_dimensions);
-}
-
-template <class T> NDArray<T>::NDArray (int dim1)
-{
-	m_dimensions = new std::vector<int>;
-	m_dimensions->push_back(dim1);
-	dims = 0; data = 0;
-	allocate_memory(m_dimensions);
-}
-
-template <class T> NDArray<T>::NDArray (int dim1, int dim2)
-{
-	m_dimensions = new std::vector<int>;
-	m_dimensions->push_back(dim1);
-	m_dimensions->push_back(dim2);
-	dims = 0; data = 0;
-	allocate_memory(m_dimensions);
-}
-
-template <class T> NDArray<T>::NDArray (int dim1, int dim2, int dim3)
-{
-	m_dimensions = new std::vector<int>;
-	m_dimensions->push_back(dim1);
-	m_dimensions->push_back(dim2);
-	m_dimensions->push_back(dim3);
-	dims = 0; data = 0;
-	allocate_memory(m_dimensions);
-}
-
-template <class T> NDArray<T>::NDArray (const NDArray<T>& a)
-{
-	dims = 0; data = 0;
-	m_dimensions = new std::vector<int>;
-	*m_dimensions = *a.m_dimensions;
-	allocate_memory(m_dimensions);
-	for (unsigned int i = 0; i < elements; i++)
-	{
-		data[i] = a.data[i];
-	}
-}
-
-template <class T> NDArray<T>::~NDArray ()
-{
-	deallocate_memory();
-	delete( m_dimensions );
-	m_dimensions = 0x0;
-}
-
-template<class T>  NDArray<T> NDArray<T>::get(vector<int> *lower_limits, vector<int> *upper_limits)
-{
-	if ((lower_limits->size() != upper_limits->size()) || (lower_limits->size() != m_dimensions->size()))
-	{
-		cout << "NDArray: Invalid Index Parameters. To many indices." << endl;
-		cout << "NDArray: Dimensions in array: " << m_dimensions->size() << endl;
-		cout << "NDArray: Dimensions in lower limits: " << lower_limits->size() << endl;
-		cout << "NDArray: Dimensions in upper limits: " << lower_limits->size() << endl;
-
-		return NDArray();
-	}
-
-	vector<int> indexes;
-	vector<int> sizes;
-	vector<int> sub_matrices;
-
-	for (unsigned int i = 0; i < lower_limits->size(); i++)
-	{
-		if ((*lower_limits)[i] > (*upper_limits)[i])
-		{
-			cout << "NDArray: Invalid Index Parameters. Lower limits larger than upper limit." << endl;
-			return NDArray();
-		}
-		if ((*lower_limits)[i] == -1 && (*upper_limits)[i] == -1)
-		{
-			(*lower_limits)[i] = 0; (*upper_limits)[i] = get_size(i)-1;
-		}
-		indexes.push_back((*lower_limits)[i]);
-		sizes.push_back((*upper_limits)[i]-(*lower_limits)[i]+1);
-		if (i == 0)
-		{
-			sub_matrices.push_back(1);
-		}
-		else
-		{
-			sub_matrices.push_back(sub_matrices[i-1]*(*m_dimensions)[i-1]);
-		}
-	}
-
-	NDArray<T> out(&sizes);
-
-	int index_i = 0;
-	int index_o = 0;
-	unsigned int p;
-	for (p = 0; p < indexes.size(); p++) index_i += sub_matrices[p]*indexes[p];
-	while (indexes[indexes.size()-1] <= (*upper_limits)[indexes.size()-1])
-	{
-		out[index_o] = data[index_i];
-
-		indexes[0]++;
-		index_i++;
-		index_o++;
-		unsigned int current_dim = 0;
-		while(indexes[current_dim] > (*upper_limits)[current_dim] && current_dim < indexes.size())
-		{
-			indexes[current_dim] = (*lower_limits)[current_dim];
-			current_dim++;
-			if( current_dim == indexes.size() )
-				break;
-			else
-				indexes[current_dim]++;
-			index_i = 0;
-			for (p = 0; p < indexes.size(); p++) index_i += sub_matrices[p]*indexes[p];
-		}
-		if (current_dim == indexes.size())
-		{
-			break;
-		}
-	}
-	return out;
-}
-
-
-template<class T>  NDArray<T>& NDArray<T>::set(const NDArray<T>& a, vector<int> *lower_limits, vector<int> *upper_limits)
-{
-	if ((lower_limits->size() != upper_limits->size()) || (lower_limits->size() != m_dimensions->size()))
-	{
-		cout << "NDArray: Invalid Index Parameters. To many indices." << endl;
-		cout << "NDArray: Dimensions in array: " << m_dimensions->size() << endl;
-		cout << "NDArray: Dimensions in lower limits: " << lower_limits->size() << endl;
-		cout << "NDArray: Dimensions in upper limits: " << lower_limits->size() << endl;
-		cout << "NDArray: Invalid Index Parameters" << endl;
-		return *this;
-	}
-
-	vector<int> indexes;
-	vector<int> sizes;
-	vector<int> sub_matrices;
-
-	for (unsigned int i = 0; i < lower_limits->size(); i++)
-	{
-		if ((*lower_limits)[i] > (*upper_limits)[i] || (*upper_limits)[i] >= get_size(i) )
-		{
-			cout << "NDArray: Invalid Index Parameters" << endl;
-			return *this;
-		}
-		if ((*lower_limits)[i] == -1 && (*upper_limits)[i] == -1)
-		{
-			(*lower_limits)[i] = 0; (*upper_limits)[i] = get_size(i)-1;
-		}
-		indexes.push_back((*lower_limits)[i]);
-		sizes.push_back((*upper_limits)[i]-(*lower_limits)[i]+1);
-		if (i == 0)
-		{
-			sub_matrices.push_back(1);
-		}
-		else
-		{
-			sub_matrices.push_back(sub_matrices[i-1]*(*m_dimensions)[i-1]);
-		}
-	}
-
-	int index_i = 0;
-	int index_o = 0;
-	unsigned int p;
-	for (p = 0; p < indexes.size(); p++) index_i += sub_matrices[p]*indexes[p];
-	while (indexes[indexes.size()-1] <= (*upper_limits)[indexes.size()-1])
-	{
-		/* CHANGE THIS */
-		data[index_i] = a.data[index_o];
-
-		indexes[0]++;
-		index_i++;
-		index_o++;
-		unsigned int current_dim = 0;
-		while(indexes[current_dim] > (*upper_limits)[current_dim] && current_dim < indexes.size())
-		{
-			indexes[current_dim] = (*lower_limits)[current_dim];
-			current_dim++;
-			if( current_dim == indexes.size() )
-				break;
-			else
-				indexes[current_dim]++;
-			index_i = 0;
-			for (p = 0; p < indexes.size(); p++) index_i += sub_matrices[p]*indexes[p];
-		}
-		if (current_dim == indexes.size())
-		{
-			break;
-		}
-	}
-	return *this;
-}
-
-template <class T> int NDArray<T>::get_number_of_dimensions()
-{
-	return m_dimensions->size();
-}
-
-template <class T> int NDArray<T>::get_size(unsigned int dim)
-{
-	if (dim >= m_dimensions->size())
-	{
-		return 1;
-	}
-	return (*m_dimensions)[dim];
-}
-
-
-template < class T > vector<int>* NDArray<T>::get_dimensions()
-{
-	return m_dimensions;
-}
-
-
-template <class T> unsigned long int NDArray<T>::get_number_of_elements()
-{
-	return elements;
-}
-
-template <class T> T* NDArray<T>::get_data_ptr()
-{
-	return data;
-}
-
-template <class T> T& NDArray<T>::operator[] (int i)
-{
-	if (i < 0 || i >= (int)elements)
-	{
-		cout << "NDArray: Index out of range: i=" << i << ", elements=" << elements << endl;
-		//return data[0];
-	}
-	return data[i];
-}
-
-template <class T> NDArray<T>& NDArray<T>::operator= (const NDArray<T>& a)
-{
-	if (this != &a)
-	{
-		if (*m_dimensions != *a.m_dimensions)
-		{
-			deallocate_memory();
-			delete m_dimensions;
-			m_dimensions = new vector<int>;
-			*m_dimensions = *a.m_dimensions;
-			allocate_memory(m_dimensions);
-		}
-		for (unsigned int i = 0; i < elements; i++) data[i] = a.data[i];
-	}
-	return *this;
-}
-
-template <class T> NDArray<T>& NDArray<T>::operator*= (const T s)
-{
-	for (unsigned int i = 0; i < elements; i++) data[i] *= s;
-	return *this;
-}
-
-template <class T> NDArray<T> NDArray<T>::operator* (const NDArray<T>& a) const
-{
-
-	NDArray<T> out;
-
-	/* This operation is only really well defined if inputs are matrices (or vectors) and dimensions match */
-	if (m_dimensions->size() > 2 || a.m_dimensions->size() > 2)
-	{
-		cout << "Array multiplication only defined for vectors and matrices." << endl;
-		return out;
-	} 
-
-	if ((*m_dimensions)[1] != (*(a.m_dimensions))[0])
-	{
-		cout << "Array dimensions do not match for array multiplication." << endl;
-		return out;
-	}
-
-	int rows = (*m_dimensions)[0];
-	int cols = (*(a.m_dimensions))[1];
-
-	int m = (*m_dimensions)[1];
-
-	out = NDArray<T>(rows,cols);
-
-	for (int i = 0; i < rows; i++)
-	{
-		for (int j = 0; j < cols; j++)
-		{
-
-			for (int k = 0; k < m; k++)
-			{
-				out.data[j*rows + i] += data[k*rows + i]*a.data[j*m + k];
-			} 
-		} 
-	}
-
-	return out;
-}
-
-template <class T> NDArray<T> NDArray<T>::operator* (const T scalar) const
-{
-
-	NDArray<T> out = *this;
-
-	for (unsigned int i=0; i<elements; i++)
-	{
-		data[i] *= scalar;
-	}
-
-	return out;
-}
-
-template <class T>  NDArray<T> NDArray<T>::dot_multiply(const NDArray<T>& a)
-{
-	NDArray<T> out(m_dimensions);
-	if (elements != a.elements)
-	{
-		cout << "Dot multiplication can only be performed on arrays of equal dimensions" << endl;
-		return out;
-	}
-
-	for (unsigned int i = 0; i < elements; i++)
-	{
-		out.data[i] = data[i]*a.data[i];
-	}
-
-	return out;
-}
-
-template <class T>  NDArray<T> NDArray<T>::dot_divide(const NDArray<T>& a)
-{
-	NDArray<T> out(m_dimensions);
-	if (elements != a.elements)
-	{
-		cout << "Dot multiplication can only be performed on arrays of equal dimensions" << endl;
-		return out;
-	}
-
-	for (unsigned int i = 0; i < elements; i++)
-	{
-		out.data[i] = data[i]/a.data[i];
-	}
-
-	return out;
-}
-
-template <class T> void NDArray<T>::flipdim (int dimension)
-{
-	if (dimension > get_number_of_dimensions()-1)
-	{
-		cout << "Error: invalid dimension specified for flipping" << endl;
-		return;
-	}
-
-	long elements_before = 1;
-	for (int i = 0; i < dimension; i++)
-	{
-		elements_before *= get_size(i);
-	}
-
-	long elements_after = 1;
-	for (int i = dimension+1; i < get_number_of_dimensions(); i++)
-	{
-		elements_after *= get_size(i);
-	}
-
-	long dimension_length = get_size(dimension);
-
-	T* temp = NULL; 
-	try
-	{
-		temp = new T[dimension_length];
-	} 
-	catch (...) 
-	{
-		cout << "Unable to allocate memory for flipdim" << endl;
-		return;
-
-	}
-
-	int chunk_size = elements_before*dimension_length;
-	for (int j = 0; j < elements_after; j++)
-	{
-		for (int i = 0; i < elements_before; i++)
-		{
-			for (int k = 0; k < dimension_length; k++)
-			{
-				temp[k] = data[j*chunk_size+i*dimension_length + k];
-			}
-			for (int k = 0; k < dimension_length; k++)
-			{
-				data[j*chunk_size+i*dimension_length + k] = temp[dimension_length-1-k];
-			}
-		}
-	}
-
-	if (temp)
-	{
-		delete [] temp;
-	}
-}
-
-template <class T> int NDArray<T>::reshape (std::vector<int>* dims)
-{
-
-  unsigned long elements_old = 1;
-  for (unsigned int i = 0; i < m_dimensions->size(); i++) {
-    elements_old *= (*m_dimensions)[i];
-  } 
-
-  unsigned long elements_new = 1;
-  for (unsigned int i = 0; i < dims->size(); i++) {
-    elements_new *= (*dims)[i];
-  } 
-
-  if (elements_new != elements_old) {
-    return -1;
-  }
-
-  m_dimensions->clear();
-  for (unsigned int i = 0; i < dims->size(); i++) {
-    m_dimensions->push_back((*dims)[i]);
-  }
-
-  return 0;
-}
-
-template <class T> void NDArray<T>::allocate_memory (vector<int> *dimensions)
-{
-
-	if (dims != 0) delete [] dims;
-	if (data != 0) delete [] data;
-
-	ndim = dimensions->size();
-
-	try
-	{
-		dims = new int[ndim];
-	}
-	catch (bad_alloc&)
-	{
-		cout << "Error allocating memory for dimensions array" << endl;
-	}
-
-	elements = 1;
-	for (int i = 0; i < ndim; i++)
-	{
-		dims[i] = (*dimensions)[i];
-		elements *= dims[i];
-	}
-
-	try
-	{
-		data = new T[elements];
-	}
-	catch (bad_alloc&)
-	{
-		cout << "Error allocating memory for data" << endl;
-	}
-	for (unsigned int i = 0 ; i < elements; i++) data[i] = 0; 
-
-}
-
-template <class T> void NDArray<T>::deallocate_memory ()
-{
-	delete [] dims; dims = 0;
-	delete [] data; data = 0;
-	ndim = 0;
-	elements = 0;
-}
-
-
-/* The declarations below are necessary to make sure that specific functions are included in the library */
-
-template class DLLEXPORT NDArray< complex<double> >;
-template class DLLEXPORT NDArray< complex<float> >;
-template class DLLEXPORT NDArray< double >;
-template class DLLEXPORT NDArray< float >;
-template class DLLEXPORT NDArray< int >;
-template class DLLEXPORT NDArray< unsigned int >;
-template class DLLEXPORT NDArray< unsigned long int >;
-template class DLLEXPORT NDArray< char >;
-
+#include "ndarray.hpp"
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "ndarraykernels.hpp"
+
+#include <vector>
+#include <iostream>
+#include <complex>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <stdlib.h>
+#if defined (WIN32) || defined (_WIN32)
+#include <malloc.h>
+#endif
+
+using namespace std;
+using namespace mr_recon;
+
+template <class T> NDArray<T>::NDArray ()
+	: elements(0), data(0)
+{
+}
+
+template <class T> NDArray<T>::NDArray (vector<int> *dimensions)
+	: m_dimensions(*dimensions), elements(0), data(0)
+{
+	allocate_memory();
+}
+
+template <class T> NDArray<T>::NDArray (int number_of_dimensions, int* dimensions)
+	: m_dimensions(dimensions, dimensions + number_of_dimensions), elements(0), data(0)
+{
+	allocate_memory();
+}
+
+template <class T> NDArray<T>::NDArray (int dim1)
+	: m_dimensions(1, dim1), elements(0), data(0)
+{
+	allocate_memory();
+}
+
+template <class T> NDArray<T>::NDArray (int dim1, int dim2)
+	: elements(0), data(0)
+{
+	m_dimensions.push_back(dim1);
+	m_dimensions.push_back(dim2);
+	allocate_memory();
+}
+
+template <class T> NDArray<T>::NDArray (int dim1, int dim2, int dim3)
+	: elements(0), data(0)
+{
+	m_dimensions.push_back(dim1);
+	m_dimensions.push_back(dim2);
+	m_dimensions.push_back(dim3);
+	allocate_memory();
+}
+
+template <class T> NDArray<T>::NDArray (const NDArray<T>& a)
+	: m_dimensions(a.m_dimensions), elements(0), data(0)
+{
+	allocate_memory();
+	for (unsigned long int i = 0; i < elements; i++)
+	{
+		data[i] = a.data[i];
+	}
+}
+
+template <class T> NDArray<T>::NDArray (NDArray<T>&& a) noexcept
+	: m_dimensions(std::move(a.m_dimensions)), elements(a.elements), data(a.data)
+{
+	a.m_dimensions.clear();
+	a.elements = 0;
+	a.data = 0;
+}
+
+template <class T> NDArray<T>::~NDArray ()
+{
+	deallocate_memory();
+}
+
+/* Copies counts[] elements between two strided arrays, dimension 0 is contiguous in both */
+template <class T> static void copy_strided(const T* src, const long* src_strides, T* dst, const long* dst_strides, const long* counts, int dim)
+{
+	if (dim == 0)
+	{
+		std::copy(src, src + counts[0], dst);
+		return;
+	}
+	for (long i = 0; i < counts[dim]; i++)
+	{
+		copy_strided(src + i*src_strides[dim], src_strides, dst + i*dst_strides[dim], dst_strides, counts, dim-1);
+	}
+}
+
+/* Copies a hyperslab of size counts from src (starting at src_offset) to dst (starting at dst_offset).
+   Dimensions that are contiguous in both arrays are merged so that the innermost copy is as long
+   as possible, and large copies are split across threads along the outermost dimension. */
+template <class T> static void copy_hyperslab(const T* src, const vector<int>& src_dims, const vector<int>& src_offset,
+					       T* dst, const vector<int>& dst_dims, const vector<int>& dst_offset,
+					       const vector<int>& counts)
+{
+	vector<long> cnt, ss, ds;
+	long src_stride = 1, dst_stride = 1;
+	const T* s = src;
+	T* d = dst;
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		s += src_stride*src_offset[i];
+		d += dst_stride*dst_offset[i];
+		if (i == 0 || counts[i] > 1)
+		{
+			if (!cnt.empty() && cnt.back()*ss.back() == src_stride && cnt.back()*ds.back() == dst_stride)
+			{
+				cnt.back() *= counts[i];
+			}
+			else
+			{
+				cnt.push_back(counts[i]);
+				ss.push_back(src_stride);
+				ds.push_back(dst_stride);
+			}
+		}
+		src_stride *= src_dims[i];
+		dst_stride *= dst_dims[i];
+	}
+
+	/* 0-d arrays hold no elements, there is nothing to copy */
+	if (cnt.empty()) return;
+
+	long total = 1;
+	for (size_t i = 0; i < cnt.size(); i++) total *= cnt[i];
+	if (total == 0) return;
+
+	int outer = static_cast<int>(cnt.size()) - 1;
+	long min_chunk = 1;
+	if (outer == 0)
+	{
+		/* One contiguous run, split it in large pieces */
+		min_chunk = NDARRAY_PARALLEL_THRESHOLD;
+	}
+	else
+	{
+		long inner = total / cnt[outer];
+		min_chunk = (NDARRAY_PARALLEL_THRESHOLD + inner - 1) / inner;
+	}
+
+	parallel_for(0, cnt[outer], [&](long first, long last) {
+		if (outer == 0)
+		{
+			std::copy(s + first, s + last, d + first);
+			return;
+		}
+		for (long i = first; i < last; i++)
+		{
+			copy_strided(s + i*ss[outer], &ss[0], d + i*ds[outer], &ds[0], &cnt[0], outer-1);
+		}
+	}, min_chunk);
+}
+
+template<class T>  NDArray<T> NDArray<T>::get(vector<int> *lower_limits, vector<int> *upper_limits)
+{
+	if ((lower_limits->size() != upper_limits->size()) || (lower_limits->size() != m_dimensions.size()))
+	{
+		cout << "NDArray: Invalid Index Parameters. To many indices." << endl;
+		cout << "NDArray: Dimensions in array: " << m_dimensions.size() << endl;
+		cout << "NDArray: Dimensions in lower limits: " << lower_limits->size() << endl;
+		cout << "NDArray: Dimensions in upper limits: " << lower_limits->size() << endl;
+
+		return NDArray();
+	}
+
+	vector<int> sizes;
+	for (unsigned int i = 0; i < lower_limits->size(); i++)
+	{
+		if ((*lower_limits)[i] > (*upper_limits)[i])
+		{
+			cout << "NDArray: Invalid Index Parameters. Lower limits larger than upper limit." << endl;
+			return NDArray();
+		}
+		if ((*lower_limits)[i] == -1 && (*upper_limits)[i] == -1)
+		{
+			(*lower_limits)[i] = 0; (*upper_limits)[i] = get_size(i)-1;
+		}
+		if ((*lower_limits)[i] < 0 || (*upper_limits)[i] >= get_size(i))
+		{
+			cout << "NDArray: Invalid Index Parameters. Limits outside the array." << endl;
+			return NDArray();
+		}
+		sizes.push_back((*upper_limits)[i]-(*lower_limits)[i]+1);
+	}
+
+	NDArray<T> out(&sizes);
+	vector<int> origin(sizes.size(), 0);
+	copy_hyperslab<T>(data, m_dimensions, *lower_limits, out.data, sizes, origin, sizes);
+	return out;
+}
+
+
+template<class T>  NDArray<T>& NDArray<T>::set(const NDArray<T>& a, vector<int> *lower_limits, vector<int> *upper_limits)
+{
+	if ((lower_limits->size() != upper_limits->size()) || (lower_limits->size() != m_dimensions.size()))
+	{
+		cout << "NDArray: Invalid Index Parameters. To many indices." << endl;
+		cout << "NDArray: Dimensions in array: " << m_dimensions.size() << endl;
+		cout << "NDArray: Dimensions in lower limits: " << lower_limits->size() << endl;
+		cout << "NDArray: Dimensions in upper limits: " << lower_limits->size() << endl;
+		cout << "NDArray: Invalid Index Parameters" << endl;
+		return *this;
+	}
+
+	vector<int> sizes;
+	unsigned long int needed = 1;
+	for (unsigned int i = 0; i < lower_limits->size(); i++)
+	{
+		if ((*lower_limits)[i] > (*upper_limits)[i] || (*upper_limits)[i] >= get_size(i) )
+		{
+			cout << "NDArray: Invalid Index Parameters" << endl;
+			return *this;
+		}
+		if ((*lower_limits)[i] == -1 && (*upper_limits)[i] == -1)
+		{
+			(*lower_limits)[i] = 0; (*upper_limits)[i] = get_size(i)-1;
+		}
+		if ((*lower_limits)[i] < 0)
+		{
+			cout << "NDArray: Invalid Index Parameters" << endl;
+			return *this;
+		}
+		sizes.push_back((*upper_limits)[i]-(*lower_limits)[i]+1);
+		needed *= sizes.back();
+	}
+
+	if (a.elements < needed)
+	{
+		cout << "NDArray: Source array too small for the specified range" << endl;
+		return *this;
+	}
+
+	/* The source is read as a contiguous block of the size of the range */
+	vector<int> origin(sizes.size(), 0);
+	copy_hyperslab<T>(a.data, sizes, origin, data, m_dimensions, *lower_limits, sizes);
+	return *this;
+}
+
+template <class T> int NDArray<T>::get_number_of_dimensions()
+{
+	return m_dimensions.size();
+}
+
+template <class T> int NDArray<T>::get_size(unsigned int dim)
+{
+	if (dim >= m_dimensions.size())
+	{
+		return 1;
+	}
+	return m_dimensions[dim];
+}
+
+
+template < class T > vector<int>* NDArray<T>::get_dimensions()
+{
+	return &m_dimensions;
+}
+
+
+template <class T> unsigned long int NDArray<T>::get_number_of_elements()
+{
+	return elements;
+}
+
+template <class T> T* NDArray<T>::get_data_ptr()
+{
+	return data;
+}
+
+template <class T> T& NDArray<T>::operator[] (int i)
+{
+	if (i < 0 || i >= (int)elements)
+	{
+		cout << "NDArray: Index out of range: i=" << i << ", elements=" << elements << endl;
+		//return data[0];
+	}
+	return data[i];
+}
+
+template <class T> NDArray<T>& NDArray<T>::operator= (const NDArray<T>& a)
+{
+	if (this != &a)
+	{
+		if (m_dimensions != a.m_dimensions)
+		{
+			m_dimensions = a.m_dimensions;
+			allocate_memory();
+		}
+		for (unsigned long int i = 0; i < elements; i++) data[i] = a.data[i];
+	}
+	return *this;
+}
+
+template <class T> NDArray<T>& NDArray<T>::operator= (NDArray<T>&& a) noexcept
+{
+	if (this != &a)
+	{
+		deallocate_memory();
+		m_dimensions = std::move(a.m_dimensions);
+		elements = a.elements;
+		data = a.data;
+		a.m_dimensions.clear();
+		a.elements = 0;
+		a.data = 0;
+	}
+	return *this;
+}
+
+template <class T> static void scale_range(T* data, const T& s, long first, long last)
+{
+	for (long i = first; i < last; i++) data[i] *= s;
+}
+
+static void scale_range(complex<float>* data, const complex<float>& s, long first, long last)
+{
+	complex_scale(data + first, s, data + first, last - first);
+}
+
+template <class T> NDArray<T>& NDArray<T>::operator*= (const T s)
+{
+	T* d = data;
+	parallel_for(0, elements, [d, &s](long first, long last) {
+		scale_range(d, s, first, last);
+	}, NDARRAY_PARALLEL_THRESHOLD);
+	return *this;
+}
+
+template <class T> NDArray<T> NDArray<T>::operator* (const T s) const
+{
+	NDArray<T> out = *this;
+	out *= s;
+	return out;
+}
+
+template <class T> NDArray<T> NDArray<T>::operator* (const NDArray<T>& a) const
+{
+
+	NDArray<T> out;
+
+	/* This operation is only really well defined if inputs are matrices (or vectors) and dimensions match */
+	if (m_dimensions.size() > 2 || a.m_dimensions.size() > 2)
+	{
+		cout << "Array multiplication only defined for vectors and matrices." << endl;
+		return out;
+	} 
+
+	if (m_dimensions[1] != a.m_dimensions[0])
+	{
+		cout << "Array dimensions do not match for array multiplication." << endl;
+		return out;
+	}
+
+	int rows = m_dimensions[0];
+	int cols = a.m_dimensions[1];
+
+	int m = m_dimensions[1];
+
+	out = NDArray<T>(rows,cols);
+
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+
+			for (int k = 0; k < m; k++)
+			{
+				out.data[j*rows + i] += data[k*rows + i]*a.data[j*m + k];
+			} 
+		} 
+	}
+
+	return out;
+}
+
+template <class T> void NDArray<T>::flipdim (int dimension)
+{
+	if (dimension < 0 || dimension > get_number_of_dimensions()-1)
+	{
+		cout << "Error: invalid dimension specified for flipping" << endl;
+		return;
+	}
+
+	long elements_before = 1;
+	for (int i = 0; i < dimension; i++)
+	{
+		elements_before *= get_size(i);
+	}
+
+	long elements_after = 1;
+	for (int i = dimension+1; i < get_number_of_dimensions(); i++)
+	{
+		elements_after *= get_size(i);
+	}
+
+	long dimension_length = get_size(dimension);
+	long chunk_size = elements_before*dimension_length;
+	T* d = data;
+
+	if (elements_before == 1)
+	{
+		/* The flipped dimension is contiguous, reverse each run in place */
+		parallel_for(0, elements_after, [d, chunk_size](long first, long last) {
+			for (long j = first; j < last; j++)
+			{
+				std::reverse(d + j*chunk_size, d + (j+1)*chunk_size);
+			}
+		}, (NDARRAY_PARALLEL_THRESHOLD + chunk_size - 1)/chunk_size);
+		return;
+	}
+
+	/* Swap the contiguous rows k and dimension_length-1-k of each chunk, every element is
+	   read and written once and both rows are streamed sequentially */
+	long half = dimension_length/2;
+	parallel_for(0, elements_after*half, [d, elements_before, dimension_length, chunk_size, half](long first, long last) {
+		for (long p = first; p < last; p++)
+		{
+			long j = p / half;
+			long k = p % half;
+			T* lo = d + j*chunk_size + k*elements_before;
+			T* hi = d + j*chunk_size + (dimension_length-1-k)*elements_before;
+			std::swap_ranges(lo, lo + elements_before, hi);
+		}
+	}, (NDARRAY_PARALLEL_THRESHOLD + elements_before - 1)/elements_before);
+}
+
+template <class T> int NDArray<T>::reshape (std::vector<int>* dims)
+{
+
+  unsigned long elements_old = 1;
+  for (unsigned int i = 0; i < m_dimensions.size(); i++) {
+    elements_old *= m_dimensions[i];
+  } 
+
+  unsigned long elements_new = 1;
+  for (unsigned int i = 0; i < dims->size(); i++) {
+    elements_new *= (*dims)[i];
+  } 
+
+  if (elements_new != elements_old) {
+    return -1;
+  }
+
+  m_dimensions.clear();
+  for (unsigned int i = 0; i < dims->size(); i++) {
+    m_dimensions.push_back((*dims)[i]);
+  }
+
+  return 0;
+}
+
+template <class T> void NDArray<T>::allocate_memory ()
+{
+	deallocate_memory();
+
+	unsigned long int n = 1;
+	for (size_t i = 0; i < m_dimensions.size(); i++)
+	{
+		n *= m_dimensions[i];
+	}
+	if (m_dimensions.empty() || n == 0)
+	{
+		return;
+	}
+
+	void* p = 0;
+	size_t bytes = n*sizeof(T);
+	/* aligned_alloc wants a multiple of the alignment */
+	bytes = ((bytes + NDARRAY_ALIGNMENT - 1) / NDARRAY_ALIGNMENT) * NDARRAY_ALIGNMENT;
+#if defined (WIN32) || defined (_WIN32)
+	p = _aligned_malloc(bytes, NDARRAY_ALIGNMENT);
+#else
+	if (posix_memalign(&p, NDARRAY_ALIGNMENT, bytes) != 0) p = 0;
+#endif
+	if (!p)
+	{
+		cout << "Error allocating memory for data" << endl;
+		return;
+	}
+
+	data = static_cast<T*>(p);
+	elements = n;
+	for (unsigned long int i = 0 ; i < elements; i++) new (data + i) T(0);
+}
+
+template <class T> void NDArray<T>::deallocate_memory ()
+{
+	if (data)
+	{
+		for (unsigned long int i = 0; i < elements; i++) data[i].~T();
+#if defined (WIN32) || defined (_WIN32)
+		_aligned_free(data);
+#else
+		free(data);
+#endif
+	}
+	data = 0;
+	elements = 0;
+}
+
+
+/* The declarations below are necessary to make sure that specific functions are included in the library */
+
+template class DLLEXPORT NDArray< complex<double> >;
+template class DLLEXPORT NDArray< complex<float> >;
+template class DLLEXPORT NDArray< double >;
+template class DLLEXPORT NDArray< float >;
+template class DLLEXPORT NDArray< int >;
+template class DLLEXPORT NDArray< unsigned int >;
+template class DLLEXPORT NDArray< unsigned long int >;
+template class DLLEXPORT NDArray< char >;
+
@@ -1,74 +1,153 @@
-#ifndef _NDARRAY_HPP_
-#define _NDARRAY_HPP_
-
-#include "export.h"
-
-#ifdef CUDA
-
-namespace std{
-#if defined (WIN32) || defined (_WIN32)
-	template<class _Ty> class allocator;
-	template<class _Ty, class _Ax = allocator<_Ty> > class vector;
-#else
-	template<typename _Tp> class allocator;
-	template<typename _Tp, typename _Alloc = allocator<_Tp> > class vector;
-#endif
-}
-
-#else // !CUDA
-
-#include <vector>
-
-#endif
-
-namespace mr_recon
-{
-	template <class T> class DLLEXPORT NDArray
-	{
-
-	public:
-		NDArray ();
-		NDArray(int number_of_dimensions, int* dimensions);
-		NDArray(std::vector<int> *dimensions);
-		NDArray(int dim1);
-		NDArray(int dim1, int dim2);
-		NDArray(int dim1, int dim2, int dim3);
-
-		NDArray(const NDArray<T>& a);
-		~NDArray();
-
-		T& operator[] (int i);
-		NDArray<T>& operator=(const NDArray<T> &a);
-		NDArray<T> operator*(const NDArray<T> &a) const;
-		NDArray<T> operator*(const T a) const;
-		NDArray<T>& operator*=(const T s);
-
-		NDArray<T> dot_multiply(const NDArray<T> &a);
-		NDArray<T> dot_divide(const NDArray<T> &a);
-
-		int get_number_of_dimensions();
-		int get_size(unsigned int dimension);
-		std::vector<int>* get_dimensions();
-		unsigned long int get_number_of_elements();
-
-		NDArray<T> get(std::vector<int> *lower_limits, std::vector<int> *upper_limits);
-		NDArray<T>& set(const NDArray<T> &a, std::vector<int> *lower_limits, std::vector<int> *upper_limits);
-
-		void flipdim (int dimension);
-	        int reshape (std::vector<int>* dims);
-
-		T* get_data_ptr();
-
-	private:
-		std::vector<int> *m_dimensions;
-		int ndim;
-		unsigned long int elements;
-		int* dims;
-		T* data;
-
-		void allocate_memory(std::vector<int> *dimensions);
-		void deallocate_memory();
-	};
-}
-
-#endif //NDARRAY_HPP
+#ifndef _NDARRAY_HPP_
+#define _NDARRAY_HPP_
+
+#include "export.h"
+#include "ndarrayexpression.hpp"
+#include "ndarraykernels.hpp"
+#include "parallel.hpp"
+
+#include <vector>
+#include <iostream>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+/* Alignment of the array storage, one cache line and a full AVX-512 register */
+#define NDARRAY_ALIGNMENT 64
+
+/* Element-wise operations on fewer elements than this stay on the calling thread */
+#define NDARRAY_PARALLEL_THRESHOLD 65536
+
+namespace mr_recon
+{
+	template <class T> class DLLEXPORT NDArray : public NDArrayExpression< NDArray<T> >
+	{
+
+	public:
+		typedef T value_type;
+
+		NDArray ();
+		NDArray(int number_of_dimensions, int* dimensions);
+		NDArray(std::vector<int> *dimensions);
+		NDArray(int dim1);
+		NDArray(int dim1, int dim2);
+		NDArray(int dim1, int dim2, int dim3);
+
+		NDArray(const NDArray<T>& a);
+		NDArray(NDArray<T>&& a) noexcept;
+		template <class E> NDArray(const NDArrayExpression<E>& e);
+		~NDArray();
+
+		T& operator[] (int i);
+		NDArray<T>& operator=(const NDArray<T> &a);
+		NDArray<T>& operator=(NDArray<T> &&a) noexcept;
+		template <class E> NDArray<T>& operator=(const NDArrayExpression<E>& e);
+		NDArray<T> operator*(const NDArray<T> &a) const;
+		NDArray<T> operator*(const T s) const;
+		NDArray<T>& operator*=(const T s);
+
+		NDArray<T> dot_multiply(const NDArray<T> &a) const { return NDArray<T>(elementwise_multiply(*this, a)); }
+		NDArray<T> dot_divide(const NDArray<T> &a) const { return NDArray<T>(elementwise_divide(*this, a)); }
+
+		/* elementwise_multiply, elementwise_divide, sums and scaled expressions (see
+		   ndarrayexpression.hpp) are evaluated lazily when assigned to an array. */
+
+		/* Interface used by the expression templates */
+		T eval(unsigned long int i) const { return data[i]; }
+		unsigned long int size() const { return elements; }
+		const std::vector<int>& dimensions() const { return m_dimensions; }
+		bool valid() const { return true; }
+		template <class A> bool depends_on(const A* a) const { return static_cast<const void*>(a) == static_cast<const void*>(this); }
+
+		int get_number_of_dimensions();
+		int get_size(unsigned int dimension);
+		std::vector<int>* get_dimensions();
+		unsigned long int get_number_of_elements();
+
+		NDArray<T> get(std::vector<int> *lower_limits, std::vector<int> *upper_limits);
+		NDArray<T>& set(const NDArray<T> &a, std::vector<int> *lower_limits, std::vector<int> *upper_limits);
+
+		void flipdim (int dimension);
+	        int reshape (std::vector<int>* dims);
+
+		T* get_data_ptr();
+		const T* get_data_ptr() const { return data; }
+
+	private:
+		std::vector<int> m_dimensions;
+		unsigned long int elements;
+		T* data;
+
+		void allocate_memory();
+		void deallocate_memory();
+
+		template <class E> void evaluate(const E& e);
+	};
+
+	/* Evaluates elements [first, last) of an expression, overloaded for the expressions that have kernels */
+	template <class T, class E> inline void evaluate_range(T* out, const E& e, long first, long last)
+	{
+		for (long i = first; i < last; i++)
+		{
+			out[i] = e.eval(i);
+		}
+	}
+
+	typedef NDArray< std::complex<float> > NDArrayComplexFloat;
+
+	inline void evaluate_range(std::complex<float>* out, const NDArrayBinaryExpression<NDArrayComplexFloat, NDArrayComplexFloat, NDArrayMultiply>& e, long first, long last)
+	{
+		complex_multiply(e.left().get_data_ptr() + first, e.right().get_data_ptr() + first, out + first, last - first);
+	}
+
+	inline void evaluate_range(std::complex<float>* out, const NDArrayBinaryExpression<NDArrayComplexFloat, NDArrayComplexFloat, NDArrayDivide>& e, long first, long last)
+	{
+		complex_divide(e.left().get_data_ptr() + first, e.right().get_data_ptr() + first, out + first, last - first);
+	}
+
+	inline void evaluate_range(std::complex<float>* out, const NDArrayScalarExpression<NDArrayComplexFloat, NDArrayMultiply>& e, long first, long last)
+	{
+		complex_scale(e.expression().get_data_ptr() + first, e.scalar(), out + first, last - first);
+	}
+
+	template <class T> template <class E> NDArray<T>::NDArray(const NDArrayExpression<E>& e)
+		: elements(0), data(0)
+	{
+		/* Operands of different sizes leave the array empty */
+		*this = e;
+	}
+
+	template <class T> template <class E> NDArray<T>& NDArray<T>::operator=(const NDArrayExpression<E>& e)
+	{
+		const E& x = e.derived();
+		if (!x.valid())
+		{
+			std::cerr << "NDArray: Element-wise operations can only be performed on arrays of equal dimensions" << std::endl;
+			return *this;
+		}
+		if (m_dimensions != x.dimensions())
+		{
+			if (x.depends_on(this))
+			{
+				/* Reallocating would free an operand, evaluate into a new array first */
+				NDArray<T> out(x);
+				return *this = std::move(out);
+			}
+			m_dimensions = x.dimensions();
+			allocate_memory();
+		}
+		evaluate(x);
+		return *this;
+	}
+
+	template <class T> template <class E> void NDArray<T>::evaluate(const E& e)
+	{
+		/* One pass over memory for the whole expression, split across threads for large arrays */
+		T* out = data;
+		parallel_for(0, static_cast<long>(elements), [out, &e](long first, long last) {
+			evaluate_range(out, e, first, last);
+		}, NDARRAY_PARALLEL_THRESHOLD);
+	}
+}
+
+#endif //NDARRAY_HPP
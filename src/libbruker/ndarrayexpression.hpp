@@ -0,0 +1,157 @@
+#ifndef _NDARRAY_EXPRESSION_HPP_
+#define _NDARRAY_EXPRESSION_HPP_
+
+#include <vector>
+#include <complex>
+
+/*
+  Expression templates for the element-wise NDArray operations.
+
+  elementwise_multiply, elementwise_divide, +, - and scaling of an expression
+  return lightweight expression objects instead of arrays. Nothing is computed
+  until the expression is assigned to an NDArray, which then evaluates all
+  operations in a single loop without temporaries, e.g.
+
+     ComplexFloatArray c = elementwise_multiply(a, b) * s + a;
+
+  NDArray::dot_multiply, dot_divide and operator*(T) still return arrays.
+
+  Expressions keep references to the arrays they were built from, so they should
+  not be stored (e.g. with auto) beyond the statement that creates them.
+*/
+
+namespace mr_recon
+{
+	template <class T> class NDArray;
+
+	template <class E> class NDArrayExpression;
+	template <class L, class R, class Op> class NDArrayBinaryExpression;
+	template <class E, class Op> class NDArrayScalarExpression;
+
+	struct NDArrayAdd      { template <class A, class B> static A apply(const A& a, const B& b) { return a + b; } };
+	struct NDArraySubtract { template <class A, class B> static A apply(const A& a, const B& b) { return a - b; } };
+
+	/* Complex float uses the plain formulas of the kernels in ndarraykernels.hpp */
+	struct NDArrayMultiply
+	{
+		template <class A, class B> static A apply(const A& a, const B& b) { return a * b; }
+		static std::complex<float> apply(const std::complex<float>& a, const std::complex<float>& b)
+		{
+			return std::complex<float>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+		}
+	};
+
+	struct NDArrayDivide
+	{
+		template <class A, class B> static A apply(const A& a, const B& b) { return a / b; }
+		static std::complex<float> apply(const std::complex<float>& a, const std::complex<float>& b)
+		{
+			float den = b.real()*b.real() + b.imag()*b.imag();
+			return std::complex<float>((a.real()*b.real() + a.imag()*b.imag())/den, (a.imag()*b.real() - a.real()*b.imag())/den);
+		}
+	};
+
+	/* Arrays are held by reference inside an expression, (small) sub expressions by value */
+	template <class E> struct NDArrayOperand { typedef const E type; };
+	template <class T> struct NDArrayOperand< NDArray<T> > { typedef const NDArray<T>& type; };
+
+	template <class E> class NDArrayExpression
+	{
+	public:
+		const E& derived() const { return static_cast<const E&>(*this); }
+	};
+
+	template <class L, class R, class Op> class NDArrayBinaryExpression
+		: public NDArrayExpression< NDArrayBinaryExpression<L, R, Op> >
+	{
+	public:
+		typedef typename L::value_type value_type;
+
+		NDArrayBinaryExpression(const L& l, const R& r)
+			: m_left(l), m_right(r)
+		{
+		}
+
+		value_type eval(unsigned long int i) const { return Op::apply(m_left.eval(i), m_right.eval(i)); }
+		unsigned long int size() const { return m_left.size(); }
+		const std::vector<int>& dimensions() const { return m_left.dimensions(); }
+		bool valid() const { return m_left.valid() && m_right.valid() && m_left.size() == m_right.size(); }
+		template <class A> bool depends_on(const A* a) const { return m_left.depends_on(a) || m_right.depends_on(a); }
+
+		const L& left() const { return m_left; }
+		const R& right() const { return m_right; }
+
+	private:
+		typename NDArrayOperand<L>::type m_left;
+		typename NDArrayOperand<R>::type m_right;
+	};
+
+	template <class E, class Op> class NDArrayScalarExpression
+		: public NDArrayExpression< NDArrayScalarExpression<E, Op> >
+	{
+	public:
+		typedef typename E::value_type value_type;
+
+		NDArrayScalarExpression(const E& e, const value_type& s)
+			: m_expression(e), m_scalar(s)
+		{
+		}
+
+		value_type eval(unsigned long int i) const { return Op::apply(m_expression.eval(i), m_scalar); }
+		unsigned long int size() const { return m_expression.size(); }
+		const std::vector<int>& dimensions() const { return m_expression.dimensions(); }
+		bool valid() const { return m_expression.valid(); }
+		template <class A> bool depends_on(const A* a) const { return m_expression.depends_on(a); }
+
+		const E& expression() const { return m_expression; }
+		const value_type& scalar() const { return m_scalar; }
+
+	private:
+		typename NDArrayOperand<E>::type m_expression;
+		value_type m_scalar;
+	};
+
+	template <class L, class R> NDArrayBinaryExpression<L, R, NDArrayMultiply>
+	elementwise_multiply(const NDArrayExpression<L>& l, const NDArrayExpression<R>& r)
+	{
+		return NDArrayBinaryExpression<L, R, NDArrayMultiply>(l.derived(), r.derived());
+	}
+
+	template <class L, class R> NDArrayBinaryExpression<L, R, NDArrayDivide>
+	elementwise_divide(const NDArrayExpression<L>& l, const NDArrayExpression<R>& r)
+	{
+		return NDArrayBinaryExpression<L, R, NDArrayDivide>(l.derived(), r.derived());
+	}
+
+	template <class L, class R> NDArrayBinaryExpression<L, R, NDArrayAdd>
+	operator+(const NDArrayExpression<L>& l, const NDArrayExpression<R>& r)
+	{
+		return NDArrayBinaryExpression<L, R, NDArrayAdd>(l.derived(), r.derived());
+	}
+
+	template <class L, class R> NDArrayBinaryExpression<L, R, NDArraySubtract>
+	operator-(const NDArrayExpression<L>& l, const NDArrayExpression<R>& r)
+	{
+		return NDArrayBinaryExpression<L, R, NDArraySubtract>(l.derived(), r.derived());
+	}
+
+	template <class E> NDArrayScalarExpression<E, NDArrayMultiply>
+	operator*(const NDArrayExpression<E>& e, const typename E::value_type& s)
+	{
+		return NDArrayScalarExpression<E, NDArrayMultiply>(e.derived(), s);
+	}
+
+	template <class E> NDArrayScalarExpression<E, NDArrayMultiply>
+	operator*(const typename E::value_type& s, const NDArrayExpression<E>& e)
+	{
+		return NDArrayScalarExpression<E, NDArrayMultiply>(e.derived(), s);
+	}
+
+	template <class E> NDArrayScalarExpression<E, NDArrayDivide>
+	operator/(const NDArrayExpression<E>& e, const typename E::value_type& s)
+	{
+		return NDArrayScalarExpression<E, NDArrayDivide>(e.derived(), s);
+	}
+}
+
+#endif //_NDARRAY_EXPRESSION_HPP_
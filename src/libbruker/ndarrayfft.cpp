@@ -0,0 +1,167 @@
+#include "ndarrayfft.hpp"
+#include "ndarraykernels.hpp"
+#include "parallel.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+using namespace std;
+
+namespace mr_recon
+{
+	typedef complex<float> cfloat;
+
+	/* M_PI is not part of standard C++ */
+	static const double FFT_PI = 3.14159265358979323846;
+
+	static vector<unsigned long int> fft_factors(unsigned long int n)
+	{
+		vector<unsigned long int> factors;
+		while (n % 4 == 0) { factors.push_back(4); n /= 4; }
+		while (n % 2 == 0) { factors.push_back(2); n /= 2; }
+		for (unsigned long int p = 3; p*p <= n; p += 2)
+		{
+			while (n % p == 0) { factors.push_back(p); n /= p; }
+		}
+		if (n > 1) factors.push_back(n);
+		return factors;
+	}
+
+	/* (-i)*a for the forward, i*a for the inverse transform */
+	static inline cfloat rotate(const cfloat& a, bool inverse)
+	{
+		return inverse ? cfloat(-a.imag(), a.real()) : cfloat(a.imag(), -a.real());
+	}
+
+	/*
+	  One Stockham stage of radix r for the current length l = r*m at stride s,
+	  y[q + s*(r*p + k)] = w_l^(p*k) * sum_j x[q + s*(p + j*m)] * w_r^(j*k)
+	  table holds the n roots of unity w_n^j of the full transform.
+	*/
+	static void fft_stage(const cfloat* x, cfloat* y, unsigned long int r, unsigned long int m, unsigned long int s,
+			      const vector<cfloat>& table, unsigned long int n, bool inverse)
+	{
+		unsigned long int l = r*m;
+		unsigned long int step = n / l;
+
+		for (unsigned long int p = 0; p < m; p++)
+		{
+			cfloat* out = y + s*r*p;
+
+			if (r == 2)
+			{
+				const cfloat* a = x + s*p;
+				const cfloat* b = x + s*(p + m);
+				for (unsigned long int q = 0; q < s; q++)
+				{
+					out[q] = a[q] + b[q];
+					out[s + q] = a[q] - b[q];
+				}
+			}
+			else if (r == 4)
+			{
+				const cfloat* t0 = x + s*p;
+				const cfloat* t1 = x + s*(p + m);
+				const cfloat* t2 = x + s*(p + 2*m);
+				const cfloat* t3 = x + s*(p + 3*m);
+				for (unsigned long int q = 0; q < s; q++)
+				{
+					cfloat a0 = t0[q] + t2[q];
+					cfloat a1 = t0[q] - t2[q];
+					cfloat b0 = t1[q] + t3[q];
+					cfloat b1 = rotate(t1[q] - t3[q], inverse);
+					out[q] = a0 + b0;
+					out[s + q] = a1 + b1;
+					out[2*s + q] = a0 - b0;
+					out[3*s + q] = a1 - b1;
+				}
+			}
+			else
+			{
+				/* Direct DFT of r points, w_r^(j*k) is w_n^(j*k*n/r) */
+				for (unsigned long int k = 0; k < r; k++)
+				{
+					cfloat* o = out + s*k;
+					const cfloat* t = x + s*p;
+					for (unsigned long int q = 0; q < s; q++) o[q] = t[q];
+					for (unsigned long int j = 1; j < r; j++)
+					{
+						cfloat w = table[((j*k) % r) * (n / r)];
+						t = x + s*(p + j*m);
+						for (unsigned long int q = 0; q < s; q++)
+						{
+							o[q] += cfloat(t[q].real()*w.real() - t[q].imag()*w.imag(), t[q].real()*w.imag() + t[q].imag()*w.real());
+						}
+					}
+				}
+			}
+
+			for (unsigned long int k = 1; k < r && p > 0; k++)
+			{
+				complex_scale(out + s*k, table[(p*k*step) % n], out + s*k, s);
+			}
+		}
+	}
+
+	static void fft_transform(cfloat* data, cfloat* scratch, unsigned long int n, unsigned long int inner,
+				  const vector<unsigned long int>& factors, const vector<cfloat>& table, bool inverse)
+	{
+		cfloat* x = data;
+		cfloat* y = scratch;
+		unsigned long int l = n;
+		unsigned long int s = inner;
+		for (size_t f = 0; f < factors.size(); f++)
+		{
+			unsigned long int r = factors[f];
+			fft_stage(x, y, r, l / r, s, table, n, inverse);
+			std::swap(x, y);
+			l /= r;
+			s *= r;
+		}
+		if (x != data) std::copy(x, x + n*inner, data);
+		if (inverse) complex_scale(data, cfloat(1.0f/n, 0.0f), data, n*inner);
+	}
+
+	void fft(cfloat* data, unsigned long int n, unsigned long int inner, unsigned long int outer, bool inverse)
+	{
+		if (!data || n < 2 || inner == 0) return;
+
+		vector<unsigned long int> factors = fft_factors(n);
+		vector<cfloat> table(n);
+		double sign = inverse ? 1.0 : -1.0;
+		for (unsigned long int j = 0; j < n; j++)
+		{
+			double phi = sign*2.0*FFT_PI*j/n;
+			table[j] = cfloat(static_cast<float>(cos(phi)), static_cast<float>(sin(phi)));
+		}
+
+		unsigned long int block = n*inner;
+		parallel_for(0, outer, [&](long first, long last) {
+				vector<cfloat> scratch(block);
+				for (long b = first; b < last; b++)
+				{
+					fft_transform(data + b*block, &scratch[0], n, inner, factors, table, inverse);
+				}
+			}, max(1L, static_cast<long>(NDARRAY_PARALLEL_THRESHOLD / block)));
+	}
+
+	void fft(ComplexFloatArray& a, unsigned int dimension, bool inverse)
+	{
+		if (dimension >= static_cast<unsigned int>(a.get_number_of_dimensions()))
+		{
+			std::cerr << "fft: Invalid dimension " << dimension << std::endl;
+			return;
+		}
+
+		unsigned long int inner = 1;
+		unsigned long int outer = 1;
+		for (unsigned int i = 0; i < static_cast<unsigned int>(a.get_number_of_dimensions()); i++)
+		{
+			if (i < dimension) inner *= a.get_size(i);
+			if (i > dimension) outer *= a.get_size(i);
+		}
+		fft(a.get_data_ptr(), a.get_size(dimension), inner, outer, inverse);
+	}
+}
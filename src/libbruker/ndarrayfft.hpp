@@ -0,0 +1,31 @@
+#ifndef _NDARRAY_FFT_HPP_
+#define _NDARRAY_FFT_HPP_
+
+#include "export.h"
+#include "types.hpp"
+
+#include <complex>
+
+namespace mr_recon
+{
+	/*
+	  Self-contained complex float FFT for quick reconstructions, e.g. previews.
+
+	  A Stockham autosort FFT, so no bit reversal pass is needed. The transform sizes are factored
+	  into radix 4, 2, 3 and 5 butterflies, other prime factors use a direct DFT butterfly. The
+	  butterflies run over contiguous runs of the interleaved transforms, the twiddles are applied
+	  with the vectorized complex_scale kernel.
+
+	  The forward transform is unnormalized, the inverse is scaled by 1/n. There are no shifts,
+	  element 0 is the zero frequency.
+	*/
+
+	/* outer blocks of inner interleaved transforms of length n, element j of transform i of block b is
+	   data[b*n*inner + j*inner + i] */
+	DLLEXPORT void fft(std::complex<float>* data, unsigned long int n, unsigned long int inner, unsigned long int outer, bool inverse = false);
+
+	/* Transforms one dimension of an array for all indices of the other dimensions */
+	DLLEXPORT void fft(ComplexFloatArray& a, unsigned int dimension, bool inverse = false);
+}
+
+#endif //_NDARRAY_FFT_HPP_
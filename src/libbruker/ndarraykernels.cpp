@@ -0,0 +1,541 @@
+#include "ndarraykernels.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+
+#if defined (__AVX__)
+#include <immintrin.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace mr_recon
+{
+#if defined (__AVX__)
+	/* Four complex numbers per register */
+	static const unsigned long int VECTOR_LENGTH = 4;
+
+	static inline __m256 vector_multiply(__m256 a, __m256 b)
+	{
+		__m256 b_re = _mm256_moveldup_ps(b);
+		__m256 b_im = _mm256_movehdup_ps(b);
+		__m256 a_swap = _mm256_permute_ps(a, 0xB1);
+		return _mm256_addsub_ps(_mm256_mul_ps(a, b_re), _mm256_mul_ps(a_swap, b_im));
+	}
+
+	static inline __m256 vector_divide(__m256 a, __m256 b)
+	{
+		__m256 b_re = _mm256_moveldup_ps(b);
+		__m256 b_im = _mm256_movehdup_ps(b);
+		__m256 a_swap = _mm256_permute_ps(a, 0xB1);
+		/* a*conj(b) */
+		__m256 t = _mm256_xor_ps(_mm256_mul_ps(a_swap, b_im), _mm256_set1_ps(-0.0f));
+		__m256 num = _mm256_addsub_ps(_mm256_mul_ps(a, b_re), t);
+		__m256 sq = _mm256_mul_ps(b, b);
+		__m256 den = _mm256_add_ps(sq, _mm256_permute_ps(sq, 0xB1));
+		return _mm256_div_ps(num, den);
+	}
+
+	static inline __m256 vector_load(const complex<float>* p) { return _mm256_loadu_ps(reinterpret_cast<const float*>(p)); }
+	static inline __m256 vector_broadcast(complex<float> s) { return _mm256_setr_ps(s.real(), s.imag(), s.real(), s.imag(), s.real(), s.imag(), s.real(), s.imag()); }
+	static inline void vector_store(complex<float>* p, __m256 v) { _mm256_storeu_ps(reinterpret_cast<float*>(p), v); }
+	typedef __m256 vector_type;
+#define NDARRAY_VECTORIZED
+#elif defined (__SSE2__)
+	/* Two complex numbers per register */
+	static const unsigned long int VECTOR_LENGTH = 2;
+
+	/* Flips the sign of the real parts */
+	static inline __m128 negate_real(__m128 a)
+	{
+		return _mm_xor_ps(a, _mm_castsi128_ps(_mm_set_epi32(0, static_cast<int>(0x80000000), 0, static_cast<int>(0x80000000))));
+	}
+
+	static inline __m128 vector_multiply(__m128 a, __m128 b)
+	{
+		__m128 b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 a_swap = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+		return _mm_add_ps(_mm_mul_ps(a, b_re), negate_real(_mm_mul_ps(a_swap, b_im)));
+	}
+
+	static inline __m128 vector_divide(__m128 a, __m128 b)
+	{
+		__m128 b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 a_swap = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+		/* a*conj(b), the imaginary parts get the minus sign */
+		__m128 t = _mm_xor_ps(negate_real(_mm_mul_ps(a_swap, b_im)), _mm_set1_ps(-0.0f));
+		__m128 num = _mm_add_ps(_mm_mul_ps(a, b_re), t);
+		__m128 sq = _mm_mul_ps(b, b);
+		__m128 den = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_div_ps(num, den);
+	}
+
+	static inline __m128 vector_load(const complex<float>* p) { return _mm_loadu_ps(reinterpret_cast<const float*>(p)); }
+	static inline __m128 vector_broadcast(complex<float> s) { return _mm_setr_ps(s.real(), s.imag(), s.real(), s.imag()); }
+	static inline void vector_store(complex<float>* p, __m128 v) { _mm_storeu_ps(reinterpret_cast<float*>(p), v); }
+	typedef __m128 vector_type;
+#define NDARRAY_VECTORIZED
+#endif
+
+	static inline complex<float> scalar_multiply(const complex<float>& a, const complex<float>& b)
+	{
+		return complex<float>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+	}
+
+	static inline complex<float> scalar_divide(const complex<float>& a, const complex<float>& b)
+	{
+		float den = b.real()*b.real() + b.imag()*b.imag();
+		return complex<float>((a.real()*b.real() + a.imag()*b.imag())/den, (a.imag()*b.real() - a.real()*b.imag())/den);
+	}
+
+	void complex_multiply(const complex<float>* a, const complex<float>* b, complex<float>* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#ifdef NDARRAY_VECTORIZED
+		for (; i + VECTOR_LENGTH <= n; i += VECTOR_LENGTH)
+		{
+			vector_store(out + i, vector_multiply(vector_load(a + i), vector_load(b + i)));
+		}
+#endif
+		for (; i < n; i++) out[i] = scalar_multiply(a[i], b[i]);
+	}
+
+	void complex_divide(const complex<float>* a, const complex<float>* b, complex<float>* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#ifdef NDARRAY_VECTORIZED
+		for (; i + VECTOR_LENGTH <= n; i += VECTOR_LENGTH)
+		{
+			vector_store(out + i, vector_divide(vector_load(a + i), vector_load(b + i)));
+		}
+#endif
+		for (; i < n; i++) out[i] = scalar_divide(a[i], b[i]);
+	}
+
+	void complex_scale(const complex<float>* a, complex<float> s, complex<float>* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#ifdef NDARRAY_VECTORIZED
+		vector_type v = vector_broadcast(s);
+		for (; i + VECTOR_LENGTH <= n; i += VECTOR_LENGTH)
+		{
+			vector_store(out + i, vector_multiply(vector_load(a + i), v));
+		}
+#endif
+		for (; i < n; i++) out[i] = scalar_multiply(a[i], s);
+	}
+
+	float max_abs(const float* a, unsigned long int n)
+	{
+		unsigned long int i = 0;
+		float m = 0.0f;
+#if defined (__AVX__)
+		__m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		__m256 vm = _mm256_setzero_ps();
+		for (; i + 8 <= n; i += 8)
+		{
+			vm = _mm256_max_ps(vm, _mm256_and_ps(_mm256_loadu_ps(a + i), abs_mask));
+		}
+		float lanes[8];
+		_mm256_storeu_ps(lanes, vm);
+		for (int l = 0; l < 8; l++) if (lanes[l] > m) m = lanes[l];
+#elif defined (__SSE2__)
+		__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 vm = _mm_setzero_ps();
+		for (; i + 4 <= n; i += 4)
+		{
+			vm = _mm_max_ps(vm, _mm_and_ps(_mm_loadu_ps(a + i), abs_mask));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, vm);
+		for (int l = 0; l < 4; l++) if (lanes[l] > m) m = lanes[l];
+#endif
+		for (; i < n; i++) if (fabsf(a[i]) > m) m = fabsf(a[i]);
+		return m;
+	}
+
+	/* Largest float that converts to T, for int 2^31 - 128 as 2^31 - 1 is not a float */
+	template <class T> static inline float quantize_upper() { return static_cast<float>(std::numeric_limits<T>::max()); }
+	template <> inline float quantize_upper<int>() { return 2147483520.0f; }
+
+	template <class T> static inline T quantize_scalar(float v)
+	{
+		if (v >= quantize_upper<T>()) return static_cast<T>(quantize_upper<T>());
+		if (v <= static_cast<float>(std::numeric_limits<T>::min())) return std::numeric_limits<T>::min();
+		return static_cast<T>(lrintf(v));
+	}
+
+	void quantize(const float* a, float scale, short* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#if defined (__SSE2__)
+		__m128 s = _mm_set1_ps(scale);
+		for (; i + 8 <= n; i += 8)
+		{
+			/* cvtps rounds to nearest, packs saturates to 16 bits */
+			__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(a + i), s));
+			__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(a + i + 4), s));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+		}
+#endif
+		for (; i < n; i++) out[i] = quantize_scalar<short>(scale*a[i]);
+	}
+
+	void quantize(const float* a, float scale, int* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#if defined (__SSE2__)
+		/* Values beyond the int range convert to INT_MIN, so the input is clamped first */
+		__m128 s = _mm_set1_ps(scale);
+		__m128 upper = _mm_set1_ps(quantize_upper<int>());
+		__m128 lower = _mm_set1_ps(-2147483648.0f);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(a + i), s), lower), upper);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtps_epi32(v));
+		}
+#endif
+		for (; i < n; i++) out[i] = quantize_scalar<int>(scale*a[i]);
+	}
+
+#if defined (__SSE2__)
+	/* Vector accumulators for convert_with_statistics, four floats (two complex samples) per step */
+	struct VectorStatistics
+	{
+		VectorStatistics()
+			: sum(_mm_setzero_ps()), energy(_mm_setzero_ps()), max_power(_mm_setzero_ps()), clipped(_mm_setzero_si128())
+		{
+		}
+
+		inline void add(__m128 v, float* out)
+		{
+			_mm_storeu_ps(out, v);
+			sum = _mm_add_ps(sum, v);
+			__m128 sq = _mm_mul_ps(v, v);
+			energy = _mm_add_ps(energy, sq);
+			/* |z|^2 in both lanes of each complex sample */
+			max_power = _mm_max_ps(max_power, _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1))));
+		}
+
+		inline void add(__m128i v, __m128i lower, __m128i upper, float* out)
+		{
+			/* Matching lanes are all ones, i.e. -1 */
+			__m128i rail = _mm_or_si128(_mm_cmpeq_epi32(v, lower), _mm_cmpeq_epi32(v, upper));
+			clipped = _mm_sub_epi32(clipped, rail);
+			add(_mm_cvtepi32_ps(v), out);
+		}
+
+		void reduce(SignalStatistics& s, float& max_power_out, unsigned long int n)
+		{
+			float f[4];
+			int c[4];
+			_mm_storeu_ps(f, sum);
+			s.sum_real += static_cast<double>(f[0]) + f[2];
+			s.sum_imag += static_cast<double>(f[1]) + f[3];
+			_mm_storeu_ps(f, energy);
+			s.energy += static_cast<double>(f[0]) + f[1] + f[2] + f[3];
+			_mm_storeu_ps(f, max_power);
+			for (int l = 0; l < 4; l++) if (f[l] > max_power_out) max_power_out = f[l];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(c), clipped);
+			s.clipped += static_cast<unsigned int>(c[0]) + static_cast<unsigned int>(c[1]) + static_cast<unsigned int>(c[2]) + static_cast<unsigned int>(c[3]);
+			s.samples += n;
+		}
+
+		__m128 sum;
+		__m128 energy;
+		__m128 max_power;
+		__m128i clipped;
+	};
+#endif
+
+	/* stride is the distance of consecutive input samples in complex samples, the output is contiguous */
+	template <class T> static void statistics_scalar(const T* a, float* out, unsigned long int first, unsigned long int n,
+						       bool check_rails, SignalStatistics& s, float& max_power, unsigned int stride = 1)
+	{
+		for (unsigned long int i = first; i < n; i++)
+		{
+			T x = a[2*i*stride];
+			T y = a[2*i*stride + 1];
+			float re = static_cast<float>(x);
+			float im = static_cast<float>(y);
+			out[2*i] = re;
+			out[2*i+1] = im;
+			s.sum_real += re;
+			s.sum_imag += im;
+			float power = re*re + im*im;
+			s.energy += power;
+			if (power > max_power) max_power = power;
+			if (check_rails)
+			{
+				if (x == std::numeric_limits<T>::max() || x == std::numeric_limits<T>::min()) s.clipped++;
+				if (y == std::numeric_limits<T>::max() || y == std::numeric_limits<T>::min()) s.clipped++;
+			}
+		}
+		if (n > first) s.samples += n - first;
+	}
+
+	static inline void finish_statistics(SignalStatistics& s, float max_power)
+	{
+		float m = sqrtf(max_power);
+		if (m > s.max_magnitude) s.max_magnitude = m;
+	}
+
+	void convert_with_statistics(const short* a, float* out, unsigned long int n, SignalStatistics& s)
+	{
+		unsigned long int i = 0;
+		float max_power = 0.0f;
+#if defined (__SSE2__)
+		VectorStatistics v;
+		__m128i lower = _mm_set1_epi32(std::numeric_limits<short>::min());
+		__m128i upper = _mm_set1_epi32(std::numeric_limits<short>::max());
+		for (; i + 2 <= n; i += 2)
+		{
+			/* Sign extends four shorts to ints */
+			__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + 2*i));
+			v.add(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16), lower, upper, out + 2*i);
+		}
+		v.reduce(s, max_power, i);
+#endif
+		statistics_scalar(a, out, i, n, true, s, max_power);
+		finish_statistics(s, max_power);
+	}
+
+	void convert_with_statistics(const int* a, float* out, unsigned long int n, SignalStatistics& s)
+	{
+		unsigned long int i = 0;
+		float max_power = 0.0f;
+#if defined (__SSE2__)
+		VectorStatistics v;
+		__m128i lower = _mm_set1_epi32(std::numeric_limits<int>::min());
+		__m128i upper = _mm_set1_epi32(std::numeric_limits<int>::max());
+		for (; i + 2 <= n; i += 2)
+		{
+			v.add(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2*i)), lower, upper, out + 2*i);
+		}
+		v.reduce(s, max_power, i);
+#endif
+		statistics_scalar(a, out, i, n, true, s, max_power);
+		finish_statistics(s, max_power);
+	}
+
+	void convert_with_statistics(const float* a, float* out, unsigned long int n, SignalStatistics& s)
+	{
+		unsigned long int i = 0;
+		float max_power = 0.0f;
+#if defined (__SSE2__)
+		VectorStatistics v;
+		for (; i + 2 <= n; i += 2)
+		{
+			v.add(_mm_loadu_ps(a + 2*i), out + 2*i);
+		}
+		v.reduce(s, max_power, i);
+#endif
+		statistics_scalar(a, out, i, n, false, s, max_power);
+		finish_statistics(s, max_power);
+	}
+
+	void convert(const short* a, float* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#if defined (__SSE2__)
+		for (; i + 4 <= n; i += 4)
+		{
+			/* Sign extends eight shorts to ints */
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2*i));
+			_mm_storeu_ps(out + 2*i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+			_mm_storeu_ps(out + 2*i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)));
+		}
+#endif
+		for (i *= 2; i < 2*n; i++) out[i] = a[i];
+	}
+
+	void convert(const int* a, float* out, unsigned long int n)
+	{
+		unsigned long int i = 0;
+#if defined (__SSE2__)
+		for (; i + 2 <= n; i += 2)
+		{
+			_mm_storeu_ps(out + 2*i, _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2*i))));
+		}
+#endif
+		for (i *= 2; i < 2*n; i++) out[i] = static_cast<float>(a[i]);
+	}
+
+	void convert(const float* a, float* out, unsigned long int n)
+	{
+		if (a != out) memcpy(out, a, n*2*sizeof(float));
+	}
+
+#if defined (__SSE2__)
+	/* Two complex samples as floats */
+	static inline __m128d load_complex_pair(const short* a)
+	{
+		__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a));
+		return _mm_castps_pd(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+	}
+
+	static inline __m128d load_complex_pair(const int* a)
+	{
+		return _mm_castps_pd(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a))));
+	}
+
+	static inline __m128d load_complex_pair(const float* a)
+	{
+		return _mm_castps_pd(_mm_loadu_ps(a));
+	}
+#endif
+
+	template <class T> static void deinterleave_scalar(const T* a, float* out, unsigned long int first, unsigned long int last,
+							 unsigned long int samples, unsigned int first_channel, unsigned int channels)
+	{
+		for (unsigned long int s = first; s < last; s++)
+		{
+			for (unsigned int c = first_channel; c < channels; c++)
+			{
+				out[2*(c*samples + s)] = static_cast<float>(a[2*(s*channels + c)]);
+				out[2*(c*samples + s) + 1] = static_cast<float>(a[2*(s*channels + c) + 1]);
+			}
+		}
+	}
+
+	/* Transposes 2x2 tiles of complex samples, two samples of two channels at a time. Each
+	   complex float is one 64 bit lane, so the tile transpose is a pair of unpacks. */
+	template <class T> static void deinterleave(const T* a, float* out, unsigned long int samples, unsigned int channels)
+	{
+		if (channels <= 1)
+		{
+			convert(a, out, samples);
+			return;
+		}
+		unsigned long int s = 0;
+#if defined (__SSE2__)
+		unsigned int even = channels & ~1U;
+		for (; s + 2 <= samples; s += 2)
+		{
+			const T* row0 = a + 2*s*channels;
+			const T* row1 = row0 + 2*channels;
+			for (unsigned int c = 0; c < even; c += 2)
+			{
+				__m128d r0 = load_complex_pair(row0 + 2*c);
+				__m128d r1 = load_complex_pair(row1 + 2*c);
+				_mm_storeu_pd(reinterpret_cast<double*>(out + 2*(c*samples + s)), _mm_unpacklo_pd(r0, r1));
+				_mm_storeu_pd(reinterpret_cast<double*>(out + 2*((c + 1)*samples + s)), _mm_unpackhi_pd(r0, r1));
+			}
+		}
+		/* An odd last channel */
+		if (even < channels) deinterleave_scalar(a, out, 0, s, samples, even, channels);
+#endif
+		deinterleave_scalar(a, out, s, samples, samples, 0, channels);
+	}
+
+	void deinterleave_channels(const short* a, float* out, unsigned long int samples, unsigned int channels)
+	{
+		deinterleave(a, out, samples, channels);
+	}
+
+	void deinterleave_channels(const int* a, float* out, unsigned long int samples, unsigned int channels)
+	{
+		deinterleave(a, out, samples, channels);
+	}
+
+	void deinterleave_channels(const float* a, float* out, unsigned long int samples, unsigned int channels)
+	{
+		deinterleave(a, out, samples, channels);
+	}
+
+#if defined (__SSE2__)
+	/* Two samples of channels c and c+1 from rows s and s+1, split by channel into the statistics */
+	static inline void deinterleave_pair_statistics(const short* row0, const short* row1, float* out0, float* out1,
+							VectorStatistics& v0, VectorStatistics& v1)
+	{
+		__m128i lower = _mm_set1_epi32(std::numeric_limits<short>::min());
+		__m128i upper = _mm_set1_epi32(std::numeric_limits<short>::max());
+		__m128i x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row0));
+		__m128i x1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row1));
+		x0 = _mm_srai_epi32(_mm_unpacklo_epi16(x0, x0), 16);
+		x1 = _mm_srai_epi32(_mm_unpacklo_epi16(x1, x1), 16);
+		v0.add(_mm_unpacklo_epi64(x0, x1), lower, upper, out0);
+		v1.add(_mm_unpackhi_epi64(x0, x1), lower, upper, out1);
+	}
+
+	static inline void deinterleave_pair_statistics(const int* row0, const int* row1, float* out0, float* out1,
+							VectorStatistics& v0, VectorStatistics& v1)
+	{
+		__m128i lower = _mm_set1_epi32(std::numeric_limits<int>::min());
+		__m128i upper = _mm_set1_epi32(std::numeric_limits<int>::max());
+		__m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0));
+		__m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1));
+		v0.add(_mm_unpacklo_epi64(x0, x1), lower, upper, out0);
+		v1.add(_mm_unpackhi_epi64(x0, x1), lower, upper, out1);
+	}
+
+	static inline void deinterleave_pair_statistics(const float* row0, const float* row1, float* out0, float* out1,
+							VectorStatistics& v0, VectorStatistics& v1)
+	{
+		__m128 x0 = _mm_loadu_ps(row0);
+		__m128 x1 = _mm_loadu_ps(row1);
+		v0.add(_mm_movelh_ps(x0, x1), out0);
+		v1.add(_mm_movehl_ps(x1, x0), out1);
+	}
+#endif
+
+	/* Works through the channels in pairs, so that only two sets of accumulators are live and the
+	   raw values can be checked against the rails before they are converted */
+	template <class T> static void deinterleave_statistics(const T* a, float* out, unsigned long int samples, unsigned int channels,
+								bool check_rails, SignalStatistics* s)
+	{
+		if (channels <= 1)
+		{
+			convert_with_statistics(a, out, samples, s[0]);
+			return;
+		}
+		unsigned int c = 0;
+#if defined (__SSE2__)
+		for (; c + 2 <= channels; c += 2)
+		{
+			VectorStatistics v0, v1;
+			float* out0 = out + 2*c*samples;
+			float* out1 = out0 + 2*samples;
+			unsigned long int i = 0;
+			for (; i + 2 <= samples; i += 2)
+			{
+				const T* row0 = a + 2*(i*channels + c);
+				deinterleave_pair_statistics(row0, row0 + 2*channels, out0 + 2*i, out1 + 2*i, v0, v1);
+			}
+			float max0 = 0.0f, max1 = 0.0f;
+			v0.reduce(s[c], max0, i);
+			v1.reduce(s[c + 1], max1, i);
+			statistics_scalar(a + 2*c, out0, i, samples, check_rails, s[c], max0, channels);
+			statistics_scalar(a + 2*(c + 1), out1, i, samples, check_rails, s[c + 1], max1, channels);
+			finish_statistics(s[c], max0);
+			finish_statistics(s[c + 1], max1);
+		}
+#endif
+		for (; c < channels; c++)
+		{
+			float max_power = 0.0f;
+			statistics_scalar(a + 2*c, out + 2*c*samples, 0, samples, check_rails, s[c], max_power, channels);
+			finish_statistics(s[c], max_power);
+		}
+	}
+
+	void deinterleave_with_statistics(const short* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s)
+	{
+		deinterleave_statistics(a, out, samples, channels, true, s);
+	}
+
+	void deinterleave_with_statistics(const int* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s)
+	{
+		deinterleave_statistics(a, out, samples, channels, true, s);
+	}
+
+	void deinterleave_with_statistics(const float* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s)
+	{
+		deinterleave_statistics(a, out, samples, channels, false, s);
+	}
+}
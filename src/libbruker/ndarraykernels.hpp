@@ -0,0 +1,72 @@
+#ifndef _NDARRAY_KERNELS_HPP_
+#define _NDARRAY_KERNELS_HPP_
+
+#include "export.h"
+
+#include <complex>
+
+namespace mr_recon
+{
+	/* Element-wise complex float kernels on interleaved data. These use the textbook formulas,
+	   without the overflow and NaN handling of std::complex, and are vectorized with SSE2 or AVX
+	   when the compiler targets them. out may be the same as either input. */
+	DLLEXPORT void complex_multiply(const std::complex<float>* a, const std::complex<float>* b, std::complex<float>* out, unsigned long int n);
+	DLLEXPORT void complex_divide(const std::complex<float>* a, const std::complex<float>* b, std::complex<float>* out, unsigned long int n);
+	DLLEXPORT void complex_scale(const std::complex<float>* a, std::complex<float> s, std::complex<float>* out, unsigned long int n);
+
+	/* Largest absolute value of n floats, NaNs are ignored */
+	DLLEXPORT float max_abs(const float* a, unsigned long int n);
+
+	/* out = round(scale*a), rounding to nearest and saturating at the limits of the output type;
+	   int saturates at 2147483520, the largest float below 2^31 */
+	DLLEXPORT void quantize(const float* a, float scale, short* out, unsigned long int n);
+	DLLEXPORT void quantize(const float* a, float scale, int* out, unsigned long int n);
+
+	/* Running statistics of complex samples, sums are kept in double so that whole scans can be added up */
+	struct DLLEXPORT SignalStatistics
+	{
+		SignalStatistics() : samples(0), clipped(0), max_magnitude(0.0f), sum_real(0.0), sum_imag(0.0), energy(0.0) {}
+
+		void add(const SignalStatistics& s)
+		{
+			samples += s.samples;
+			clipped += s.clipped;
+			if (s.max_magnitude > max_magnitude) max_magnitude = s.max_magnitude;
+			sum_real += s.sum_real;
+			sum_imag += s.sum_imag;
+			energy += s.energy;
+		}
+
+		unsigned long int samples;  /* complex samples */
+		unsigned long int clipped;  /* real or imaginary values at the limits of the input type */
+		float max_magnitude;
+		double sum_real;
+		double sum_imag;
+		double energy;              /* sum of squared magnitudes */
+	};
+
+	/* Converts n interleaved complex samples to float and adds them to the statistics in the same pass.
+	   For the integer types, values equal to the smallest or largest value of the type count as clipped.
+	   out may be the same as a for float input. */
+	DLLEXPORT void convert_with_statistics(const short* a, float* out, unsigned long int n, SignalStatistics& s);
+	DLLEXPORT void convert_with_statistics(const int* a, float* out, unsigned long int n, SignalStatistics& s);
+	DLLEXPORT void convert_with_statistics(const float* a, float* out, unsigned long int n, SignalStatistics& s);
+
+	/* Converts n interleaved complex samples to float */
+	DLLEXPORT void convert(const short* a, float* out, unsigned long int n);
+	DLLEXPORT void convert(const int* a, float* out, unsigned long int n);
+	DLLEXPORT void convert(const float* a, float* out, unsigned long int n);
+
+	/* Converts complex samples stored with the channel running fastest, [channels, samples], to float
+	   with the samples of each channel contiguous, [samples, channels] as ISMRMRD stores them */
+	DLLEXPORT void deinterleave_channels(const short* a, float* out, unsigned long int samples, unsigned int channels);
+	DLLEXPORT void deinterleave_channels(const int* a, float* out, unsigned long int samples, unsigned int channels);
+	DLLEXPORT void deinterleave_channels(const float* a, float* out, unsigned long int samples, unsigned int channels);
+
+	/* As deinterleave_channels, adding the samples of channel c to s[c] in the same pass */
+	DLLEXPORT void deinterleave_with_statistics(const short* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s);
+	DLLEXPORT void deinterleave_with_statistics(const int* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s);
+	DLLEXPORT void deinterleave_with_statistics(const float* a, float* out, unsigned long int samples, unsigned int channels, SignalStatistics* s);
+}
+
+#endif //_NDARRAY_KERNELS_HPP_
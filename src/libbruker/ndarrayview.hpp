@@ -0,0 +1,208 @@
+#ifndef _NDARRAY_VIEW_HPP_
+#define _NDARRAY_VIEW_HPP_
+
+#include "ndarray.hpp"
+
+#include <vector>
+#include <iostream>
+
+namespace mr_recon
+{
+	/*
+	  Non-owning strided view of an array. A view is a pointer, a shape and a stride
+	  (in elements) per dimension, with the first dimension varying fastest as in NDArray.
+	  Slicing, permuting and reshaping return new views of the same memory, nothing is
+	  copied until copy() is called. The memory must outlive the view.
+	*/
+	template <class T> class NDArrayView
+	{
+
+	public:
+		NDArrayView()
+			: m_data(0)
+		{
+		}
+
+		/* Contiguous buffer with the given dimensions */
+		NDArrayView(T* data, const std::vector<int>& dimensions)
+			: m_data(data), m_dimensions(dimensions)
+		{
+			long stride = 1;
+			for (size_t i = 0; i < m_dimensions.size(); i++)
+			{
+				m_strides.push_back(stride);
+				stride *= m_dimensions[i];
+			}
+		}
+
+		NDArrayView(T* data, const std::vector<int>& dimensions, const std::vector<long>& strides)
+			: m_data(data), m_dimensions(dimensions), m_strides(strides)
+		{
+		}
+
+		NDArrayView(NDArray<T>& a)
+		{
+			*this = NDArrayView<T>(a.get_data_ptr(), *a.get_dimensions());
+		}
+
+		/* The payload of an ISMRMRD::Acquisition (or anything with the same accessors) as [samples, channels] */
+		template <class Acquisition> static NDArrayView<T> from_acquisition(Acquisition& acq)
+		{
+			std::vector<int> dims(2);
+			dims[0] = acq.number_of_samples();
+			dims[1] = acq.active_channels();
+			return NDArrayView<T>(acq.getDataPtr(), dims);
+		}
+
+		int get_number_of_dimensions() const { return static_cast<int>(m_dimensions.size()); }
+		int get_size(unsigned int dimension) const { return dimension < m_dimensions.size() ? m_dimensions[dimension] : 1; }
+		long get_stride(unsigned int dimension) const { return dimension < m_strides.size() ? m_strides[dimension] : 0; }
+		const std::vector<int>& get_dimensions() const { return m_dimensions; }
+		T* get_data_ptr() const { return m_data; }
+
+		unsigned long int get_number_of_elements() const
+		{
+			if (!m_data) return 0;
+			unsigned long int n = 1;
+			for (size_t i = 0; i < m_dimensions.size(); i++) n *= m_dimensions[i];
+			return n;
+		}
+
+		/* True if the elements are laid out like an NDArray of the same dimensions */
+		bool is_contiguous() const
+		{
+			long stride = 1;
+			for (size_t i = 0; i < m_dimensions.size(); i++)
+			{
+				if (m_dimensions[i] > 1 && m_strides[i] != stride) return false;
+				stride *= m_dimensions[i];
+			}
+			return true;
+		}
+
+		T& operator()(int i0, int i1 = 0, int i2 = 0, int i3 = 0, int i4 = 0) const
+		{
+			return m_data[i0*get_stride(0) + i1*get_stride(1) + i2*get_stride(2) + i3*get_stride(3) + i4*get_stride(4)];
+		}
+
+		T& operator()(const std::vector<int>& index) const
+		{
+			long offset = 0;
+			for (size_t i = 0; i < index.size() && i < m_strides.size(); i++) offset += index[i]*m_strides[i];
+			return m_data[offset];
+		}
+
+		/* Elements first to last (inclusive) of one dimension, the dimension is kept */
+		NDArrayView<T> slice(unsigned int dimension, int first, int last) const
+		{
+			if (dimension >= m_dimensions.size() || first < 0 || last < first || last >= m_dimensions[dimension])
+			{
+				std::cout << "NDArrayView: Invalid slice " << first << ":" << last << " of dimension " << dimension << std::endl;
+				return NDArrayView<T>();
+			}
+			NDArrayView<T> out(*this);
+			out.m_data += first*m_strides[dimension];
+			out.m_dimensions[dimension] = last - first + 1;
+			return out;
+		}
+
+		/* Same limits as NDArray::get, -1,-1 selects the whole dimension */
+		NDArrayView<T> slice(const std::vector<int>& lower_limits, const std::vector<int>& upper_limits) const
+		{
+			if (lower_limits.size() != m_dimensions.size() || upper_limits.size() != m_dimensions.size())
+			{
+				std::cout << "NDArrayView: Invalid Index Parameters. Wrong number of indices." << std::endl;
+				return NDArrayView<T>();
+			}
+			NDArrayView<T> out(*this);
+			for (unsigned int i = 0; i < m_dimensions.size() && out.m_data; i++)
+			{
+				if (lower_limits[i] == -1 && upper_limits[i] == -1) continue;
+				out = out.slice(i, lower_limits[i], upper_limits[i]);
+			}
+			return out;
+		}
+
+		/* A single index of one dimension, the dimension is removed */
+		NDArrayView<T> select(unsigned int dimension, int index) const
+		{
+			NDArrayView<T> out = slice(dimension, index, index);
+			if (out.m_data)
+			{
+				out.m_dimensions.erase(out.m_dimensions.begin() + dimension);
+				out.m_strides.erase(out.m_strides.begin() + dimension);
+			}
+			return out;
+		}
+
+		/* Dimension i of the result is dimension order[i] of this view */
+		NDArrayView<T> permute(const std::vector<int>& order) const
+		{
+			std::vector<bool> used(m_dimensions.size(), false);
+			bool ok = order.size() == m_dimensions.size();
+			for (size_t i = 0; ok && i < order.size(); i++)
+			{
+				ok = order[i] >= 0 && order[i] < static_cast<int>(m_dimensions.size()) && !used[order[i]];
+				if (ok) used[order[i]] = true;
+			}
+			if (!ok)
+			{
+				std::cout << "NDArrayView: Invalid permutation" << std::endl;
+				return NDArrayView<T>();
+			}
+
+			NDArrayView<T> out(*this);
+			for (size_t i = 0; i < order.size(); i++)
+			{
+				out.m_dimensions[i] = m_dimensions[order[i]];
+				out.m_strides[i] = m_strides[order[i]];
+			}
+			return out;
+		}
+
+		/* New dimensions with the same number of elements, only possible for contiguous views */
+		NDArrayView<T> reshape(const std::vector<int>& dimensions) const
+		{
+			unsigned long int n = 1;
+			for (size_t i = 0; i < dimensions.size(); i++) n *= dimensions[i];
+			if (n != get_number_of_elements() || !is_contiguous())
+			{
+				std::cout << "NDArrayView: Cannot reshape, element count differs or view is not contiguous" << std::endl;
+				return NDArrayView<T>();
+			}
+			return NDArrayView<T>(m_data, dimensions);
+		}
+
+		/* Copies the view into a new contiguous array */
+		NDArray<T> copy() const
+		{
+			std::vector<int> dims(m_dimensions);
+			NDArray<T> out(&dims);
+			T* dst = out.get_data_ptr();
+			if (!m_data || !dst) return out;
+
+			std::vector<int> index(m_dimensions.size(), 0);
+			unsigned long int n = get_number_of_elements();
+			int n0 = get_size(0);
+			long s0 = get_stride(0);
+			for (unsigned long int i = 0; i < n; i += n0)
+			{
+				const T* src = &(*this)(index);
+				for (int j = 0; j < n0; j++) dst[i+j] = src[j*s0];
+				for (size_t d = 1; d < index.size(); d++)
+				{
+					if (++index[d] < m_dimensions[d]) break;
+					index[d] = 0;
+				}
+			}
+			return out;
+		}
+
+	private:
+		T* m_data;
+		std::vector<int> m_dimensions;
+		std::vector<long> m_strides;
+	};
+}
+
+#endif //_NDARRAY_VIEW_HPP_
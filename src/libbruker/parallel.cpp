@@ -0,0 +1,169 @@
+#include "parallel.hpp"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#if !defined (WIN32) && !defined (_WIN32)
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace mr_recon
+{
+	static atomic<unsigned int> s_number_of_threads(0);
+
+	/* Set on pool threads, parallel_for called from inside a job runs serially */
+	static thread_local bool s_pool_thread = false;
+
+	/*
+	  Worker threads are started on first use and kept for the lifetime of the process.
+	  One job runs at a time, the calling thread and the workers pull chunks of the range
+	  from a shared counter until it is exhausted.
+	*/
+	class ThreadPool
+	{
+	public:
+		ThreadPool()
+			: m_stop(false), m_generation(0), m_participants(0), m_running(0), m_fn(0), m_end(0), m_chunk(1)
+		{
+#if !defined (WIN32) && !defined (_WIN32)
+			m_pid = getpid();
+#endif
+		}
+
+		~ThreadPool()
+		{
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_work.notify_all();
+			for (size_t i = 0; i < m_workers.size(); i++) m_workers[i].join();
+		}
+
+		/* Worker threads do not survive fork(), a child process runs everything serially */
+		bool usable()
+		{
+#if !defined (WIN32) && !defined (_WIN32)
+			return m_pid == getpid();
+#else
+			return true;
+#endif
+		}
+
+		void run(long begin, long end, long chunk, unsigned int threads, const function<void(long, long)>& fn)
+		{
+			lock_guard<mutex> job_lock(m_job_mutex);
+			{
+				lock_guard<mutex> lock(m_mutex);
+				while (m_workers.size() + 1 < threads)
+				{
+					m_workers.push_back(thread(&ThreadPool::worker, this, static_cast<unsigned int>(m_workers.size()), m_generation));
+				}
+				m_fn = &fn;
+				m_next = begin;
+				m_end = end;
+				m_chunk = chunk;
+				m_participants = threads - 1;
+				m_running = threads - 1;
+				m_generation++;
+			}
+			m_work.notify_all();
+
+			s_pool_thread = true;
+			execute();
+			s_pool_thread = false;
+
+			unique_lock<mutex> lock(m_mutex);
+			while (m_running > 0) m_done.wait(lock);
+			m_fn = 0;
+		}
+
+	private:
+		void execute()
+		{
+			long first;
+			while ((first = m_next.fetch_add(m_chunk)) < m_end)
+			{
+				(*m_fn)(first, first + m_chunk < m_end ? first + m_chunk : m_end);
+			}
+		}
+
+		void worker(unsigned int index, unsigned int generation)
+		{
+			s_pool_thread = true;
+			unique_lock<mutex> lock(m_mutex);
+			while (true)
+			{
+				while (!m_stop && m_generation == generation) m_work.wait(lock);
+				if (m_stop) return;
+				generation = m_generation;
+				if (index >= m_participants) continue;
+
+				lock.unlock();
+				execute();
+				lock.lock();
+				if (--m_running == 0) m_done.notify_one();
+			}
+		}
+
+		vector<thread> m_workers;
+		mutex m_job_mutex;
+		mutex m_mutex;
+		condition_variable m_work;
+		condition_variable m_done;
+		bool m_stop;
+		unsigned int m_generation;
+		unsigned int m_participants;
+		unsigned int m_running;
+
+		const function<void(long, long)>* m_fn;
+		atomic<long> m_next;
+		long m_end;
+		long m_chunk;
+#if !defined (WIN32) && !defined (_WIN32)
+		pid_t m_pid;
+#endif
+	};
+
+	static ThreadPool& get_thread_pool()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void set_number_of_threads(unsigned int n)
+	{
+		s_number_of_threads = n;
+	}
+
+	unsigned int get_number_of_threads()
+	{
+		unsigned int n = s_number_of_threads;
+		if (n == 0) n = thread::hardware_concurrency();
+		return (n == 0) ? 1 : n;
+	}
+
+	void parallel_for(long begin, long end, const function<void(long, long)>& fn, long min_chunk)
+	{
+		long n = end - begin;
+		if (n <= 0) return;
+		if (min_chunk < 1) min_chunk = 1;
+
+		long threads = get_number_of_threads();
+		if (threads > n / min_chunk) threads = n / min_chunk;
+		if (threads <= 1 || s_pool_thread || !get_thread_pool().usable())
+		{
+			fn(begin, end);
+			return;
+		}
+
+		/* A few chunks per thread so that uneven chunks balance out */
+		long chunk = (n + 4*threads - 1) / (4*threads);
+		if (chunk < min_chunk) chunk = min_chunk;
+		get_thread_pool().run(begin, end, chunk, static_cast<unsigned int>(threads), fn);
+	}
+}
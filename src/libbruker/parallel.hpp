@@ -0,0 +1,20 @@
+#ifndef _PARALLEL_HPP_
+#define _PARALLEL_HPP_
+
+#include "export.h"
+
+#include <functional>
+
+namespace mr_recon
+{
+	/* Number of threads used by the parallel array operations, 0 means one per core */
+	DLLEXPORT void set_number_of_threads(unsigned int n);
+	DLLEXPORT unsigned int get_number_of_threads();
+
+	/* Calls fn(first, last) on disjoint sub ranges of [begin, end) from a pool of worker threads
+	   and the calling thread. Ranges are at least min_chunk long, small ranges and calls made
+	   from inside fn run on the calling thread. */
+	DLLEXPORT void parallel_for(long begin, long end, const std::function<void(long, long)>& fn, long min_chunk = 1);
+}
+
+#endif //_PARALLEL_HPP_
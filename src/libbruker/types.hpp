@@ -6,6 +6,7 @@
 #include <complex>
 
 #include "ndarray.hpp"
+#include "ndarrayview.hpp"
 
 namespace mr_recon
 {
@@ -15,6 +16,9 @@ namespace mr_recon
 	typedef NDArray<ComplexFloat> ComplexFloatArray;
 	typedef NDArray<ComplexDouble> ComplexDoubleArray;
 
+	typedef NDArrayView<ComplexFloat> ComplexFloatArrayView;
+	typedef NDArrayView<ComplexDouble> ComplexDoubleArrayView;
+
 }
 
 #endif //DATA_TYPES_HPP
@@ -8,9 +8,27 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
 
 #include "brukerrawdata.hpp"
+#include "brukerprofileselection.hpp"
 #include "brukerparameterparser.hpp"
+#include "brukerfidfollower.hpp"
+#include "brukerasyncfidreader.hpp"
+#include "brukersignalstatistics.hpp"
+#include "brukerpreview.hpp"
+#include "brukerstageprofiler.hpp"
+#include "brukertrace.hpp"
+#include "brukerprogressreporter.hpp"
+#include "brukermemory.hpp"
+#include "brukerallocationcounter.hpp"
+#include "acquisitionsink.hpp"
+#include "compressedsink.hpp"
+#include "chunkeddatasetsink.hpp"
+#include "shardeddatasetsink.hpp"
 
 #include "ismrmrd/ismrmrd.h"
 #include "ismrmrd/xml.h"
@@ -19,12 +37,58 @@
 
 namespace po = boost::program_options;
 
+// Profile filter for the fid reader in a shard writer
+static bool ShardOwnsProfile(BrukerRawDataProfile* p, void* user)
+{
+    return static_cast<ShardedDatasetSink*>(user)->OwnsRepetition(p->GetRepetitionNo());
+}
+
+// Appends the four ky boundary variants of a header: none, first, last and first and last,
+// so the conversion loop only selects a template instead of rewriting the flags per profile
+static void PushBoundaryTemplates(std::vector<ISMRMRD::AcquisitionHeader>& templates, const ISMRMRD::AcquisitionHeader& head)
+{
+    for (int boundary = 0; boundary < 4; boundary++) {
+        ISMRMRD::AcquisitionHeader h = head;
+        h.clearAllFlags();
+        if (boundary & 1) {
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_ENCODE_STEP1);
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_REPETITION);
+        }
+        if (boundary & 2) {
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_ENCODE_STEP1);
+            h.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_REPETITION);
+        }
+        templates.push_back(h);
+    }
+}
+
 int main(int argc, char** argv)
 {
 
     std::string in_filename;
     std::string out_filename;
     std::string out_group;
+    double follow_timeout;
+    int compression_level;
+    unsigned int compression_threads;
+    unsigned int compression_chunk;
+    HDF5LayoutOptions layout;
+    unsigned int shard_repetitions;
+    unsigned int writers;
+    unsigned int readahead;
+    unsigned long int read_block;
+    std::string stats_filename;
+    std::string preview_filename;
+    std::string profile_filename;
+    std::string trace_filename;
+    unsigned int trace_events;
+    double progress_interval;
+    std::string max_memory_text;
+    std::string progress_format;
+    std::string select_ranges[BrukerProfileSelection::SELECT_DIMENSION_MAX];
+    std::string channel_layout;
     
     // Set up the command line interface options
     po::options_description desc("Allowed options");
@@ -35,6 +99,35 @@ int main(int argc, char** argv)
             ("outfile,o", po::value<std::string>(&out_filename)->default_value("out.h5"), "Output file")
             ("out-group,G", po::value<std::string>(&out_group)->default_value("dataset"), "Output group name") 
             ("no-subject,N","no subject information") 
+            ("follow,F", "follow a fid that is still being acquired")
+            ("follow-timeout", po::value<double>(&follow_timeout)->default_value(30.0), "Seconds without fid growth before giving up in follow mode")
+            ("stream,S", "write the ISMRMRD streaming protocol to the output file instead of HDF5")
+            ("compression-level,Z", po::value<int>(&compression_level)->default_value(0), "Write compressed samples with shuffle and deflate at this level (1-9), 0 writes a standard ISMRMRD dataset; the compressed layout cannot be read by ISMRMRD readers such as Gadgetron")
+            ("compression-threads", po::value<unsigned int>(&compression_threads)->default_value(0), "Number of compression threads, 0 uses all cores")
+            ("compression-chunk", po::value<unsigned int>(&compression_chunk)->default_value(0), "Profiles per compressed chunk, 0 picks about 1 MB chunks")
+            ("chunked-writer", "write the acquisitions in HDF5 chunks aligned with the repetitions instead of through ISMRMRD::Dataset")
+            ("chunk-profiles", po::value<unsigned int>(&layout.chunk_profiles)->default_value(0), "Acquisitions per HDF5 chunk of the chunked writer, 0 aligns chunks with repetitions")
+            ("chunk-cache", po::value<unsigned long int>(&layout.cache_bytes)->default_value(0), "HDF5 raw data chunk cache in bytes of the chunked writer, 0 derives it from the chunk size")
+            ("alignment", po::value<unsigned long int>(&layout.alignment)->default_value(0), "HDF5 file space alignment in bytes of the chunked writer, 0 uses 4096, 1 disables")
+            ("shard-repetitions", po::value<unsigned int>(&shard_repetitions)->default_value(0), "Write blocks of this many repetitions to separate shard files linked from the output file, 0 disables sharding")
+            ("writers", po::value<unsigned int>(&writers)->default_value(0), "Number of parallel shard writers, 0 uses all cores")
+            ("readahead", po::value<unsigned int>(&readahead)->default_value(8), "Number of large fid reads kept in flight, 0 reads one profile at a time")
+            ("read-block", po::value<unsigned long int>(&read_block)->default_value(4*1024*1024), "Size in bytes of each large fid read")
+            ("stats-json", po::value<std::string>(&stats_filename), "Write per channel signal statistics, collected while decoding, to this JSON file")
+            ("preview", po::value<std::string>(&preview_filename), "Write a magnitude image of the center slice of the first repetition to this PGM file")
+            ("profile-json", po::value<std::string>(&profile_filename), "Write wall time, CPU time, bytes and calls of each conversion stage to this JSON file")
+            ("trace-json", po::value<std::string>(&trace_filename), "Record trace events of parsing, reads, decoding and writes and write them to this Chrome trace_event JSON file")
+            ("max-memory", po::value<std::string>(&max_memory_text), "Memory budget for the conversion buffers, e.g. 512M or 4G; read-ahead, output chunks and compression threads are sized to fit")
+            ("check-allocations", "Fail if any thread of the conversion allocates memory once the first repetition is done (needs the bruker_to_ismrmrd_counting build)")
+            ("progress", po::value<double>(&progress_interval)->default_value(1.0), "Seconds between progress reports, 0 disables them")
+            ("progress-format", po::value<std::string>(&progress_format)->default_value("text"), "Progress report format: text or json (one object per line)")
+            ("trace-events", po::value<unsigned int>(&trace_events)->default_value(65536), "Most recent trace events kept per thread")
+            ("repetitions", po::value<std::string>(&select_ranges[BrukerProfileSelection::SELECT_REPETITION]), "Convert only these repetitions, e.g. 0-9,20,100- (0 based)")
+            ("slices", po::value<std::string>(&select_ranges[BrukerProfileSelection::SELECT_SLICE]), "Convert only these slices")
+            ("echoes", po::value<std::string>(&select_ranges[BrukerProfileSelection::SELECT_ECHO]), "Convert only these echoes")
+            ("ky", po::value<std::string>(&select_ranges[BrukerProfileSelection::SELECT_KY]), "Convert only these ky encoding steps (0 based, as written to the acquisitions)")
+            ("kz", po::value<std::string>(&select_ranges[BrukerProfileSelection::SELECT_KZ]), "Convert only these kz encoding steps")
+            ("channel-layout", po::value<std::string>(&channel_layout)->default_value("sequential"), "Receiver channels within a profile of the fid: sequential (ParaVision) or interleaved (sample by sample)")
             ;
 
     po::variables_map vm;
@@ -54,6 +147,64 @@ int main(int argc, char** argv)
 
     bool subject_info = true;
     if(vm.count("no-subject")) subject_info = false;
+    bool follow = (vm.count("follow") > 0);
+    bool stream = (vm.count("stream") > 0);
+
+    if (compression_level < 0 || compression_level > 9) {
+        std::cerr << "Compression level must be between 0 and 9" << std::endl;
+        return -1;
+    }
+    if (compression_level > 0 && stream) {
+        std::cerr << "Compressed output cannot be combined with stream output" << std::endl;
+        return -1;
+    }
+    if (shard_repetitions > 0 && (stream || compression_level > 0)) {
+        std::cerr << "Sharded output cannot be combined with stream or compressed output" << std::endl;
+        return -1;
+    }
+
+    // ISMRMRD::Dataset writes the HDF5 output unless the chunked writer is asked for, by name,
+    // by one of its layout options or by sharding, which joins chunked shard files
+    bool chunked_writer = compression_level == 0 && !stream &&
+        (vm.count("chunked-writer") || shard_repetitions > 0 || !vm["chunk-profiles"].defaulted() ||
+         !vm["chunk-cache"].defaulted() || !vm["alignment"].defaulted());
+    if (shard_repetitions > 0 && (vm.count("stats-json") || vm.count("preview"))) {
+        std::cerr << "Signal statistics and previews are not available with sharded output" << std::endl;
+        return -1;
+    }
+    if (channel_layout != "sequential" && channel_layout != "interleaved") {
+        std::cerr << "Channel layout must be sequential or interleaved" << std::endl;
+        return -1;
+    }
+    if (progress_format != "text" && progress_format != "json") {
+        std::cerr << "Progress format must be text or json" << std::endl;
+        return -1;
+    }
+    bool check_allocations = (vm.count("check-allocations") > 0);
+    if (check_allocations && !BrukerAllocationCounter::IsEnabled()) {
+        std::cerr << "Allocation checks need a build with the counting allocator (bruker_to_ismrmrd_counting)" << std::endl;
+        return -1;
+    }
+    if (check_allocations && shard_repetitions > 0) {
+        std::cerr << "Allocation checks are not available with sharded output" << std::endl;
+        return -1;
+    }
+    if (check_allocations && vm.count("preview")) {
+        std::cerr << "Allocation checks are not available with a preview, it reconstructs while converting" << std::endl;
+        return -1;
+    }
+    // Profiles outside the selection are left out of the profile list, so they are never read
+    BrukerProfileSelection selection;
+    for (int d = 0; d < BrukerProfileSelection::SELECT_DIMENSION_MAX; d++) {
+        BrukerProfileSelection::SelectionDimension dim = static_cast<BrukerProfileSelection::SelectionDimension>(d);
+        if (vm.count(BrukerProfileSelection::GetDimensionName(dim)) && !selection.SetRanges(dim, select_ranges[d])) return -1;
+    }
+    if (writers == 0) writers = std::thread::hardware_concurrency();
+    unsigned long int max_memory = 0;
+    if (vm.count("max-memory") && !BrukerMemory::ParseSize(max_memory_text, max_memory)) {
+        std::cerr << "Invalid memory size " << max_memory_text << ", expected e.g. 512M or 4G" << std::endl;
+        return -1;
+    }
 
     std::cout << "Bruker ISMRMRD converter" << std::endl;
 
@@ -63,14 +214,50 @@ int main(int argc, char** argv)
     std::string methodfilename = in_filename + std::string("/method");
     std::string subjectfilename = in_filename + std::string("/../subject");
 
+    // Tracing starts before any other thread does, the stages below are trace events too
+    bool tracing = (vm.count("trace-json") > 0);
+    if (tracing) {
+        BrukerTrace::Enable(trace_events);
+        BrukerTrace::SetThreadName("main");
+    }
+
+    // Stages of the conversion for --profile-json, the per profile ones sample the CPU clock
+    BrukerStageProfiler profiler(vm.count("profile-json") > 0 || tracing);
+    unsigned int stage_parse = profiler.AddStage("parse_parameters");
+    unsigned int stage_profile_list = profiler.AddStage("profile_list");
+    unsigned int stage_header = profiler.AddStage("write_header");
+    unsigned int stage_wait = profiler.AddStage("follow_wait", 16);
+    unsigned int stage_read = profiler.AddStage("fid_read", 16);
+    unsigned int stage_convert = profiler.AddStage("convert", 16);
+    unsigned int stage_append = profiler.AddStage("append_acquisition", 16);
+    unsigned int stage_close = profiler.AddStage("close_output");
+    profiler.SetInfo("input", in_filename);
+    profiler.SetInfo("output", out_filename);
+    char hostname[256] = "";
+    if (gethostname(hostname, sizeof(hostname) - 1) == 0) profiler.SetInfo("host", hostname);
+
     // Parse Bruker parameters
+    profiler.Begin(stage_parse);
     BrukerParameterFile acqpar(acqpfilename);
     BrukerParameterFile methodpar(methodfilename);
     BrukerParameterFile subjectpar(subjectfilename);
+    profiler.End(stage_parse);
 
     // Get the profile list and the first profile
+    profiler.Begin(stage_profile_list);
     BrukerProfileListGenerator lg;
+    if (!selection.SelectsAll()) lg.SetSelection(&selection);
+    if (channel_layout == "interleaved") lg.SetChannelLayout(BrukerRawDataProfile::CHANNELS_INTERLEAVED);
     BrukerRawDataProfile* first = lg.GetProfileList(&acqpar,&methodpar);
+    profiler.End(stage_profile_list);
+    if (!selection.SelectsAll()) {
+        std::cout << "Selected " << lg.GetNumberOfSelectedProfiles() << " of " << lg.GetNumberOfFidProfiles()
+                  << " profiles (" << selection.Describe() << ")" << std::endl;
+    }
+    if (!first) {
+        std::cerr << "No profiles to convert" << std::endl;
+        return -1;
+    }
 
     // Some parameters from the profile list
     int size_kx = lg.GetDimensionSize(0);
@@ -79,14 +266,13 @@ int main(int argc, char** argv)
     int no_objects = lg.GetNumberOfObjects();
     int no_echos = lg.GetNumberOfEchos();
     int no_repetitions = lg.GetNumberOfRepetitions();
+    int selected_repetitions = lg.GetNumberOfSelectedRepetitions();
     int ky_min = lg.GetMinEncodingStep1();
     int ky_max = lg.GetMaxEncodingStep1();
     int kz_min = lg.GetMinEncodingStep2();
     int kz_max = lg.GetMaxEncodingStep2();
 
-    // Some parameters from the acqp and method files
-    // TODO most of these can probably found in the lg above
-    // have to add some methods to the BrukerProfileListGenerator
+    // Parameters from the acqp and method files that the profile list generator does not read
     BrukerParameter* p;
     p = acqpar.FindParameter("SW");
     int freq = floor(p->GetValue(0)->GetFloatValue() * 1000000);
@@ -96,10 +282,15 @@ int main(int argc, char** argv)
     //std::string image_type = p->GetValue(0)->GetStringValue(); // 2D or 3D acq marker
     //bool threed = image_type.compare("2D");
     
+    // The acquisitions hold the samples of each channel as they are in the fid,
+    // which may be more than the encoding matrix when the readout is oversampled
     p = methodpar.FindParameter("PVM_EncMatrix");
-    int nx = p->GetValue(0)->GetIntValue();
+    int recon_nx = p->GetValue(0)->GetIntValue();
+    int nx = (lg.GetNumberOfSamples() > 0) ? lg.GetNumberOfSamples() : recon_nx;
     int ny = p->GetValue(1)->GetIntValue();
-    int nz = lg.GetNumberOfObjects() / lg.GetNumberOfEchos();
+    // A missing or zero ACQ_n_echo_images means a single echo
+    int template_echos = (no_echos > 0) ? no_echos : 1;
+    int nz = no_objects / template_echos;
     int nc = lg.GetNumberOfChannels();
 
     p = methodpar.FindParameter("PVM_Fov");
@@ -161,8 +352,6 @@ int main(int argc, char** argv)
          }
      }
 
-    std::cout << "YO MAMA!" << std::endl;
-    
 
     // Write some info out to the user
     //lg.PrintParameters();            
@@ -181,8 +370,113 @@ int main(int argc, char** argv)
     //std::cout << "FOV_y: " << fovy << std::endl;
     //std::cout << "FOV_z: " << fovz << std::endl;
 
-    // Create the dataset
-    ISMRMRD::Dataset dataset(out_filename.c_str(), out_group.c_str());
+    // When the profiles follow each other in the file it is read front to back through one large
+    // stream buffer, without a single seek and without the fid reader
+    bool sequential_reads = lg.IsSequentialLayout();
+    unsigned long int stream_block = read_block;
+
+    // Fit the buffers into --max-memory: what cannot shrink is reserved first, then the read
+    // buffers get a third of the rest and the output buffers what is left
+    BrukerMemoryBudget budget(max_memory);
+    if (budget.IsLimited()) {
+        unsigned long int profiles = 0;
+        unsigned long int max_read_size = 0;
+        for (BrukerRawDataProfile* pr = first; pr; pr = pr->GetNext()) {
+            profiles++;
+            if (pr->GetReadSize() > max_read_size) max_read_size = pr->GetReadSize();
+        }
+        unsigned long int profile_bytes = static_cast<unsigned long int>(nx)*nc*sizeof(std::complex<float>);
+        unsigned int processes = (chunked_writer && shard_repetitions > 0) ? writers : 1;
+
+        bool fits = budget.Reserve("profile list", profiles*(sizeof(BrukerRawDataProfile) + 16));
+        fits = fits && budget.Reserve("acquisition", processes*(profile_bytes + max_read_size));
+        if (vm.count("preview")) {
+            fits = fits && budget.Reserve("preview", static_cast<unsigned long int>(nx)*(ky_max - ky_min + 1)*nc*2*sizeof(std::complex<float>));
+        }
+        if (!fits) {
+            std::cerr << "The conversion does not fit into " << BrukerMemory::FormatSize(max_memory) << std::endl;
+            return -1;
+        }
+
+        // A sequential fid only needs its stream buffer. Otherwise the fid reader shrinks: smaller
+        // reads first, fewer of them in flight next, one profile at a time last
+        if (sequential_reads) {
+            unsigned long int stream_share = budget.Share("stream buffer", 1.0/3.0) / processes;
+            if (stream_block > stream_share) stream_block = stream_share;
+        } else if (!follow) {
+            unsigned long int read_share = budget.Share("read buffers", 1.0/3.0) / processes;
+            while (readahead > 0 && readahead*read_block > read_share) {
+                if (read_block > 65536 && read_block/2 >= max_read_size) read_block /= 2;
+                else if (readahead > 1) readahead--;
+                else readahead = 0;
+            }
+        }
+
+        unsigned long int output_share = budget.Share("output buffers", 1.0) / processes;
+        if (compression_level > 0) {
+            // Each compression thread keeps two blocks in flight and compresses into two more buffers
+            if (compression_threads == 0) compression_threads = std::thread::hardware_concurrency();
+            if (compression_threads == 0) compression_threads = 1;
+            unsigned long int chunk = (compression_chunk ? compression_chunk : std::max(1UL, (1UL << 20)/profile_bytes))*profile_bytes;
+            while (compression_threads > 1 && 4UL*compression_threads*chunk > output_share) compression_threads--;
+            if (4UL*chunk > output_share) {
+                compression_chunk = static_cast<unsigned int>(std::max(1UL, output_share/(4UL*profile_bytes)));
+            }
+        } else if (chunked_writer) {
+            // One chunk of pending acquisitions and the chunk cache per writer
+            unsigned long int per_profile = profile_bytes + sizeof(HDF5Acquisition) + sizeof(unsigned long int);
+            layout.FillDefaults(nx, nc, profiles / (selected_repetitions > 0 ? selected_repetitions : 1));
+            if (layout.cache_bytes > output_share/4) layout.cache_bytes = output_share/4;
+            unsigned long int max_chunk = (output_share - layout.cache_bytes)/per_profile;
+            if (layout.chunk_profiles > max_chunk) layout.chunk_profiles = static_cast<unsigned int>(std::max(1UL, max_chunk));
+        }
+
+        budget.PrintPlan(std::cout);
+        if (sequential_reads) std::cout << "  fid stream buffer: " << BrukerMemory::FormatSize(stream_block);
+        else std::cout << "  fid reads: " << (readahead ? readahead : 1) << " x " << BrukerMemory::FormatSize(readahead ? read_block : max_read_size);
+        if (compression_level > 0) std::cout << ", compression: " << compression_threads << " threads";
+        if (chunked_writer) std::cout << ", output chunks: " << layout.chunk_profiles << " acquisitions, chunk cache " << BrukerMemory::FormatSize(layout.cache_bytes);
+        std::cout << std::endl;
+    }
+
+    // Create the output
+    AcquisitionSink* sink = 0;
+    CompressedSink* compressed = 0;
+    ShardedDatasetSink* sharded = 0;
+    if (compression_level > 0) {
+        compressed = new CompressedSink(out_filename, out_group, nx, nc, compression_level, compression_threads, compression_chunk);
+        if (!compressed->IsOpen()) {
+            delete compressed;
+            return -1;
+        }
+        sink = compressed;
+    } else if (stream) {
+        StreamSink* s = new StreamSink(out_filename);
+        if (!s->IsOpen()) {
+            std::cerr << "Error opening output stream " << out_filename << std::endl;
+            delete s;
+            return -1;
+        }
+        sink = s;
+    } else if (!chunked_writer) {
+        sink = new DatasetSink(out_filename, out_group);
+    } else {
+        layout.FillDefaults(nx, nc, lg.GetNumberOfSelectedProfiles() / (selected_repetitions > 0 ? selected_repetitions : 1));
+        if (shard_repetitions > 0) {
+            // Only the shards of the selected repetitions are written
+            sharded = new ShardedDatasetSink(out_filename, out_group, layout, shard_repetitions, writers);
+            sharded->SetRepetitions(no_repetitions > 0 ? no_repetitions : 1, selection.SelectsAll() ? 0 : &selection);
+            sink = sharded;
+        }
+    }
+    if (!sink) {
+        ChunkedDatasetSink* s = new ChunkedDatasetSink(out_filename, out_group, layout);
+        if (!s->IsOpen()) {
+            delete s;
+            return -1;
+        }
+        sink = s;
+    }
 
     //Let's create a header, we will use the C++ classes in ismrmrd/xml.h
     ISMRMRD::IsmrmrdHeader h;
@@ -202,7 +496,7 @@ int main(int argc, char** argv)
     e.encodedSpace.fieldOfView_mm.x = fovx;
     e.encodedSpace.fieldOfView_mm.y = fovy;
     e.encodedSpace.fieldOfView_mm.z = fovz;
-    e.reconSpace.matrixSize.x = nx;
+    e.reconSpace.matrixSize.x = recon_nx;
     e.reconSpace.matrixSize.y = ny;
     e.reconSpace.matrixSize.z = size_kz;
     e.reconSpace.fieldOfView_mm.x = fovx;
@@ -225,95 +519,350 @@ int main(int argc, char** argv)
 
     //Add any additional fields that you may want would go here....
 
-    //Serialize the header
-    std::stringstream str;
-    ISMRMRD::serialize( h, str);
-    std::string xml_header = str.str();
-    //std::cout << xml_header << std::endl;
-        
-    //Write the header to the data file.
-    dataset.writeHeader(xml_header);
+    //Write the header to the output
+    profiler.Begin(stage_header);
+    sink->WriteHeader(h);
+    profiler.End(stage_header);
     std::cout << "Wrote XML header" << std::endl;
 
+    // Each shard writer is a separate process that converts its own repetitions
+    bool writers_started = true;
+    if (sharded) {
+        std::cout << "Converting blocks of " << shard_repetitions << " repetitions with " << writers << " writers" << std::endl;
+        writers_started = sharded->StartWriters();
+    }
+
     // Create an ISMRMRD acquisition
     ISMRMRD::Acquisition acq;
     acq.resize(nx,nc);
     acq.center_sample() = nx/2;
+    acq.available_channels() = nc;
+    p = acqpar.FindParameter("SW_h");
+    if (p && p->GetValue(0)->GetFloatValue() > 0.0f) {
+        acq.sample_time_us() = 1.0e6f / p->GetValue(0)->GetFloatValue();
+    }
 
-    // TODO: These are definitely wrong
-    // Consider looking at ACQ_grad_matrix?
-    acq.read_dir()[0] = 1.;
-    acq.phase_dir()[1] = 1.;
-    acq.slice_dir()[2] = 1.;
+    // One complete header per (slice, echo): the rows of ACQ_grad_matrix are the read, phase
+    // and slice directions and the offsets, given along those, place the slice in the magnet.
+    // In 3D the slice direction is phase encoded and ACQ_phase2_offset centres the field of
+    // view along it; ACQ_slice_offset then only positions the excited slab.
+    // Each header comes in four ky boundary variants carrying the first/last flags; the loop
+    // copies the template when the slice, echo or boundary changes and stamps the counters.
+    bool threed = lg.GetNumberOfDimensions() > 2;
+    std::vector<ISMRMRD::AcquisitionHeader> header_templates;
+    for (int s = 0; s < nz; s++) {
+        float partition_offset_mm = threed ? phase2_offset_mm[s] : slice_offset_mm[s];
+        for (int e = 0; e < template_echos; e++) {
+            acq.idx().slice = s;
+            acq.idx().contrast = e;
+            for ( int i=0; i<3; i++ ) {
+                acq.read_dir()[i] = grad_matrix[s][0][i];
+                acq.phase_dir()[i] = grad_matrix[s][1][i];
+                acq.slice_dir()[i] = grad_matrix[s][2][i];
+                acq.position()[i] = read_offset_mm[s]*grad_matrix[s][0][i]
+                                  + phase1_offset_mm[s]*grad_matrix[s][1][i]
+                                  + partition_offset_mm*grad_matrix[s][2][i];
+            }
+            PushBoundaryTemplates(header_templates, acq.getHead());
+        }
+    }
+    // Slices without geometry in the acqp get the axial directions at the isocentre
+    for (int e = 0; e < template_echos; e++) {
+        acq.idx().contrast = e;
+        for ( int i=0; i<3; i++ ) {
+            acq.read_dir()[i] = (i == 0) ? 1.0f : 0.0f;
+            acq.phase_dir()[i] = (i == 1) ? 1.0f : 0.0f;
+            acq.slice_dir()[i] = (i == 2) ? 1.0f : 0.0f;
+            acq.position()[i] = 0.0f;
+        }
+        PushBoundaryTemplates(header_templates, acq.getHead());
+    }
+    int current_template = -1;
+    bool reported_slice = false;
+
+    // In follow mode the fid may not even exist yet
+    BrukerFidFollower follower(fidfilename, follow_timeout);
+    if (follow) {
+        std::cout << "Following fid file, expecting " << lg.GetExpectedFileSize() << " bytes" << std::endl;
+        if (!follower.WaitForBytes(1)) {
+            std::cerr << "Error waiting for fid file " << fidfilename << std::endl;
+            delete sink;
+            return -1;
+        }
+    }
 
     // open input fid file
+    // Without the fid reader the profiles are read from this stream
+    std::vector<char> stream_buffer;
+    BrukerMemoryScope stream_buffer_memory(BrukerMemory::MEMORY_READ_BUFFERS);
     std::ifstream fidfile;
+    if (sequential_reads && stream_block > 0) {
+        stream_buffer.resize(stream_block);
+        stream_buffer_memory.Set(stream_buffer.size());
+        fidfile.rdbuf()->pubsetbuf(&stream_buffer[0], stream_buffer.size());
+    }
     fidfile.open(fidfilename.c_str(),std::ifstream::in | std::ifstream::binary );
     if (!fidfile)
     {
         std::cerr << "Error opening fid file" << in_filename << std::endl;
+        delete sink;
         return -1;
     }
     else
     {
         std::cout << "Reading from fid file " << in_filename << std::endl;
+        if (sequential_reads) std::cout << "Sequential fid layout, reading without seeks" << std::endl;
+    }
+
+    // The preview is reconstructed in the background once its profiles have been converted
+    BrukerPreview* preview = 0;
+    if (vm.count("preview")) {
+        preview = new BrukerPreview(preview_filename);
+        if (!preview->Setup(lg, first, nc)) {
+            delete preview;
+            preview = 0;
+        }
+    }
+
+    // Statistics are gathered in the decode itself, without another pass over the data
+    BrukerSignalStatistics* statistics = 0;
+    if (vm.count("stats-json")) {
+        statistics = new BrukerSignalStatistics(nc);
+    }
+
+    // A following conversion has to wait for each profile, so it reads one at a time
+    BrukerAsyncFidReader* reader = 0;
+    if (readahead > 0 && !follow && !sequential_reads) {
+        reader = new BrukerAsyncFidReader(readahead, read_block);
+        if (!reader->Open(fidfilename) || !reader->Start(first, sharded ? ShardOwnsProfile : 0, sharded)) {
+            std::cerr << "Error starting fid reader" << std::endl;
+            delete statistics;
+            delete preview;
+            delete reader;
+            delete sink;
+            return -1;
+        }
+    }
+
+    // Progress is reported from its own thread, the loop only bumps the counters.
+    // Shard writers convert in separate processes, so there is nothing to report here. The reports
+    // are formatted on the reporting thread, which allocates, so allocation checks go without.
+    BrukerProgressReporter* progress = 0;
+    if (progress_interval > 0.0 && !sharded && !check_allocations) {
+        unsigned long int total_profiles = 0;
+        unsigned long int total_bytes = 0;
+        for (BrukerRawDataProfile* pr = first; pr; pr = pr->GetNext()) {
+            total_profiles++;
+            total_bytes += pr->GetReadSize();
+        }
+        progress = new BrukerProgressReporter(total_profiles, total_bytes,
+                                              progress_format == "json" ? BrukerProgressReporter::PROGRESS_JSON : BrukerProgressReporter::PROGRESS_TEXT,
+                                              progress_interval, std::cerr, isatty(STDERR_FILENO) != 0);
+        progress->SetNumberOfRepetitions(no_repetitions > 0 ? no_repetitions : 1);
+        progress->SetNumberOfSlices(lg.GetNumberOfSlices() > 0 ? lg.GetNumberOfSlices() : 1);
+        progress->Start();
+    }
+
+    // The buffers have grown to their final size once the first repetition, or with a single
+    // repetition the first half of the profiles, has been converted; after that no thread of the
+    // pipeline (reads, conversion, compression, HDF5 writes) may allocate
+    int64_t steady_start = -1;
+    unsigned long int steady_allocations = 0;
+    if (check_allocations) {
+        int64_t n = 0;
+        for (BrukerRawDataProfile* pr = first; pr; pr = pr->GetNext(), n++) {
+            if (steady_start < 0 && pr->GetRepetitionNo() != first->GetRepetitionNo()) steady_start = n;
+        }
+        if (steady_start < 0) steady_start = n/2;
     }
 
     // Loop over data set to read it in, convert it and write it out
     int64_t counter = 0;
     BrukerRawDataProfile* current = first;
-    float* data_ptr = 0;
+
+    // Per profile latency from the bytes being on disk to the acquisition being written
+    double latency_sum = 0.0;
+    double latency_max = 0.0;
+    bool timed_out = false;
+    bool read_failed = false;
+
+    // Raw profile bytes when reading without the fid reader, and where that stream stands
+    std::vector<char> raw_buffer;
+    unsigned long int fid_position = 0;
 
     while (current) {
 
+        if (counter == steady_start) steady_allocations = BrukerAllocationCounter::GetTotalAllocations();
+
+        if (sharded && !sharded->OwnsRepetition(current->GetRepetitionNo())) {
+            current = current->GetNext();
+            counter++;
+            continue;
+        }
+
+        int slice_template = current->GetSliceNo();
+        if (current->GetSliceNo() >= static_cast<unsigned int>(nz)) {
+            if (!reported_slice) {
+                std::cerr << "Slice " << current->GetSliceNo() << " has no geometry in the acqp, writing it without position" << std::endl;
+                reported_slice = true;
+            }
+            slice_template = nz;
+        }
+        int echo_template = (current->GetEchoNo() < static_cast<unsigned int>(template_echos)) ? current->GetEchoNo() : 0;
+        int boundary = ((current->GetEncodeStep1() == ky_min) ? 1 : 0) | ((current->GetEncodeStep1() == ky_max) ? 2 : 0);
+        int template_index = (slice_template*template_echos + echo_template)*4 + boundary;
+        if (template_index != current_template) {
+            current_template = template_index;
+            acq.setHead(header_templates[current_template]);
+        }
         acq.scan_counter() = counter;
+        acq.idx().slice = current->GetSliceNo();
         acq.idx().kspace_encode_step_1 = current->GetEncodeStep1()+(size_ky>>1);
         acq.idx().kspace_encode_step_2 = current->GetEncodeStep2()+(size_kz>>1);
-        acq.idx().slice = current->GetSliceNo();
-        acq.idx().contrast = current->GetEchoNo();
         acq.idx().repetition = current->GetRepetitionNo();
-        int curslice = counter % nz;
-        for ( int i=0; i<2; i++ ) {
-             acq.read_dir()[i] = grad_matrix[curslice][0][i];
-             acq.phase_dir()[i] = grad_matrix[curslice][1][i];
-             acq.slice_dir()[i] = grad_matrix[curslice][2][i];
-        }
 
-        // Set some flags
-        // TODO: this needs fleshing out
-        acq.clearAllFlags();
-        if (current->GetEncodeStep1() == ky_min) {
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_ENCODE_STEP1);
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_REPETITION);
-        }
-        if (current->GetEncodeStep1() == ky_max) {
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_ENCODE_STEP1);
-            acq.setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_REPETITION);
+        // read the data
+        double t_available = 0.0;
+        if (follow) {
+            profiler.Begin(stage_wait);
+            bool available = follower.WaitForBytes(current->GetFilePosition() + current->GetReadSize());
+            profiler.End(stage_wait);
+            if (!available) {
+                timed_out = true;
+                break;
+            }
+            t_available = BrukerMonotonicSeconds();
         }
 
-        // read the data
-        // convert to complex float and stuff
-        current->SetProfileLength(nx*nc);
-        current->ReadData(fidfile);
-        data_ptr = current->GetDataPtr();
-        for (int c=0; c<nc; c++) {
-            for (int s=0; s< nx; s++) {
-                acq.data(s,c) = std::complex<float>(data_ptr[2*(nx*c+s)], data_ptr[2*(nx*c+s)+1]);
+        const char* raw_data = 0;
+        profiler.Begin(stage_read);
+        if (reader) {
+            if (reader->NextProfile(&raw_data) != current) {
+                std::cerr << "Fid reader is out of step with the profile list" << std::endl;
+                read_failed = true;
+                break;
             }
+        } else if (current->ReadRawData(fidfile, raw_buffer, fid_position)) {
+            raw_data = &raw_buffer[0];
+        } else {
+            // Appending now would write the previous profile's samples under this header
+            std::cerr << "Unable to read profile " << counter << " from the fid" << std::endl;
+            read_failed = true;
+            break;
         }
+        profiler.End(stage_read, current->GetReadSize());
 
-        // append to the dataset
-        dataset.appendAcquisition(acq);
+        // convert to complex float and stuff
+        profiler.Begin(stage_convert);
+        // The profile layout [samples, channels] is the acquisition payload, so decode straight
+        // into it; the profiles themselves hold no data and the list stays small
+        float* samples = reinterpret_cast<float*>(acq.getDataPtr());
+        current->DecodeData(raw_data, samples, statistics);
+        if (preview) preview->AddProfile(current, samples);
+        profiler.End(stage_convert);
+
+        // append to the output
+        profiler.Begin(stage_append);
+        sink->AppendAcquisition(acq);
+        profiler.End(stage_append, static_cast<unsigned long int>(nx)*nc*sizeof(std::complex<float>));
+
+        if (progress) progress->ProfileDone(current->GetReadSize(), current->GetRepetitionNo(), current->GetSliceNo());
+
+        if (follow) {
+            double latency = BrukerMonotonicSeconds() - t_available;
+            latency_sum += latency;
+            if (latency > latency_max) latency_max = latency;
+        }
 
         // next
         current = current->GetNext();
         counter++;
     }
 
+    if (check_allocations) {
+        steady_allocations = (counter > steady_start) ? BrukerAllocationCounter::GetTotalAllocations() - steady_allocations : 0;
+        std::cout << "Steady state allocations: " << steady_allocations << " in "
+                  << (counter > steady_start ? counter - steady_start : 0) << " profiles" << std::endl;
+    }
+
     // Close the Bruker file (is this necessary?)
     fidfile.close();
+    delete reader;
+
+    profiler.Begin(stage_close);
+    sink->Close();
+    profiler.End(stage_close);
+    if (progress) {
+        progress->Stop();
+        delete progress;
+    }
+    if (sharded && sharded->IsWriter()) {
+        if (tracing) {
+            // Each writer process traces its own shards next to the main trace
+            std::string::size_type dot = trace_filename.rfind('.');
+            if (dot == std::string::npos || trace_filename.find('/', dot) != std::string::npos) dot = trace_filename.size();
+            std::stringstream writer_trace;
+            writer_trace << trace_filename.substr(0, dot) << "_writer" << sharded->GetWriterIndex() << trace_filename.substr(dot);
+            BrukerTrace::WriteJSON(writer_trace.str());
+        }
+        _exit((sharded->Succeeded() && !timed_out && !read_failed) ? 0 : 1);
+    }
+    if (compressed) compressed->PrintStatistics(std::cout);
+    if (preview) {
+        if (preview->Finish()) {
+            std::cout << "Wrote preview to " << preview_filename << std::endl;
+        }
+        delete preview;
+    }
+    bool sink_failed = (sharded && (!writers_started || !sharded->Succeeded()));
+    delete sink;
+
+    if (sink_failed) {
+        std::cerr << "Sharded conversion failed" << std::endl;
+        return -1;
+    }
+
+    BrukerMemory::PrintReport(std::cout);
+
+    if (follow && counter > 0) {
+        std::cout << "Profile latency: mean " << 1000.0*latency_sum/counter
+                  << " ms, max " << 1000.0*latency_max << " ms over " << counter << " profiles" << std::endl;
+    }
+
+    if (vm.count("profile-json")) {
+        if (!profiler.WriteJSON(profile_filename)) return -1;
+        std::cout << "Wrote stage timings to " << profile_filename << std::endl;
+    }
+
+    if (tracing) {
+        if (!BrukerTrace::WriteJSON(trace_filename)) return -1;
+        std::cout << "Wrote " << BrukerTrace::GetRecordedEvents() - BrukerTrace::GetDroppedEvents()
+                  << " trace events to " << trace_filename;
+        if (BrukerTrace::GetDroppedEvents()) std::cout << " (" << BrukerTrace::GetDroppedEvents() << " older events dropped)";
+        std::cout << std::endl;
+    }
+
+    if (statistics) {
+        bool written = statistics->WriteJSON(stats_filename);
+        delete statistics;
+        if (!written) return -1;
+        std::cout << "Wrote signal statistics to " << stats_filename << std::endl;
+    }
+
+    if (check_allocations && steady_allocations > 0) {
+        std::cerr << "The conversion loop allocated memory in the steady state" << std::endl;
+        return -1;
+    }
+
+    if (timed_out) {
+        std::cerr << "Timed out waiting for the fid after " << counter << " profiles" << std::endl;
+        return -1;
+    }
+
+    if (read_failed) {
+        std::cerr << "Reading the fid failed after " << counter << " profiles, the output is incomplete" << std::endl;
+        return -1;
+    }
 
     // Goodbye
     std::cout << "Conversion complete." << std::endl;
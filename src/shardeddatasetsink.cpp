@@ -0,0 +1,315 @@
+#include "shardeddatasetsink.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+ShardedDatasetSink::ShardedDatasetSink(std::string filename, std::string group, const HDF5LayoutOptions& layout,
+				       unsigned int repetitions_per_shard, unsigned int writers)
+  : m_FileName(filename),
+    m_Group(group),
+    m_Layout(layout),
+    m_uiRepetitionsPerShard(repetitions_per_shard ? repetitions_per_shard : 1),
+    m_uiWriters(writers ? writers : 1),
+    m_uiRepetitions(0),
+    m_uiShardCount(0),
+    m_iWriter(-1),
+    m_pShard(0),
+    m_lCurrentShard(-1),
+    m_bClosed(false),
+    m_bSucceeded(false)
+{
+
+}
+
+ShardedDatasetSink::~ShardedDatasetSink()
+{
+  Close();
+}
+
+std::string ShardedDatasetSink::GetShardFileName(unsigned int shard)
+{
+  std::string base = m_FileName;
+  std::string ext;
+  size_t dot = base.rfind('.');
+  size_t slash = base.rfind('/');
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+    ext = base.substr(dot);
+    base = base.substr(0, dot);
+  }
+  std::stringstream s;
+  s << base << "_shard" << std::setw(4) << std::setfill('0') << shard << ext;
+  return s.str();
+}
+
+void ShardedDatasetSink::SetRepetitions(unsigned int total, const BrukerProfileSelection* selection)
+{
+  /* Shard k holds repetitions k*R to min((k+1)*R, total)-1 and is written if one of them is
+     selected; the other dimensions of a selection apply to every repetition alike */
+  m_uiRepetitions = total;
+  m_uiShardCount = (total + m_uiRepetitionsPerShard - 1) / m_uiRepetitionsPerShard;
+  m_Shards.clear();
+  for (unsigned int k = 0; k < m_uiShardCount; k++) {
+    unsigned int first = k*m_uiRepetitionsPerShard;
+    unsigned int last = std::min(first + m_uiRepetitionsPerShard, total);
+    bool selected = !selection || selection->SelectsAll(BrukerProfileSelection::SELECT_REPETITION);
+    for (unsigned int r = first; r < last && !selected; r++) {
+      selected = selection->IsSelected(BrukerProfileSelection::SELECT_REPETITION, static_cast<int>(r));
+    }
+    if (selected) m_Shards.push_back(k);
+  }
+}
+
+bool ShardedDatasetSink::StartWriters()
+{
+  /* Make sure nothing buffered is written twice by the children */
+  std::cout.flush();
+  std::cerr.flush();
+
+  /* Remove every shard the scan could have, an earlier run with another selection may have
+     left some that this run does not write */
+  for (unsigned int k = 0; k < m_uiShardCount; k++) {
+    std::string name = GetShardFileName(k);
+    if (unlink(name.c_str()) != 0 && errno != ENOENT) {
+      std::cerr << "ShardedDatasetSink: unable to remove old shard " << name << std::endl;
+      return false;
+    }
+  }
+
+  for (unsigned int w = 0; w < m_uiWriters; w++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      m_iWriter = static_cast<int>(w);
+      m_Pids.clear();
+      return true;
+    }
+    if (pid < 0) {
+      std::cerr << "ShardedDatasetSink: unable to fork writer " << w << std::endl;
+      return false;
+    }
+    m_Pids.push_back(pid);
+  }
+  return true;
+}
+
+bool ShardedDatasetSink::OwnsRepetition(unsigned int repetition)
+{
+  if (m_iWriter < 0) return false;
+  unsigned int shard = repetition / m_uiRepetitionsPerShard;
+  return (shard % m_uiWriters) == static_cast<unsigned int>(m_iWriter);
+}
+
+void ShardedDatasetSink::WriteHeader(const ISMRMRD::IsmrmrdHeader& h)
+{
+  m_Header = h;
+}
+
+bool ShardedDatasetSink::OpenShard(unsigned int shard)
+{
+  if (m_pShard) {
+    m_pShard->Close();
+    delete m_pShard;
+    m_pShard = 0;
+  }
+
+  m_pShard = new ChunkedDatasetSink(GetShardFileName(shard), m_Group, m_Layout);
+  if (!m_pShard->IsOpen()) {
+    delete m_pShard;
+    m_pShard = 0;
+    return false;
+  }
+
+  /* Every shard carries the header so that it can be read on its own */
+  m_pShard->WriteHeader(m_Header);
+  m_lCurrentShard = shard;
+  return true;
+}
+
+void ShardedDatasetSink::AppendAcquisition(const ISMRMRD::Acquisition& acq)
+{
+  unsigned int shard = acq.getHead().idx.repetition / m_uiRepetitionsPerShard;
+  if (static_cast<long>(shard) != m_lCurrentShard) {
+    if (!OpenShard(shard)) {
+      std::cerr << "ShardedDatasetSink: unable to open shard " << GetShardFileName(shard) << std::endl;
+      return;
+    }
+  }
+  m_pShard->AppendAcquisition(acq);
+}
+
+void ShardedDatasetSink::Close()
+{
+  if (m_bClosed) return;
+  m_bClosed = true;
+
+  if (m_iWriter >= 0) {
+    if (m_pShard) {
+      m_pShard->Close();
+      delete m_pShard;
+      m_pShard = 0;
+    }
+    m_bSucceeded = true;
+    return;
+  }
+
+  bool writers_ok = !m_Pids.empty();
+  for (size_t i = 0; i < m_Pids.size(); i++) {
+    int status = 0;
+    if (waitpid(m_Pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "ShardedDatasetSink: writer " << i << " failed" << std::endl;
+      writers_ok = false;
+    }
+  }
+  m_Pids.clear();
+
+  m_bSucceeded = writers_ok && CreateShardIndex();
+}
+
+/* One row of <group>/shard_index */
+typedef struct ShardIndexEntry {
+  unsigned int first_repetition;
+  unsigned int repetitions;
+  unsigned long long first_acquisition;
+  unsigned long long acquisitions;
+  char file[256];
+} ShardIndexEntry;
+
+bool ShardedDatasetSink::CreateShardIndex()
+{
+  if (m_Shards.empty()) {
+    std::cerr << "ShardedDatasetSink: no shards were written" << std::endl;
+    return false;
+  }
+
+  /* The shards of the converted repetitions and their sizes, in repetition order */
+  std::vector<ShardIndexEntry> index(m_Shards.size());
+  unsigned long long total = 0;
+  for (size_t i = 0; i < m_Shards.size(); i++) {
+    std::string name = GetShardFileName(m_Shards[i]);
+    if (access(name.c_str(), R_OK) != 0) {
+      std::cerr << "ShardedDatasetSink: shard " << name << " was not written" << std::endl;
+      return false;
+    }
+
+    hid_t file = H5Fopen(name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0) {
+      std::cerr << "ShardedDatasetSink: unable to open shard " << name << std::endl;
+      return false;
+    }
+    hid_t data = H5Dopen2(file, (m_Group + "/data").c_str(), H5P_DEFAULT);
+    hsize_t dims[1] = { 0 };
+    if (data >= 0) {
+      hid_t space = H5Dget_space(data);
+      H5Sget_simple_extent_dims(space, dims, 0);
+      H5Sclose(space);
+      H5Dclose(data);
+    }
+    H5Fclose(file);
+    if (data < 0) {
+      std::cerr << "ShardedDatasetSink: shard " << name << " has no " << m_Group << "/data" << std::endl;
+      return false;
+    }
+
+    /* Relative names are resolved against the directory of the output file */
+    std::string source = name;
+    size_t slash = source.rfind('/');
+    if (slash != std::string::npos) source = source.substr(slash+1);
+    if (source.size() >= sizeof(index[i].file)) {
+      std::cerr << "ShardedDatasetSink: shard name " << source << " is too long for the index" << std::endl;
+      return false;
+    }
+
+    ShardIndexEntry& e = index[i];
+    memset(&e, 0, sizeof(e));
+    e.first_repetition = m_Shards[i]*m_uiRepetitionsPerShard;
+    e.repetitions = std::min(e.first_repetition + m_uiRepetitionsPerShard, m_uiRepetitions) - e.first_repetition;
+    e.first_acquisition = total;
+    e.acquisitions = dims[0];
+    strncpy(e.file, source.c_str(), sizeof(e.file)-1);
+    total += dims[0];
+  }
+
+  hid_t file = H5Fcreate(m_FileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (file < 0) {
+    std::cerr << "ShardedDatasetSink: unable to create " << m_FileName << std::endl;
+    return false;
+  }
+  hid_t group = H5Gcreate2(file, m_Group.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  std::stringstream str;
+  ISMRMRD::serialize(m_Header, str);
+  bool ok = WriteIsmrmrdXmlHeader(group, str.str());
+
+  /* <group>/shards/shardNNNN links to <group>/data of each shard */
+  hid_t links = H5Gcreate2(group, "shards", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  std::vector<std::string> link_names;
+  for (size_t i = 0; i < index.size() && ok; i++) {
+    std::stringstream l;
+    l << "shard" << std::setw(4) << std::setfill('0') << m_Shards[i];
+    link_names.push_back(l.str());
+    if (H5Lcreate_external(index[i].file, (m_Group + "/data").c_str(), links, l.str().c_str(), H5P_DEFAULT, H5P_DEFAULT) < 0) {
+      std::cerr << "ShardedDatasetSink: unable to link " << index[i].file << " in " << m_FileName << std::endl;
+      ok = false;
+    }
+  }
+
+  /* A single shard is also linked as <group>/data, so that ISMRMRD reads the output directly */
+  if (ok && index.size() == 1 &&
+      H5Lcreate_external(index[0].file, (m_Group + "/data").c_str(), group, "data", H5P_DEFAULT, H5P_DEFAULT) < 0) {
+    std::cerr << "ShardedDatasetSink: unable to link " << index[0].file << " as " << m_Group << "/data" << std::endl;
+    ok = false;
+  }
+
+  /* The index: which repetitions and acquisitions each shard holds */
+  hid_t name_type = H5Tcopy(H5T_C_S1);
+  H5Tset_size(name_type, sizeof(index[0].file));
+  H5Tset_strpad(name_type, H5T_STR_NULLTERM);
+  hid_t index_type = H5Tcreate(H5T_COMPOUND, sizeof(ShardIndexEntry));
+  H5Tinsert(index_type, "first_repetition", HOFFSET(ShardIndexEntry, first_repetition), H5T_NATIVE_UINT);
+  H5Tinsert(index_type, "repetitions", HOFFSET(ShardIndexEntry, repetitions), H5T_NATIVE_UINT);
+  H5Tinsert(index_type, "first_acquisition", HOFFSET(ShardIndexEntry, first_acquisition), H5T_NATIVE_ULLONG);
+  H5Tinsert(index_type, "acquisitions", HOFFSET(ShardIndexEntry, acquisitions), H5T_NATIVE_ULLONG);
+  H5Tinsert(index_type, "file", HOFFSET(ShardIndexEntry, file), name_type);
+  hsize_t dims[1] = { index.size() };
+  hid_t space = H5Screate_simple(1, dims, 0);
+  hid_t data = ok ? H5Dcreate2(group, "shard_index", index_type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT) : -1;
+  if (ok && (data < 0 || H5Dwrite(data, index_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &index[0]) < 0)) {
+    std::cerr << "ShardedDatasetSink: unable to write the shard index of " << m_FileName << std::endl;
+    ok = false;
+  }
+  if (data >= 0) H5Dclose(data);
+  H5Sclose(space);
+  H5Tclose(index_type);
+  H5Tclose(name_type);
+
+  /* Read back through the links, so a shard that cannot be found from the output is an error */
+  for (size_t i = 0; i < link_names.size() && ok; i++) {
+    hid_t linked = H5Dopen2(links, link_names[i].c_str(), H5P_DEFAULT);
+    hsize_t linked_dims[1] = { 0 };
+    if (linked >= 0) {
+      hid_t linked_space = H5Dget_space(linked);
+      H5Sget_simple_extent_dims(linked_space, linked_dims, 0);
+      H5Sclose(linked_space);
+      H5Dclose(linked);
+    }
+    if (linked < 0 || linked_dims[0] != index[i].acquisitions) {
+      std::cerr << "ShardedDatasetSink: " << m_Group << "/shards/" << link_names[i] << " does not read back "
+		<< index[i].acquisitions << " acquisitions" << std::endl;
+      ok = false;
+    }
+  }
+
+  H5Gclose(links);
+  H5Gclose(group);
+  H5Fclose(file);
+
+  if (ok) {
+    std::cout << "Wrote " << total << " acquisitions in " << index.size() << " shards" << std::endl;
+  }
+  return ok;
+}
@@ -0,0 +1,88 @@
+/*****************************************************
+ *
+ *  Sharded ISMRMRD output
+ *
+ *  Each block of repetitions is written to its own
+ *  shard file by one of several writer processes.
+ *  When all writers have finished, the output file
+ *  gets the XML header, an index of the shards and
+ *  an external link to the <group>/data of each one.
+ *  Every shard is a complete ISMRMRD dataset. Virtual
+ *  datasets are not used: HDF5 does not map variable
+ *  length acquisitions through them reliably.
+ *
+ *  HDF5 is not thread safe, so the writers are forked
+ *  processes rather than threads. Every writer reads,
+ *  converts and writes its own repetitions, which lets
+ *  the conversion scale with the number of writers.
+ *
+ *****************************************************/
+
+#ifndef SHARDED_DATASET_SINK_HPP
+#define SHARDED_DATASET_SINK_HPP
+
+#include "chunkeddatasetsink.hpp"
+#include "brukerprofileselection.hpp"
+
+#include <vector>
+#include <sys/types.h>
+
+class ShardedDatasetSink : public AcquisitionSink
+{
+public:
+  ShardedDatasetSink(std::string filename, std::string group, const HDF5LayoutOptions& layout,
+		     unsigned int repetitions_per_shard, unsigned int writers);
+  ~ShardedDatasetSink();
+
+  /* The number of repetitions of the scan and the selection of the conversion, 0 for all,
+     which decide the shards that are cleaned up and indexed; call before StartWriters */
+  void SetRepetitions(unsigned int total, const BrukerProfileSelection* selection);
+
+  /* Forks the writers. Returns false in the parent if forking failed. */
+  bool StartWriters();
+
+  /* True in a forked writer, which must exit after Close() */
+  bool IsWriter() { return m_iWriter >= 0; }
+
+  /* Index of a forked writer, -1 in the parent */
+  int GetWriterIndex() { return m_iWriter; }
+
+  /* True if this process converts the given repetition */
+  bool OwnsRepetition(unsigned int repetition);
+
+  void WriteHeader(const ISMRMRD::IsmrmrdHeader& h);
+  void AppendAcquisition(const ISMRMRD::Acquisition& acq);
+
+  /* In a writer, closes the open shard. In the parent, waits for the
+     writers and creates the shard index. */
+  void Close();
+
+  bool Succeeded() { return m_bSucceeded; }
+
+  std::string GetShardFileName(unsigned int shard);
+
+protected:
+  bool OpenShard(unsigned int shard);
+  bool CreateShardIndex();
+
+  std::string m_FileName;
+  std::string m_Group;
+  HDF5LayoutOptions m_Layout;
+  unsigned int m_uiRepetitionsPerShard;
+  unsigned int m_uiWriters;
+  unsigned int m_uiRepetitions;     /* repetitions of the scan */
+  unsigned int m_uiShardCount;      /* shards the scan could have */
+  std::vector<unsigned int> m_Shards; /* shards written by this run, ascending */
+
+  int m_iWriter;
+  std::vector<pid_t> m_Pids;
+
+  ISMRMRD::IsmrmrdHeader m_Header;
+  ChunkedDatasetSink* m_pShard;
+  long m_lCurrentShard;
+
+  bool m_bClosed;
+  bool m_bSucceeded;
+};
+
+#endif //SHARDED_DATASET_SINK_HPP